@@ -25,10 +25,7 @@
 #include "../BleApi/fido_ble.h"
 #include "../BleApi/fido_apduresponses.h"
 
-#include "mincrypt/dsa_sig.h"
-#include "mincrypt/p256.h"
-#include "mincrypt/p256_ecdsa.h"
-#include "mincrypt/sha256.h"
+#include "../../HID/u2f_verify.h"
 
 //#define REPLY_BUFFER_LENGTH 256
 //static unsigned char reply[REPLY_BUFFER_LENGTH];
@@ -163,6 +160,9 @@ ReturnValue BleApiTest_RegisterWrongLength(pBleDevice dev)
 U2F_REGISTER_RESP regRsp;
 U2F_REGISTER_REQ regReq;
 
+// Decoded user and attestation keys, kept across tests.
+U2F_keyCache keyCache;
+
 ReturnValue BleApiTest_Enroll(pBleDevice dev, int expectedSW12)
 {
 	uint64_t t = dev->TimeMs();
@@ -228,47 +228,15 @@ ReturnValue BleApiTest_Enroll(pBleDevice dev, int expectedSW12)
 	    1000.0 << "s";
 
 	// Check crypto of enroll response.
-	std::string cert;
-	CHECK_EQ(getCertificate(regRsp, &cert), true, "Cannot extract certificate.");
-	INFO << "cert: " << bytes2ascii(cert);
-
-	std::string pk;
-	CHECK_EQ(getSubjectPublicKey(cert, &pk), true, "Cannot extract public key.");
-	INFO << "pk  : " << bytes2ascii(pk);
-
-	std::string sig;
-	CHECK_EQ(getSignature(regRsp, static_cast<int>(cert.size()), &sig), true, "Cannot extract signature.");
-	INFO << "sig : " << bytes2ascii(sig);
-
-	// Parse signature into two integers.
-	p256_int sig_r, sig_s;
-	CHECK_EQ(1, dsa_sig_unpack((uint8_t *) (sig.data()), static_cast<int>(sig.size()),
-				   &sig_r, &sig_s), "Cannot unpack signature");
-
-	// Compute hash as integer.
-	const uint8_t *hash;
-	p256_int h;
-	SHA256_CTX sha;
-	SHA256_init(&sha);
-	uint8_t rfu = 0;
-	SHA256_update(&sha, &rfu, sizeof(rfu));	// 0x00
-	SHA256_update(&sha, regReq.appId, sizeof(regReq.appId));	// O
-	SHA256_update(&sha, regReq.nonce, sizeof(regReq.nonce));	// d
-	SHA256_update(&sha, regRsp.keyHandleCertSig, regRsp.keyHandleLen);	// hk
-	SHA256_update(&sha, &regRsp.pubKey, sizeof(regRsp.pubKey));	// pk
-	hash = SHA256_final(&sha);
-	p256_from_bin(hash, &h);
-
-	INFO << "hash : " << bytes2ascii((char *)hash, 32);
-
-	// Parse subject public key into two integers.
-	CHECK_EQ(pk.size(), P256_POINT_SIZE, "Public key does not match P256 point size.");
-	p256_int pk_x, pk_y;
-	p256_from_bin((uint8_t *) pk.data() + 1, &pk_x);
-	p256_from_bin((uint8_t *) pk.data() + 1 + P256_SCALAR_SIZE, &pk_y);
+	U2F_derSpan userKey;
+	U2F_derRegister parts;
+	CHECK_EQ(U2F_parseRegister(reply, replyLength - 2, &userKey, &parts), true, "Cannot extract certificate and signature.");
+	INFO << "cert: " << bytes2ascii((const char *)parts.cert.data, (int)parts.cert.len);
+	INFO << "pk  : " << bytes2ascii((const char *)parts.pubKey.data, (int)parts.pubKey.len);
+	INFO << "sig : " << bytes2ascii((const char *)parts.sig.data, (int)parts.sig.len);
 
 	// Verify signature.
-	CHECK_EQ(1, p256_ecdsa_verify(&pk_x, &pk_y, &h, &sig_r, &sig_s), "Signature does not match.");
+	CHECK_EQ(1, U2F_verifyRegister(regReq.appId, regReq.nonce, userKey, parts, &keyCache), "Signature does not match.");
 
 	return ReturnValue::BLEAPI_ERROR_SUCCESS;
 }
@@ -338,29 +306,8 @@ ReturnValue BleApiTest_Sign(pBleDevice dev, uint32_t *ctr, int expectedSW12, boo
 	INFO << "Sign: " << (replyLength - 2) << " bytes in "
 	    << ((float)(dev->TimeMs() - t)) / 1000.0 << "s";
 
-	// Parse signature from authenticate response.
-	p256_int sig_r, sig_s;
-	CHECK_EQ(1, dsa_sig_unpack(resp.sig,
-				   replyLength - 2 - sizeof(resp.flags) -
-				   sizeof(resp.ctr), &sig_r, &sig_s));
-
-	// Compute hash as integer.
-	p256_int h;
-	SHA256_CTX sha;
-	SHA256_init(&sha);
-	SHA256_update(&sha, regReq.appId, sizeof(regReq.appId));	// O
-	SHA256_update(&sha, &resp.flags, sizeof(resp.flags));	// T
-	SHA256_update(&sha, &resp.ctr, sizeof(resp.ctr));	// CTR
-	SHA256_update(&sha, authReq.nonce, sizeof(authReq.nonce));	// d
-	p256_from_bin(SHA256_final(&sha), &h);
-
-	// Parse public key from registration response.
-	p256_int pk_x, pk_y;
-	p256_from_bin(regRsp.pubKey.x, &pk_x);
-	p256_from_bin(regRsp.pubKey.y, &pk_y);
-
-	// Verify signature.
-	CHECK_EQ(1, p256_ecdsa_verify(&pk_x, &pk_y, &h, &sig_r, &sig_s), "Signature does not match.");
+	// Verify signature, with the public key from the registration response.
+	CHECK_EQ(1, U2F_verifyAuthenticate((uint8_t *) & regRsp.pubKey, regReq.appId, authReq.nonce, reply, replyLength - 2, &keyCache), "Signature does not match.");
 
   *ctr = ntohl(resp.ctr);
 
@@ -22,19 +22,15 @@
 
 #include <string.h>
 #include "fido_ble.h"
+#include "../../HID/u2f_hex.h"
 
 static std::string bytes2ascii(const unsigned char *ptr, int len)
 {
-	static const char *convert = "0123456789ABCDEF";
-	std::string r;
-	int i;
+	if (len <= 0)
+		return std::string();
 
-	for (i = 0; i < len; i++) {
-		const unsigned char c = ptr[i];
-
-		r += convert[(c >> 4) & 0x0F];
-		r += convert[(c) & 0x0F];
-	}
+	std::string r(2 * len, 0);
+	U2F_hexEncode(ptr, len, &r[0]);
 
 	return r;
 }
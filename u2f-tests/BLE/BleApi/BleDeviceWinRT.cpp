@@ -27,6 +27,7 @@
 #include <codecvt>
 
 #include "fido_ble.h"
+#include "../../HID/u2f_hex.h"
 
 #include <BleDeviceWinRT.h>
 #include <BleAdvertisementWinRT.h>
@@ -82,16 +83,11 @@ static const Guid FIDO_CHARACTERISTIC_VERSIONBITFIELD_GUID(0xF1D0FFF4, 0xDEAA, 0
 
 static std::string bytes2ascii(const unsigned char *ptr, int len)
 {
-  static const char *convert = "0123456789ABCDEF";
-  std::string r;
-  int i;
+  if (len <= 0)
+    return std::string();
 
-  for (i = 0; i < len; i++) {
-    const unsigned char c = ptr[i];
-
-    r += convert[(c >> 4) & 0x0F];
-    r += convert[(c) & 0x0F];
-  }
+  std::string r(2 * len, 0);
+  U2F_hexEncode(ptr, len, &r[0]);
 
   return r;
 }
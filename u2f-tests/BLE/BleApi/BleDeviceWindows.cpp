@@ -25,6 +25,7 @@
 #include "fido_ble.h"
 #include "BleDeviceWindows.h"
 #include "BleApiError.h"
+#include "../../HID/u2f_hex.h"
 
 
 DEFINE_GUID(GUID_BLUETOOTHLE_FIDO_CONTROLPOINT, 0xF1D0FFF1, 0xDEAA, 0xECEE,
@@ -42,16 +43,11 @@ DEFINE_GUID(GUID_BLUETOOTHLE_FIDO_VERSIONBITFIELD, 0xF1D0FFF3, 0xDEAA, 0xECEE, 0
 
 static std::string bytes2ascii(const unsigned char *ptr, int len)
 {
-	static const char *convert = "0123456789ABCDEF";
-	std::string r;
-	int i;
-
-	for (i = 0; i < len; i++) {
-		const unsigned char c = ptr[i];
+	if (len <= 0)
+		return std::string();
 
-		r += convert[(c >> 4) & 0x0F];
-		r += convert[(c) & 0x0F];
-	}
+	std::string r(2 * len, 0);
+	U2F_hexEncode(ptr, len, &r[0]);
 
 	return r;
 }
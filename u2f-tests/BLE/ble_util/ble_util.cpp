@@ -17,6 +17,7 @@
  */
 
 #include "ble_util.h"
+#include "../../HID/u2f_hex.h"
 
 #ifdef PLATFORM_WINDOWS
 bool arg_ansi = false;
@@ -30,16 +31,11 @@ bool arg_LethalWarn = false;	// default
 
 std::string bytes2ascii(const char *ptr, int len)
 {
-	static const char *convert = "0123456789ABCDEF";
-	std::string r;
-	int i;
+	if (len <= 0)
+		return std::string();
 
-	for (i = 0; i < len; i++) {
-		const char c = ptr[i];
-
-		r += convert[(c >> 4) & 0x0F];
-		r += convert[(c) & 0x0F];
-	}
+	std::string r(2 * len, 0);
+	U2F_hexEncode(ptr, len, &r[0]);
 
 	return r;
 }
@@ -71,80 +67,3 @@ uint16_t bytes2short(const unsigned char *buffer, uint32_t offset)
 	return (((uint16_t) (buffer[offset] << 8)) | (uint16_t)
 		buffer[offset + 1]);
 }
-
-bool getCertificate(const U2F_REGISTER_RESP & rsp, std::string * cert)
-{
-	int len = rsp.keyHandleLen;
-	int certlen = MAX_KH_SIZE + MAX_CERT_SIZE + MAX_ECDSA_SIG_SIZE - len;
-
-	unsigned char *p = (unsigned char *)&rsp.keyHandleCertSig[len];
-
-	CHECK_GE(certlen, 4 + 25, "Certificate length must be larger than the header we test + the asn sequence for the public key");	// must be larger than the header we test + the asn sequence for the public key (see below)
-	CHECK_EQ(p[0], 0x30, "Certificate encoding always starts wtih 0x30");
-
-	int seqlen, headerlen;
-	switch (p[1]) {
-	case 0x81:
-		seqlen = p[2];
-		headerlen = 3;
-		break;
-	case 0x82:
-		seqlen = p[2] * 256 + p[3];
-		headerlen = 4;
-		break;
-	default:
-		CHECK_GE(p[1], 0x81, "Certificate validation: Value must be 0x81 or 0x82");
-		CHECK_LE(p[1], 0x82, "Certificate validation: Value must be 0x81 or 0x82");
-		return false;
-	}
-
-	CHECK_LE(seqlen, certlen - headerlen);
-
-	cert->assign(reinterpret_cast < const char *>(p), seqlen + headerlen);
-	return true;
-}
-
-bool getSignature(const U2F_REGISTER_RESP & rsp, int certsize,
-		  std::string * sig)
-{
-	int sigoffset = rsp.keyHandleLen + certsize;
-	CHECK_LE(sigoffset, MAX_KH_SIZE + MAX_CERT_SIZE + MAX_ECDSA_SIG_SIZE);
-
-	size_t siglength = sizeof(rsp.keyHandleCertSig) - sigoffset;
-	const unsigned char *p = &rsp.keyHandleCertSig[sigoffset];
-
-	CHECK_GE(siglength, 2, "Signature length must always be greater than 2.");
-	CHECK_EQ(p[0], 0x30, "Signature always must start with 0x30");	// start of signature
-
-	// extract and check length
-	size_t seqlen = p[1];
-	CHECK_LE(seqlen, siglength - 2, "Signature length does not match encoded length.");
-
-	sig->assign(reinterpret_cast < const char *>(p), seqlen + 2);
-	return true;
-}
-
-bool getSubjectPublicKey(const std::string & cert, std::string * pk)
-{
-	CHECK_GE(cert.size(), P256_POINT_SIZE);
-
-	// Explicitly search for asn1 lead-in sequence of p256-ecdsa public key.
-	const unsigned char asn1[] = {
-		0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2A, 0x86,
-		0x48, 0xCE, 0x3D, 0x02, 0x01, 0x06, 0x08, 0x2A,
-		0x86, 0x48, 0xCE, 0x3D, 0x03, 0x01, 0x07, 0x03,
-		0x42, 0x00
-	};
-
-	// see if this sequence is part of the certificate
-	size_t off = cert.find((const char *)asn1, 0, sizeof(asn1));
-	CHECK_NE(off, std::string::npos);
-
-	// see if the cert has at least the pointsize length left.
-	off += sizeof(asn1);
-	CHECK_LE(off, cert.size() - P256_POINT_SIZE);
-
-	pk->assign(cert, off, P256_POINT_SIZE);
-
-	return true;
-}
@@ -113,8 +113,3 @@ std::string bytes2ascii(const std::string & s);
 uint16_t bytes2short(const unsigned char *buffer, uint32_t offset);
 
 void AbortOrNot();
-
-bool getCertificate(const U2F_REGISTER_RESP & rsp, std::string * cert);
-bool getSignature(const U2F_REGISTER_RESP & rsp, int certsize,
-		  std::string * sig);
-bool getSubjectPublicKey(const std::string & cert, std::string * pk);
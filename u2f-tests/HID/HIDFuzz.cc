@@ -0,0 +1,563 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// U2F HID framing fuzzer.
+//
+// Mutates short sequences of INIT / CONT frames, seeded from the HIDTest
+// negative cases, and sends them to a fob. The replies are checked against
+// the u2f_sim framing model, which also provides the branch coverage that
+// decides which mutants are kept for further mutation.
+//
+// Each case ends with an INIT on every channel it touched, which aborts any
+// half sent message, and a PING on our own channel to check the channel is
+// not stuck.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include "u2f_util.h"
+#include "u2f_sim.h"
+
+using namespace std;
+
+int arg_Verbose = 0;  // default
+bool arg_Pause = false;  // default
+bool arg_Abort = true;  // default
+
+static
+void checkPause() {
+  if (arg_Pause) {
+    printf("\nPress any key to continue..");
+    getchar();
+    printf("\n");
+  }
+}
+
+static
+void AbortOrNot() {
+  checkPause();
+  if (arg_Abort) abort();
+  cerr << "(continuing -a)" << endl;
+}
+
+struct U2Fob* device;
+
+typedef vector<U2FHID_FRAME> Case;
+
+// Kinds of findings.
+enum {
+  FIND_HANG,  // expected reply never came
+  FIND_WRONG_ERROR,  // error frame with the wrong ERR_* code
+  FIND_UNEXPECTED,  // reply that does not match, or should not be there
+  FIND_STUCK,  // channel no longer answers PING after the case
+  FIND_KINDS
+};
+
+static const char* findName[FIND_KINDS] = {
+  "hang", "wrong error", "unexpected reply", "stuck channel"
+};
+
+struct FuzzStats {
+  uint64_t execs;
+  uint64_t frames;
+  uint64_t findings[FIND_KINDS];
+  uint64_t recoveries;
+};
+
+FuzzStats stats;
+
+vector<Case> corpus;
+const size_t kMaxCorpus = 512;
+const size_t kMaxFrames = 8;
+
+// Bits seen so far of model coverage and of device reply signatures.
+uint8_t seenCoverage[U2FSIM_COVERAGE_BITS / 8];
+uint8_t seenReplies[U2FSIM_COVERAGE_BITS / 8];
+
+float arg_Quiet = .01f;  // seconds to wait for stray frames after a case
+int arg_ShowFindings = 5;  // per kind, the rest is only counted
+
+static
+U2FHID_FRAME initFrame(uint32_t cid, uint8_t cmd, size_t len) {
+  U2FHID_FRAME f;
+  memset(&f, 0, sizeof(f));
+  f.cid = cid;
+  f.init.cmd = cmd | TYPE_INIT;
+  f.init.bcnth = (uint8_t) (len >> 8);
+  f.init.bcntl = (uint8_t) len;
+  for (size_t i = 0; i < sizeof(f.init.data); ++i) f.init.data[i] = rand();
+  return f;
+}
+
+static
+U2FHID_FRAME contFrame(uint32_t cid, uint8_t seq) {
+  U2FHID_FRAME f;
+  f.cid = cid;
+  f.cont.seq = seq & ~TYPE_MASK;
+  for (size_t i = 0; i < sizeof(f.cont.data); ++i) f.cont.data[i] = rand();
+  return f;
+}
+
+// Channel ids worth trying: ours, a neighbour, broadcast, 0 and noise.
+static
+uint32_t pickCid() {
+  uint32_t cid = U2Fob_getCid(device);
+  switch (rand() % 6) {
+    case 0: return cid ^ 1;
+    case 1: return (uint32_t) CID_BROADCAST;
+    case 2: return 0;
+    case 3: return (uint32_t) rand() << 16 | (rand() & 0xffff);
+    default: return cid;
+  }
+}
+
+static
+uint8_t pickCmd() {
+  static const uint8_t cmds[] = {
+    U2FHID_PING, U2FHID_MSG, U2FHID_LOCK, U2FHID_INIT, U2FHID_WINK,
+    U2FHID_SYNC, U2FHID_ERROR
+  };
+  if (rand() % 8 == 0) return rand() | TYPE_INIT;
+  return cmds[rand() % sizeof(cmds)];
+}
+
+static
+size_t pickLen() {
+  static const size_t lens[] = {
+    0, 1, INIT_NONCE_SIZE, 57, 58, 99, 116, 117, U2FSIM_MAX_MSG,
+    U2FSIM_MAX_MSG + 1, 0xffff
+  };
+  if (rand() % 4 == 0) return rand() & 0xffff;
+  return lens[rand() % (sizeof(lens) / sizeof(lens[0]))];
+}
+
+static
+void seedCorpus() {
+  uint32_t cid = U2Fob_getCid(device);
+  Case c;
+
+  // test_WrongSeq
+  c.push_back(initFrame(cid, U2FHID_PING, 99));
+  c.push_back(contFrame(cid, 1));
+  corpus.push_back(c);
+  c.clear();
+
+  // test_NotCont
+  c.push_back(initFrame(cid, U2FHID_PING, 99));
+  c.push_back(c.back());
+  corpus.push_back(c);
+  c.clear();
+
+  // test_NotFirst
+  c.push_back(contFrame(cid, 0));
+  corpus.push_back(c);
+  c.clear();
+
+  // test_Limits
+  c.push_back(initFrame(cid, U2FHID_PING, U2FSIM_MAX_MSG + 1));
+  corpus.push_back(c);
+  c.clear();
+
+  // test_Busy
+  c.push_back(initFrame(cid, U2FHID_PING, 99));
+  c.push_back(initFrame(cid ^ 1, U2FHID_PING, 99));
+  corpus.push_back(c);
+  c.clear();
+
+  // test_InitSelfAborts, test_InitOther
+  c.push_back(initFrame(cid, U2FHID_PING, 99));
+  c.push_back(initFrame(cid, U2FHID_INIT, INIT_NONCE_SIZE));
+  corpus.push_back(c);
+  c.back().cid ^= 1;
+  corpus.push_back(c);
+  c.clear();
+
+  // Well formed two frame PING.
+  c.push_back(initFrame(cid, U2FHID_PING, 99));
+  c.push_back(contFrame(cid, 0));
+  corpus.push_back(c);
+  c.clear();
+
+  // test_OnlyInitOnBroadcast, test_NothingOnChannel0, test_Unknown
+  c.push_back(initFrame(CID_BROADCAST, U2FHID_PING, INIT_NONCE_SIZE));
+  corpus.push_back(c);
+  c.clear();
+  c.push_back(initFrame(0, U2FHID_INIT, INIT_NONCE_SIZE));
+  corpus.push_back(c);
+  c.clear();
+  c.push_back(initFrame(cid, U2FHID_SYNC, 0));
+  corpus.push_back(c);
+}
+
+static
+void mutate(Case* c) {
+  int n = 1 + rand() % 4;
+  while (n--) {
+    U2FHID_FRAME& f = (*c)[rand() % c->size()];
+    switch (rand() % 10) {
+      case 0:  // INIT <-> CONT
+        f.type ^= TYPE_INIT;
+        break;
+      case 1:
+        f.cid = pickCid();
+        break;
+      case 2:
+        f.init.cmd = pickCmd();
+        break;
+      case 3: {
+        size_t len = pickLen();
+        f.init.bcnth = (uint8_t) (len >> 8);
+        f.init.bcntl = (uint8_t) len;
+        break;
+      }
+      case 4:  // sequence off by a bit, or anything
+        f.cont.seq = (rand() % 2 ? f.cont.seq + 1 - rand() % 3 : rand()) &
+            ~TYPE_MASK;
+        break;
+      case 5:
+        if (c->size() < kMaxFrames) c->push_back(f);
+        break;
+      case 6:
+        if (c->size() > 1) c->erase(c->begin() + rand() % c->size());
+        break;
+      case 7: {
+        size_t i = rand() % c->size();
+        size_t j = rand() % c->size();
+        U2FHID_FRAME t = (*c)[i];
+        (*c)[i] = (*c)[j];
+        (*c)[j] = t;
+        break;
+      }
+      case 8:
+        f.cont.data[rand() % sizeof(f.cont.data)] ^= 1 << (rand() % 8);
+        break;
+      case 9:
+        if (c->size() < kMaxFrames) {
+          c->insert(c->begin() + rand() % (c->size() + 1),
+                    rand() % 2 ? initFrame(pickCid(), pickCmd(), pickLen())
+                               : contFrame(pickCid(), rand() % 3));
+        }
+        break;
+    }
+  }
+
+  // Never leave the fob locked: only ever send unlock.
+  for (size_t i = 0; i < c->size(); ++i) {
+    U2FHID_FRAME& f = (*c)[i];
+    if (FRAME_TYPE(f) == TYPE_INIT && f.init.cmd == U2FHID_LOCK) {
+      f.init.data[0] = 0;
+    }
+  }
+}
+
+// Append an INIT on every channel the case used, which aborts anything
+// half sent, then a PING on our channel.
+// Returns the index of the PING.
+static
+size_t appendResync(Case* c) {
+  vector<uint32_t> cids;
+  for (size_t i = 0; i < c->size(); ++i) {
+    uint32_t cid = (*c)[i].cid;
+    if (cid == 0 || cid == (uint32_t) CID_BROADCAST) continue;
+    bool seen = false;
+    for (size_t j = 0; j < cids.size(); ++j) seen |= cids[j] == cid;
+    if (!seen) cids.push_back(cid);
+  }
+  for (size_t j = 0; j < cids.size(); ++j) {
+    c->push_back(initFrame(cids[j], U2FHID_INIT, INIT_NONCE_SIZE));
+  }
+  c->push_back(initFrame(U2Fob_getCid(device), U2FHID_PING, INIT_NONCE_SIZE));
+  return c->size() - 1;
+}
+
+// Whether |got| is an acceptable device reply where the model sent |want|.
+// |cmd| and |len| are the command and length of the message |want| belongs
+// to.
+static
+bool sameReply(const U2FHID_FRAME& want, const U2FHID_FRAME& got,
+               uint8_t cmd, size_t len) {
+  if (got.cid != want.cid) return false;
+  if (FRAME_TYPE(got) != FRAME_TYPE(want)) return false;
+
+  if (FRAME_TYPE(want) == TYPE_CONT) {
+    if (got.cont.seq != want.cont.seq) return false;
+    if (cmd != U2FHID_PING) return true;
+    // Only the payload left; the rest of the last frame is padding.
+    size_t offset = sizeof(want.init.data) +
+        (size_t) want.cont.seq * sizeof(want.cont.data);
+    size_t n = len > offset ?
+        min(len - offset, sizeof(want.cont.data)) : 0;
+    return !memcmp(got.cont.data, want.cont.data, n);
+  }
+
+  if (got.init.cmd != want.init.cmd) return false;
+  switch (want.init.cmd) {
+    case U2FHID_ERROR:
+      return MSG_LEN(got) == 1 && got.init.data[0] == want.init.data[0];
+    case U2FHID_INIT:
+      // Nonce must match; cid, versions and capabilities are the fob's.
+      return MSG_LEN(got) >= MSG_LEN(want) &&
+          !memcmp(got.init.data, want.init.data, INIT_NONCE_SIZE);
+    case U2FHID_MSG:
+      // APDU replies depend on the fob's application; any will do.
+      return true;
+    case U2FHID_PING: {
+      size_t len = min((size_t) MSG_LEN(want), sizeof(want.init.data));
+      return MSG_LEN(got) == MSG_LEN(want) &&
+          !memcmp(got.init.data, want.init.data, len);
+    }
+    default:
+      return MSG_LEN(got) == MSG_LEN(want);
+  }
+}
+
+static
+void printFrame(const char* tag, const U2FHID_FRAME& f) {
+  cout << "  " << tag << " " << hex << setw(8) << setfill('0') << f.cid
+       << dec << setfill(' ') << ":" << b2a(&f.type, sizeof(f) - 4) << endl;
+}
+
+static
+void report(int kind, const Case& c, const vector<U2FHID_FRAME>& want,
+            size_t at, const U2FHID_FRAME* got) {
+  stats.findings[kind]++;
+  if (stats.findings[kind] > (uint64_t) arg_ShowFindings && !arg_Verbose) {
+    return;
+  }
+  cout << "\x1b[31mFINDING(" << findName[kind] << ")\x1b[0m at exec "
+       << stats.execs << ", reply " << at << endl;
+  for (size_t i = 0; i < c.size(); ++i) printFrame(">", c[i]);
+  if (at < want.size()) printFrame("expected <", want[at]);
+  if (got) printFrame("got <", *got);
+}
+
+// Bring the fob back to a known state after a finding.
+static
+void recover() {
+  U2FHID_FRAME r;
+  while (U2Fob_receiveHidFrame(device, &r, .2f) == 0) {
+  }
+  if (U2Fob_init(device) != 0) {
+    U2Fob_reopen(device);
+    CHECK_EQ(0, U2Fob_init(device));
+  }
+  stats.recoveries++;
+}
+
+// Set the bits of |bits| in |seen|; returns whether any was new.
+static
+bool merge(uint8_t* seen, const uint8_t* bits, size_t size) {
+  bool fresh = false;
+  for (size_t i = 0; i < size; ++i) {
+    if (bits[i] & ~seen[i]) fresh = true;
+    seen[i] |= bits[i];
+  }
+  return fresh;
+}
+
+static
+size_t countBits(const uint8_t* bits, size_t size) {
+  size_t n = 0;
+  for (size_t i = 0; i < size; ++i) {
+    for (uint8_t b = bits[i]; b; b &= b - 1) ++n;
+  }
+  return n;
+}
+
+// Run one case against model and fob.
+// Returns whether it reached new model coverage or new reply signatures.
+static
+bool runCase(Case c) {
+  size_t ping = appendResync(&c);
+
+  // What the model says.
+  struct U2Fsim* model = U2Fsim_create();
+  vector<U2FHID_FRAME> want;
+  vector<size_t> cause;  // index of the frame that triggered each reply
+  for (size_t i = 0; i < c.size(); ++i) {
+    U2FHID_FRAME r;
+    U2Fsim_write(model, &c[i], 0);
+    while (U2Fsim_read(model, &r, 0) == 0) {
+      want.push_back(r);
+      cause.push_back(i);
+    }
+  }
+  bool fresh = merge(seenCoverage, U2Fsim_coverage(model),
+                     sizeof(seenCoverage));
+  U2Fsim_destroy(model);
+
+  // What the fob says.
+  for (size_t i = 0; i < c.size(); ++i) {
+    CHECK_EQ(0, U2Fob_sendHidFrame(device, &c[i]));
+  }
+  stats.execs++;
+  stats.frames += c.size();
+
+  uint8_t replies[sizeof(seenReplies)];
+  memset(replies, 0, sizeof(replies));
+  uint32_t signature = 0;
+  uint8_t cmd = 0;
+  size_t len = 0;
+
+  for (size_t i = 0; i < want.size(); ++i) {
+    U2FHID_FRAME r;
+    if (FRAME_TYPE(want[i]) == TYPE_INIT) {
+      cmd = want[i].init.cmd;
+      len = MSG_LEN(want[i]);
+    }
+
+    if (U2Fob_receiveHidFrame(device, &r, 1.0) != 0) {
+      report(cause[i] == ping ? FIND_STUCK : FIND_HANG, c, want, i, NULL);
+      recover();
+      return true;
+    }
+
+    if (!sameReply(want[i], r, cmd, len)) {
+      bool wrongError = want[i].init.cmd == U2FHID_ERROR &&
+          r.init.cmd == U2FHID_ERROR && r.cid == want[i].cid;
+      report(wrongError ? FIND_WRONG_ERROR : FIND_UNEXPECTED,
+             c, want, i, &r);
+      recover();
+      return true;
+    }
+
+    // Reply signature: the sequence of commands and error codes.
+    signature = signature * 31 + r.init.cmd;
+    if (r.init.cmd == U2FHID_ERROR) signature = signature * 31 + r.init.data[0];
+    uint32_t bit = signature % U2FSIM_COVERAGE_BITS;
+    replies[bit / 8] |= 1 << (bit & 7);
+  }
+
+  U2FHID_FRAME r;
+  if (U2Fob_receiveHidFrame(device, &r, arg_Quiet) == 0) {
+    report(FIND_UNEXPECTED, c, want, want.size(), &r);
+    recover();
+    return true;
+  }
+
+  fresh |= merge(seenReplies, replies, sizeof(seenReplies));
+  return fresh;
+}
+
+static
+void printStats(float elapsed) {
+  cout << "#" << stats.execs
+       << " exec/s: " << fixed << setprecision(1)
+       << (elapsed > 0 ? stats.execs / elapsed : 0)
+       << " frames/s: " << (elapsed > 0 ? stats.frames / elapsed : 0)
+       << " corpus: " << corpus.size()
+       << " cov: " << countBits(seenCoverage, sizeof(seenCoverage))
+       << " sigs: " << countBits(seenReplies, sizeof(seenReplies));
+  for (int k = 0; k < FIND_KINDS; ++k) {
+    cout << " " << findName[k] << ": " << stats.findings[k];
+  }
+  cout << endl;
+  cout.unsetf(ios::floatfield);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0]
+         << " <device-path> [-v] [-V] [-p] [-n<cases>] [-t<seconds>]"
+         << " [-s<seed>] [-q<ms>]" << endl;
+    return -1;
+  }
+
+  device = U2Fob_create();
+
+  char* arg_DeviceName = argv[1];
+  long arg_Cases = 1000;
+  float arg_Seconds = 0;
+  unsigned int arg_Seed = (unsigned int) time(NULL);
+
+  while (--argc > 1) {
+    if (!strncmp(argv[argc], "-v", 2)) {
+      // Print every finding
+      arg_Verbose |= 1;
+    }
+    if (!strncmp(argv[argc], "-V", 2)) {
+      // All logging
+      arg_Verbose |= 2;
+      U2Fob_setLog(device, stdout, -1);
+    }
+    if (!strncmp(argv[argc], "-p", 2)) {
+      // Pause at abort
+      arg_Pause = true;
+    }
+    if (!strncmp(argv[argc], "-n", 2)) {
+      // Number of cases, 0 for no limit
+      arg_Cases = atol(argv[argc] + 2);
+    }
+    if (!strncmp(argv[argc], "-t", 2)) {
+      // Run for this long instead
+      arg_Seconds = (float) atof(argv[argc] + 2);
+      arg_Cases = 0;
+    }
+    if (!strncmp(argv[argc], "-s", 2)) {
+      // Seed, to reproduce a run
+      arg_Seed = (unsigned int) strtoul(argv[argc] + 2, NULL, 0);
+    }
+    if (!strncmp(argv[argc], "-q", 2)) {
+      // Quiet time after each case, ms
+      arg_Quiet = (float) atof(argv[argc] + 2) / 1000;
+    }
+  }
+
+  cout << "Seed: " << arg_Seed << endl;
+  srand(arg_Seed);
+
+  CHECK_EQ(0, U2Fob_open(device, arg_DeviceName));
+  CHECK_EQ(0, U2Fob_init(device));
+
+  seedCorpus();
+  size_t seeds = corpus.size();
+
+  // Seeds run first, as is.
+  for (size_t i = 0; i < seeds; ++i) runCase(corpus[i]);
+
+  uint64_t start = 0, lastReport = 0;
+  U2Fob_deltaTime(&start);
+  lastReport = start;
+  float elapsed = 0, sinceReport = 0;
+
+  while (arg_Cases == 0 || stats.execs < (uint64_t) arg_Cases) {
+    Case c = corpus[rand() % corpus.size()];
+    mutate(&c);
+
+    if (runCase(c)) {
+      if (corpus.size() < kMaxCorpus) {
+        corpus.push_back(c);
+      } else {
+        corpus[seeds + rand() % (kMaxCorpus - seeds)] = c;
+      }
+    }
+
+    uint64_t now = lastReport;
+    sinceReport += U2Fob_deltaTime(&now);
+    lastReport = now;
+    if (sinceReport >= 5) {
+      elapsed += sinceReport;
+      sinceReport = 0;
+      printStats(elapsed);
+    }
+    if (arg_Seconds > 0 && elapsed + sinceReport >= arg_Seconds) break;
+  }
+
+  elapsed += sinceReport;
+  printStats(elapsed);
+
+  U2Fob_destroy(device);
+
+  uint64_t total = 0;
+  for (int k = 0; k < FIND_KINDS; ++k) total += stats.findings[k];
+  return total ? 1 : 0;
+}
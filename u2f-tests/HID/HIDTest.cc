@@ -6,6 +6,7 @@
 
 // Basic U2F HID framing compliance test.
 
+#include <float.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -13,6 +14,7 @@
 
 #include <iostream>
 #include <iomanip>
+#include <map>
 
 #include "u2f_util.h"
 
@@ -28,6 +30,7 @@ using namespace std;
 int arg_Verbose = 0;  // default
 bool arg_Pause = false;  // default
 bool arg_Abort = true;  // default
+int arg_Repeat = 0;  // default, judge timings on a single sample
 
 static
 void checkPause() {
@@ -47,6 +50,38 @@ void AbortOrNot() {
 
 struct U2Fob* device;
 
+// Timing bounds and the samples collected against them with -r.
+struct TimingCheck {
+  float lo, hi;
+  U2F_samples samples;
+};
+
+map<string, TimingCheck> timings;
+bool repeating = false;  // in a PASS_REPEAT with -r
+
+// Check lo <= t <= hi. In a case repeated with -r, record t instead and
+// leave the verdict to checkTimings(), so a single scheduling hiccup does
+// not fail the fob.
+#define CHECK_TIME(name, t, lower, upper) do { \
+  if (repeating) { \
+    TimingCheck& tc = timings[name]; \
+    tc.lo = (lower); tc.hi = (upper); \
+    tc.samples.add(t); \
+  } else { \
+    CHECK_GE(t, lower); \
+    CHECK_LE(t, upper); \
+  } } while (0)
+
+#define CHECK_TIME_LE(name, t, hi) CHECK_TIME(name, t, 0.0f, hi)
+#define CHECK_TIME_GE(name, t, lo) CHECK_TIME(name, t, lo, FLT_MAX)
+
+// PASS() for a timed case, which runs -r times.
+#define PASS_REPEAT(x) do { \
+  repeating = arg_Repeat > 0; \
+  for (int _r = 1; _r < arg_Repeat; ++_r) (x); \
+  PASS(x); \
+  repeating = false; } while (0)
+
 #define SEND(f) CHECK_EQ(0, U2Fob_sendHidFrame(device, &f))
 #define RECV(f, t) CHECK_EQ(0, U2Fob_receiveHidFrame(device, &f, t))
 
@@ -102,7 +137,8 @@ void test_Echo() {
   CHECK_EQ(f.cid, r.cid);
 
   // Expect echo somewhat quickly.
-  CHECK_LT(U2Fob_deltaTime(&t), .1);
+  float elapsed = U2Fob_deltaTime(&t);
+  CHECK_TIME_LE("Echo", elapsed, .1f);
 
   // Check echoed content matches.
   CHECK_EQ(U2FHID_PING, r.init.cmd);
@@ -137,10 +173,8 @@ void test_LongEcho() {
 
   // Expected transfer times for 2ms bInterval.
   // We do not want fobs to be too slow or too agressive.
-  CHECK_GE(sent, .020);
-  CHECK_LE(sent, .075);
-  CHECK_GE(received, .020);
-  CHECK_LE(received, .075);
+  CHECK_TIME("LongEcho sent", sent, .020f, .075f);
+  CHECK_TIME("LongEcho received", received, .020f, .075f);
 }
 
 // Execute WINK, if implemented.
@@ -188,8 +222,10 @@ void test_Idle(float timeOut = .3) {
 
   U2Fob_deltaTime(&t);
   CHECK_EQ(-ERR_MSG_TIMEOUT, U2Fob_receiveHidFrame(device, &r, timeOut));
-  CHECK_GE(U2Fob_deltaTime(&t), .2);
-  CHECK_LE(U2Fob_deltaTime(&t), .5);
+  float idle = U2Fob_deltaTime(&t);
+  CHECK_TIME_GE("Idle", idle, .2f);
+  float reply = U2Fob_deltaTime(&t);
+  CHECK_TIME_LE("Idle reply", reply, .5f);
 }
 
 // Check we get a timeout error frame if not sending TYPE_CONT frames
@@ -211,8 +247,8 @@ void test_Timeout() {
   CHECK_EQ(isError(r, ERR_MSG_TIMEOUT), true);
 
   measuredTimeout = U2Fob_deltaTime(&t);
-  CHECK_GE(measuredTimeout, .4);  // needs to be at least 0.4 seconds
-  CHECK_LE(measuredTimeout, 1.0);  // but at most 1.0 seconds
+  // Needs to be at least 0.4 seconds, but at most 1.0 seconds.
+  CHECK_TIME("Timeout", measuredTimeout, .4f, 1.0f);
 }
 
 // Test LOCK functionality, if implemented.
@@ -264,7 +300,8 @@ void test_Lock() {
     }
   } while (r.init.cmd == U2FHID_ERROR);
 
-  CHECK_GE(U2Fob_deltaTime(&t), 2.5);
+  float locked = U2Fob_deltaTime(&t);
+  CHECK_TIME_GE("Lock", locked, 2.5f);
 }
 
 // Check we get abort if we send TYPE_INIT when TYPE_CONT is expected.
@@ -280,7 +317,8 @@ void test_NotCont() {
   RECV(r, 1.0);
   CHECK_EQ(f.cid, r.cid);
 
-  CHECK_LT(U2Fob_deltaTime(&t), .1);  // Expect fail reply quickly.
+  float elapsed = U2Fob_deltaTime(&t);
+  CHECK_TIME_LE("NotCont reply", elapsed, .1f);  // Expect fail reply quickly.
   CHECK_EQ(isError(r, ERR_INVALID_SEQ), true);
 
   // Check there are no further messages.
@@ -302,7 +340,8 @@ void test_WrongSeq() {
   RECV(r, 1.0);
   CHECK_EQ(f.cid, r.cid);
 
-  CHECK_LT(U2Fob_deltaTime(&t), .1);  // Expect fail reply quickly.
+  float elapsed = U2Fob_deltaTime(&t);
+  CHECK_TIME_LE("WrongSeq reply", elapsed, .1f);  // Expect fail reply quickly.
   CHECK_EQ(isError(r, ERR_INVALID_SEQ), true);
 
   // Check there are no further messages.
@@ -335,7 +374,8 @@ void test_Busy() {
   RECV(r, 1.0);
   CHECK_EQ(f.cid, r.cid);
 
-  CHECK_LT(U2Fob_deltaTime(&t), .1);  // Expect busy reply quickly.
+  float busy = U2Fob_deltaTime(&t);
+  CHECK_TIME_LE("Busy reply", busy, .1f);  // Expect busy reply quickly.
   CHECK_EQ(isError(r, ERR_CHANNEL_BUSY), true);
 
   f.cid ^= 1;  // Flip back.
@@ -345,7 +385,9 @@ void test_Busy() {
 
   CHECK_EQ(isError(r, ERR_MSG_TIMEOUT), true);
 
-  CHECK_GE(U2Fob_deltaTime(&t), .45);  // Expect T/O msg only after timeout.
+  // Expect T/O msg only after timeout.
+  float timedOut = U2Fob_deltaTime(&t);
+  CHECK_TIME_GE("Busy timeout", timedOut, .45f);
 }
 
 // Test INIT self aborts wait for CONT frame
@@ -549,6 +591,8 @@ void test_Descriptor() {
 #ifdef __OS_LINUX
   struct hidraw_report_descriptor rpt_desc;
   int res, desc_size;
+  if (!device->dev) return;  // simulated fob has no descriptor
+
   // hidapi hides internal struct.
   // Use inside knowledge to cast and get fd we need.
   int fd = *(int*)(device->dev);
@@ -572,10 +616,67 @@ void test_Descriptor() {
 #endif
 }
 
+// Fewest samples of a case to judge it on, as many as -r repeats by
+// default; with few, the median's interval reaches the extreme samples.
+#define TIMING_MIN_SAMPLES 20
+
+// Judge the timing distributions collected with -r.
+// A bound holds when the median's confidence interval lies entirely on
+// its right side; one the interval crosses fails. Cases with fewer than
+// TIMING_MIN_SAMPLES samples are shown but not judged.
+// Returns false if any case was not judged.
+bool checkTimings(const char* path) {
+  bool judged = true;
+  streamsize precision = cout.precision();
+  cout << "Timing distribution for " << path
+       << " (" << arg_Repeat << " repeats, seconds):" << endl;
+  cout << setw(20) << left << "case" << right
+       << setw(6) << "n" << setw(9) << "min" << setw(9) << "p50"
+       << setw(9) << "p90" << setw(9) << "p99" << setw(9) << "max"
+       << "  median 95% CI     bounds" << endl;
+
+  for (map<string, TimingCheck>::const_iterator it = timings.begin();
+       it != timings.end(); ++it) {
+    const TimingCheck& tc = it->second;
+    const U2F_samples& s = tc.samples;
+    float ciLo, ciHi;
+    s.medianInterval(&ciLo, &ciHi);
+
+    cout << setw(20) << left << it->first << right << fixed
+         << setprecision(4) << setw(6) << s.size()
+         << setw(9) << s.percentile(0) << setw(9) << s.percentile(.5f)
+         << setw(9) << s.percentile(.9f) << setw(9) << s.percentile(.99f)
+         << setw(9) << s.percentile(1)
+         << "  [" << ciLo << ", " << ciHi << "]  ["
+         << tc.lo << ", ";
+    if (tc.hi == FLT_MAX) cout << "-"; else cout << tc.hi;
+    cout << "]";
+    if (s.size() < TIMING_MIN_SAMPLES) {
+      cout << " \x1b[33minsufficient samples\x1b[0m";
+      judged = false;
+    }
+    cout << endl;
+  }
+  cout.unsetf(ios::floatfield);
+  cout.precision(precision);
+
+  for (map<string, TimingCheck>::const_iterator it = timings.begin();
+       it != timings.end(); ++it) {
+    const TimingCheck& tc = it->second;
+    if (tc.samples.size() < TIMING_MIN_SAMPLES) continue;
+    float ciLo, ciHi;
+    tc.samples.medianInterval(&ciLo, &ciHi);
+    if (ciLo < tc.lo || ciHi > tc.hi) cerr << it->first << ": ";
+    CHECK_GE(ciLo, tc.lo);
+    CHECK_LE(ciHi, tc.hi);
+  }
+  return judged;
+}
+
 int main(int argc, char* argv[]) {
   if (argc < 2) {
     cerr << "Usage: " << argv[0]
-         << " <device-path> [-a] [-v] [-V] [-p]" << endl;
+         << " <device-path> [-a] [-v] [-V] [-p] [-r<N>]" << endl;
     return -1;
   }
 
@@ -601,6 +702,10 @@ int main(int argc, char* argv[]) {
       // Pause at abort
       arg_Pause = true;
     }
+    if (!strncmp(argv[argc], "-r", 2)) {
+      // Repeat timed cases, judge timings on the distribution
+      arg_Repeat = argv[argc][2] ? atoi(argv[argc] + 2) : TIMING_MIN_SAMPLES;
+    }
   }
 
   srand((unsigned int) time(NULL));
@@ -609,7 +714,7 @@ int main(int argc, char* argv[]) {
   //
   CHECK_EQ(U2Fob_open(device, arg_DeviceName), 0);
 
-  PASS(test_Idle());
+  PASS_REPEAT(test_Idle());
 
   PASS(test_Init());
 
@@ -629,18 +734,18 @@ int main(int argc, char* argv[]) {
 
   PASS(test_Lock());
 
-  PASS(test_Echo());
-  PASS(test_LongEcho());
+  PASS_REPEAT(test_Echo());
+  PASS_REPEAT(test_LongEcho());
 
-  PASS(test_Timeout());
+  PASS_REPEAT(test_Timeout());
 
-  PASS(test_WrongSeq());
-  PASS(test_NotCont());
+  PASS_REPEAT(test_WrongSeq());
+  PASS_REPEAT(test_NotCont());
   PASS(test_NotFirst());
 
   PASS(test_Limits());
 
-  PASS(test_Busy());
+  PASS_REPEAT(test_Busy());
   PASS(test_LeadingZero());
 
   PASS(test_Idle(2.0));
@@ -650,6 +755,15 @@ int main(int argc, char* argv[]) {
 
   PASS(test_Descriptor());
 
+  if (arg_Repeat) {
+    if (checkTimings(arg_DeviceName)) {
+      cout << "\x1b[32mPASS(checkTimings(arg_DeviceName))\x1b[0m" << endl;
+    } else {
+      cout << "\x1b[33mcheckTimings(arg_DeviceName): insufficient samples,"
+              " use -r" << TIMING_MIN_SAMPLES << " or more\x1b[0m" << endl;
+    }
+  }
+
   U2Fob_destroy(device);
 
   return 0;
@@ -0,0 +1,826 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Crypto benchmark, on random authentication messages signed under a few
+// keys.
+//
+// First times the hot paths one call at a time, in ns and C++ heap
+// allocations per call, on fixed inputs from the first message: DER
+// signature decoding, scalar loading, libmincrypt verification, the
+// registration and authentication digests, response and certificate
+// parsing, hex coding and APDU and HID frame encoding.
+//
+// Then times libmincrypt's p256_ecdsa_verify against the u2f_p256 kernel, once
+// per call and with precomputed keys, with each field implementation this CPU
+// has, and in combined batches; then SHA-256 of the messages, with libmincrypt
+// and with each u2f_sha256 implementation, and of self-signed certificates from
+// their fixed prefix's midstate; then each crypto backend doing all of an
+// authentication check through u2f_verify, as the tests do: hash, decode the
+// DER signature and verify; then attestation chains, checked in full for every
+// enrollment and through the trust store's cache; then the signature counter
+// check against a memory-mapped store.
+// Every variant first has to accept the same signatures and reject a
+// tampered copy.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "u2f.h"
+#include "u2f_asn1.h"
+#include "u2f_counters.h"
+#include "u2f_crypto.h"
+#include "u2f_p256.h"
+#include "u2f_sha256.h"
+#include "u2f_trust.h"
+#include "u2f_util.h"
+#include "u2f_verify.h"
+
+#include "mincrypt/dsa_sig.h"
+#include "mincrypt/p256.h"
+#include "mincrypt/p256_ecdsa.h"
+#include "mincrypt/sha256.h"
+
+using namespace std;
+
+int arg_Verbose = 0;  // default
+
+// Calls to operator new, for allocations per operation.
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  ++allocations;
+  void* p = malloc(size ? size : 1);
+  if (!p) throw bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+static
+void AbortOrNot() {
+  abort();
+}
+
+// appId, flags, counter, challenge: what an authentication signs.
+#define AUTH_MESSAGE_SIZE  (32 + 1 + 4 + 32)
+
+// A key pair, with the public key's precomputed table.
+struct Key {
+  p256_int d;
+  p256_int x, y;
+  string point;  // (x, y) uncompressed, as sent
+  U2F_p256Key table;
+};
+
+// One signed message, valid for |key|.
+struct Vector {
+  size_t key;
+  string message;
+  p256_int h;  // its digest
+  p256_int r, s;
+  string der;  // (r, s) as sent
+  string rsp;  // flags, counter and der: the authentication response
+};
+
+// Ways to verify.
+enum Mode { MINCRYPT, ONE_SHOT, PRECOMPUTED };
+
+struct Run {
+  const char* name;
+  const char* impl;  // u2f_p256 field code
+  Mode mode;
+};
+
+static const Run runs[] = {
+  { "mincrypt", "", MINCRYPT },
+  { "64-bit", "64-bit", ONE_SHOT },
+  { "64-bit, key table", "64-bit", PRECOMPUTED },
+  { "mulx/adx", "mulx/adx", ONE_SHOT },
+  { "mulx/adx, key table", "mulx/adx", PRECOMPUTED },
+};
+
+// u2f_sha256 code to time; "" is libmincrypt.
+static const char* const hashRuns[] = { "", "portable", "avx2", "sha-ni" };
+
+// Random scalar below 2^255, so below n.
+static
+void randomScalar(p256_int* k) {
+  uint8_t b[P256_SCALAR_SIZE];
+  for (size_t i = 0; i < sizeof(b); ++i) b[i] = (uint8_t) rand();
+  b[0] &= 0x7f;
+  p256_from_bin(b, k);
+}
+
+// DER INTEGER holding |a|.
+static
+string derInteger(const p256_int& a) {
+  uint8_t b[P256_SCALAR_SIZE];
+  p256_to_bin(&a, b);
+  size_t i = 0;
+  while (i < sizeof(b) - 1 && !b[i]) ++i;
+  string v((char*) b + i, sizeof(b) - i);
+  if (v[0] & 0x80) v.insert(v.begin(), 0);  // keep it positive
+  return string(1, 0x02) + string(1, (char) v.size()) + v;
+}
+
+// Signs digest |h| under |key| the textbook way: for random k,
+// (r, s) = (x(kG), (h + r d) / k). Not constant time; fine for vectors.
+static
+void sign(const Key& key, const p256_int& h, p256_int* r, p256_int* s) {
+  p256_int k, y, zero = P256_ZERO, inv, rd, sum;
+  do {
+    randomScalar(&k);
+    CHECK_EQ(true, U2F_p256PointsMul(&k, &zero, NULL, NULL, r, &y));
+  } while (p256_cmp(r, &SECP256r1_n) >= 0);
+
+  p256_modinv_vartime(&SECP256r1_n, &k, &inv);
+  p256_modmul(&SECP256r1_n, r, 0, &key.d, &rd);
+  int carry = p256_add(&h, &rd, &sum);
+  p256_modmul(&SECP256r1_n, &inv, carry, &sum, s);
+}
+
+static
+void makeKey(Key* key) {
+  p256_int zero = P256_ZERO;
+  randomScalar(&key->d);
+  CHECK_EQ(true, U2F_p256PointsMul(&key->d, &zero, NULL, NULL,
+                                   &key->x, &key->y));
+  CHECK_EQ(true, U2F_p256KeyInit(&key->table, &key->x, &key->y));
+}
+
+// The public key as an uncompressed point.
+static
+string pointOf(const Key& key) {
+  uint8_t point[P256_POINT_SIZE];
+  point[0] = UNCOMPRESSED_POINT;
+  p256_to_bin(&key.x, point + 1);
+  p256_to_bin(&key.y, point + 1 + P256_SCALAR_SIZE);
+  return string((const char*) point, sizeof(point));
+}
+
+// DER element |tag| around |body|.
+static
+string derElement(uint8_t tag, const string& body) {
+  string e(1, (char) tag);
+  if (body.size() < 0x80) {
+    e += (char) body.size();
+  } else if (body.size() < 0x100) {
+    e += (char) 0x81;
+    e += (char) body.size();
+  } else {
+    e += (char) 0x82;
+    e += (char) (body.size() >> 8);
+    e += (char) body.size();
+  }
+  return e + body;
+}
+
+// Signs a random message under |key|.
+static
+void makeVector(const Key& key, Vector* v) {
+  v->message.resize(AUTH_MESSAGE_SIZE);
+  for (size_t i = 0; i < v->message.size(); ++i) v->message[i] = rand();
+  uint8_t digest[U2F_SHA256_SIZE];
+  SHA256_hash(v->message.data(), (int) v->message.size(), digest);
+  p256_from_bin(digest, &v->h);
+
+  sign(key, v->h, &v->r, &v->s);
+  v->der = derElement(0x30, derInteger(v->r) + derInteger(v->s));
+  v->rsp = v->message.substr(U2F_APPID_SIZE, U2F_AUTH_HEADER_SIZE) + v->der;
+}
+
+// X.509 Name with just a common name.
+static
+string makeName(const string& cn) {
+  static const char kCommonName[] = { 0x06, 0x03, 0x55, 0x04, 0x03 };
+  return derElement(0x30, derElement(0x31, derElement(0x30,
+      string(kCommonName, sizeof(kCommonName)) + derElement(0x0C, cn))));
+}
+
+// Certificate for |key| named |subject|, issued by |issuer| and signed
+// by |signer|.
+static
+string makeCert(const Key& key, const string& subject,
+                const Key& signer, const string& issuer, int serial) {
+  string alg((const char*) U2F_ASN1_ECDSA_SHA256,
+             sizeof(U2F_ASN1_ECDSA_SHA256));
+  string spki = string((const char*) U2F_ASN1_P256_PUBKEY_PREFIX,
+                       sizeof(U2F_ASN1_P256_PUBKEY_PREFIX)) + pointOf(key);
+  string validity = derElement(0x30,
+      derElement(0x18, "20000101000000Z") +
+      derElement(0x18, "20991231235959Z"));
+  string tbs = derElement(0x30,
+      derElement(0xA0, derElement(0x02, string(1, 2))) +  // v3
+      derElement(0x02, string(1, (char) (serial & 0x7f))) +
+      alg + issuer + validity + subject + spki);
+
+  uint8_t digest[U2F_SHA256_SIZE];
+  SHA256_hash(tbs.data(), (int) tbs.size(), digest);
+  p256_int h, r, s;
+  p256_from_bin(digest, &h);
+  sign(signer, h, &r, &s);
+  string sig = derElement(0x30, derInteger(r) + derInteger(s));
+
+  return derElement(0x30, tbs + alg + derElement(0x03, string(1, 0) + sig));
+}
+
+static
+int verify(const Run& run, const Key& key, const Vector& v,
+           const p256_int* h) {
+  switch (run.mode) {
+    case MINCRYPT:
+      return p256_ecdsa_verify(&key.x, &key.y, h, &v.r, &v.s) ? 1 : 0;
+    case ONE_SHOT:
+      return U2F_p256Verify(&key.x, &key.y, h, &v.r, &v.s);
+    case PRECOMPUTED:
+      return U2F_p256VerifyKey(&key.table, h, &v.r, &v.s);
+  }
+  return 0;
+}
+
+// All of an authentication check, with the crypto backend in use.
+static
+int verifyMessage(const Key& key, const Vector& v, const string& message) {
+  const uint8_t* m = (const uint8_t*) message.data();
+  return U2F_verifyAuthenticate((const uint8_t*) key.point.data(), m,
+                                m + U2F_APPID_SIZE + U2F_AUTH_HEADER_SIZE,
+                                (const uint8_t*) v.rsp.data(), v.rsp.size(),
+                                NULL);
+}
+
+static
+void reportWrong(const string& name) {
+  cout << setw(22) << left << name << "\x1b[31mwrong result\x1b[0m" << endl;
+}
+
+// One row: time per operation, rate, and speedup over |baseline| seconds
+// for the same work if there is one.
+static
+void report(const string& name, const char* unit, size_t count,
+            float seconds, float baseline) {
+  cout << setw(22) << left << name << right << fixed
+       << setprecision(2) << setw(9) << seconds * 1e6 / count
+       << " us/" << setw(7) << left << unit << right << setprecision(0)
+       << setw(8) << count / seconds << "/s";
+  if (baseline > 0) {
+    cout << setprecision(2) << setw(8) << baseline / seconds << "x";
+  }
+  cout << endl;
+}
+
+// Fixed inputs and outputs of the microbenchmarks.
+struct Micro {
+  const Key* key;
+  const Vector* v;
+  uint8_t scalar[P256_SCALAR_SIZE];
+  uint8_t appId[U2F_APPID_SIZE];
+  uint8_t challenge[U2F_NONCE_SIZE];
+  string keyHandle;
+  string reg;  // registration response
+  string cert;  // its attestation certificate
+  string hex;  // the challenge, in hex
+  string authReq;  // AUTHENTICATE request data
+
+  p256_int r, s;
+  uint8_t digest[U2F_SHA256_SIZE];
+  U2F_derSpan userKey;
+  U2F_derRegister parts;
+  U2F_derCert certParts;
+  string text;
+  uint8_t apdu[4096];
+  U2FHID_FRAME frame;
+  size_t len;
+  int result;
+};
+
+static
+void micro_SigUnpack(Micro* m) {
+  m->result = dsa_sig_unpack((uint8_t*) &m->v->der[0], (int) m->v->der.size(),
+                             &m->r, &m->s);
+}
+
+static
+void micro_FromBin(Micro* m) {
+  p256_from_bin(m->scalar, &m->r);
+}
+
+static
+void micro_EcdsaVerify(Micro* m) {
+  m->result = p256_ecdsa_verify(&m->key->x, &m->key->y, &m->v->h,
+                                &m->v->r, &m->v->s);
+}
+
+static
+void micro_RegisterDigest(Micro* m) {
+  U2F_registerDigest(m->appId, m->challenge,
+                     (const uint8_t*) m->keyHandle.data(),
+                     (uint8_t) m->keyHandle.size(),
+                     (const uint8_t*) m->key->point.data(), m->digest);
+}
+
+static
+void micro_AuthDigest(Micro* m) {
+  U2F_authenticateDigest(m->appId, (const uint8_t*) m->v->rsp.data(),
+                         m->challenge, m->digest);
+}
+
+static
+void micro_ParseRegister(Micro* m) {
+  m->result = U2F_parseRegister((const uint8_t*) m->reg.data(),
+                                m->reg.size(), &m->userKey, &m->parts);
+}
+
+static
+void micro_ParseCert(Micro* m) {
+  m->result = U2F_derParseCert((const uint8_t*) m->cert.data(),
+                               m->cert.size(), &m->certParts);
+}
+
+static
+void micro_B2a(Micro* m) {
+  m->text = b2a(m->challenge, sizeof(m->challenge));
+}
+
+static
+void micro_A2b(Micro* m) {
+  m->text = a2b(m->hex);
+}
+
+static
+void micro_ApduEncode(Micro* m) {
+  m->len = U2F_apduEncode(0, U2F_INS_AUTHENTICATE, U2F_AUTH_ENFORCE, 0,
+                          m->authReq.data(), m->authReq.size(),
+                          m->apdu, sizeof(m->apdu));
+}
+
+// All the frames of the encoded AUTHENTICATE APDU.
+static
+void micro_FrameEncode(Micro* m) {
+  size_t sent = 0;
+  for (size_t index = 0; index == 0 || sent < m->len; ++index) {
+    sent += U2F_frameEncode(CID_BROADCAST, U2FHID_MSG, m->apdu, m->len,
+                            index, &m->frame);
+  }
+}
+
+static const struct {
+  const char* name;
+  void (*op)(Micro* m);
+} microOps[] = {
+  { "dsa_sig_unpack", micro_SigUnpack },
+  { "p256_from_bin", micro_FromBin },
+  { "p256_ecdsa_verify", micro_EcdsaVerify },
+  { "register digest", micro_RegisterDigest },
+  { "authenticate digest", micro_AuthDigest },
+  { "parse register", micro_ParseRegister },
+  { "parse certificate", micro_ParseCert },
+  { "b2a 32", micro_B2a },
+  { "a2b 64", micro_A2b },
+  { "APDU encode", micro_ApduEncode },
+  { "HID frames encode", micro_FrameEncode },
+};
+
+// Builds the inputs from |key| and |v|, with a self-signed attestation
+// certificate, and checks every operation gets them right.
+static
+bool microSetup(const Key& key, const Vector& v, Micro* m) {
+  m->key = &key;
+  m->v = &v;
+  p256_to_bin(&v.r, m->scalar);
+  memcpy(m->appId, v.message.data(), sizeof(m->appId));
+  memcpy(m->challenge, v.message.data() + U2F_APPID_SIZE +
+         U2F_AUTH_HEADER_SIZE, sizeof(m->challenge));
+  m->keyHandle.resize(64);
+  for (size_t i = 0; i < m->keyHandle.size(); ++i) m->keyHandle[i] = rand();
+  m->hex = b2a(m->challenge, sizeof(m->challenge));
+
+  Key att;
+  makeKey(&att);
+  string attName = makeName("U2FBench attestation");
+  m->cert = makeCert(att, attName, att, attName, 1);
+  micro_RegisterDigest(m);
+  p256_int h, r, s;
+  p256_from_bin(m->digest, &h);
+  sign(att, h, &r, &s);
+  m->reg = string(1, U2F_REGISTER_ID) + key.point +
+           string(1, (char) m->keyHandle.size()) + m->keyHandle + m->cert +
+           derElement(0x30, derInteger(r) + derInteger(s));
+
+  m->authReq = string((const char*) m->challenge, sizeof(m->challenge)) +
+               string((const char*) m->appId, sizeof(m->appId)) +
+               string(1, (char) m->keyHandle.size()) + m->keyHandle;
+
+  micro_SigUnpack(m);
+  if (m->result != 1 || p256_cmp(&m->r, &v.r) || p256_cmp(&m->s, &v.s)) {
+    return false;
+  }
+  micro_FromBin(m);
+  if (p256_cmp(&m->r, &v.r)) return false;
+  micro_EcdsaVerify(m);
+  if (!m->result) return false;
+  micro_AuthDigest(m);
+  p256_from_bin(m->digest, &h);
+  if (p256_cmp(&h, &v.h)) return false;
+  micro_ParseRegister(m);
+  if (!m->result || U2F_verifyRegister(m->appId, m->challenge, m->userKey,
+                                       m->parts, NULL) != 1) {
+    return false;
+  }
+  micro_ParseCert(m);
+  if (!m->result) return false;
+  micro_B2a(m);
+  if (m->text != m->hex) return false;
+  micro_A2b(m);
+  if (m->text != string((const char*) m->challenge, sizeof(m->challenge))) {
+    return false;
+  }
+  micro_ApduEncode(m);
+  if (m->len != m->authReq.size() + U2F_APDU_OVERHEAD ||
+      memcmp(m->apdu + 7, m->authReq.data(), m->authReq.size())) {
+    return false;
+  }
+  string frames;
+  for (size_t index = 0; index == 0 || frames.size() < m->len; ++index) {
+    size_t n = U2F_frameEncode(CID_BROADCAST, U2FHID_MSG, m->apdu, m->len,
+                               index, &m->frame);
+    frames.append((const char*) (index ? m->frame.cont.data :
+                                         m->frame.init.data), n);
+  }
+  return frames == string((const char*) m->apdu, m->len);
+}
+
+// Times each operation, doubling the calls until they take 0.1s.
+static
+void microRun(Micro* m) {
+  for (size_t i = 0; i < sizeof(microOps) / sizeof(microOps[0]); ++i) {
+    size_t calls = 1, allocs = 0;
+    float seconds = 0;
+    for (;;) {
+      size_t before = allocations;
+      uint64_t t = 0; U2Fob_deltaTime(&t);
+      for (size_t k = 0; k < calls; ++k) microOps[i].op(m);
+      seconds = U2Fob_deltaTime(&t);
+      allocs = allocations - before;
+      if (seconds >= 0.1f || calls >= ((size_t) 1 << 30)) break;
+      calls *= 2;
+    }
+    cout << setw(22) << left << microOps[i].name << right << fixed
+         << setprecision(1) << setw(10) << seconds * 1e9 / calls << " ns/op"
+         << setprecision(2) << setw(8) << (float) allocs / calls
+         << " allocs/op" << endl;
+  }
+  cout.unsetf(ios::floatfield);
+}
+
+int main(int argc, char* argv[]) {
+  size_t arg_Count = 1000;
+  size_t arg_Keys = 4;
+  unsigned int arg_Seed = 1;
+  bool arg_Micro = false;  // microbenchmarks only
+
+  while (--argc > 0) {
+    if (!strncmp(argv[argc], "-v", 2)) {
+      // Print the vectors
+      arg_Verbose |= 1;
+    }
+    if (!strncmp(argv[argc], "-n", 2)) {
+      // Signatures per run
+      arg_Count = (size_t) atol(argv[argc] + 2);
+    }
+    if (!strncmp(argv[argc], "-k", 2)) {
+      // Distinct keys they are spread over
+      arg_Keys = (size_t) atol(argv[argc] + 2);
+    }
+    if (!strncmp(argv[argc], "-u", 2)) {
+      // Microbenchmarks only
+      arg_Micro = true;
+    }
+    if (!strncmp(argv[argc], "-s", 2)) {
+      // Seed
+      arg_Seed = (unsigned int) strtoul(argv[argc] + 2, NULL, 0);
+    }
+  }
+  if (arg_Count == 0) arg_Count = 1;
+  if (arg_Keys == 0) arg_Keys = 1;
+
+  srand(arg_Seed);
+  const char* native = U2F_p256Impl();
+
+  vector<Key> keys(arg_Keys);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    makeKey(&keys[i]);
+    keys[i].point = pointOf(keys[i]);
+  }
+
+  vector<Vector> vectors(arg_Count);
+  for (size_t i = 0; i < vectors.size(); ++i) {
+    vectors[i].key = i % keys.size();
+    makeVector(keys[vectors[i].key], &vectors[i]);
+    if (arg_Verbose) {
+      cout << "m " << b2a(vectors[i].message)
+           << " sig " << b2a(vectors[i].der) << endl;
+    }
+  }
+
+  Micro micro;
+  if (!microSetup(keys[vectors[0].key], vectors[0], &micro)) {
+    reportWrong("microbenchmarks");
+  } else {
+    microRun(&micro);
+  }
+  if (arg_Micro) return 0;
+
+  cout << arg_Count << " signatures over " << arg_Keys << " keys, "
+       << native << " field code by default" << endl;
+
+  float baseline = 0;
+  for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i) {
+    const Run& run = runs[i];
+    if (run.mode != MINCRYPT && !U2F_p256Use(run.impl)) continue;
+
+    // Correctness first, untimed.
+    bool ok = true;
+    for (size_t k = 0; k < vectors.size() && ok; ++k) {
+      const Vector& v = vectors[k];
+      p256_int bad = v.h;
+      P256_DIGIT(&bad, 0) ^= 1;
+      ok = verify(run, keys[v.key], v, &v.h) == 1 &&
+           verify(run, keys[v.key], v, &bad) == 0;
+    }
+    if (!ok) {
+      reportWrong(run.name);
+      continue;
+    }
+
+    uint64_t t = 0; U2Fob_deltaTime(&t);
+    for (size_t k = 0; k < vectors.size(); ++k) {
+      const Vector& v = vectors[k];
+      verify(run, keys[v.key], v, &v.h);
+    }
+    float seconds = U2Fob_deltaTime(&t);
+    if (run.mode == MINCRYPT) baseline = seconds;
+
+    report(run.name, "verify", arg_Count, seconds,
+           run.mode == MINCRYPT ? 0 : baseline);
+  }
+  U2F_p256Use(native);
+
+  // Combined checks of up to U2F_P256_BATCH_MAX signatures at a time,
+  // with key tables; must also single out a tampered signature.
+  {
+    vector<p256_int> hs(arg_Count);
+    vector<U2F_p256Sig> sigs(arg_Count);
+    vector<int> results(arg_Count);
+    for (size_t k = 0; k < vectors.size(); ++k) {
+      const Vector& v = vectors[k];
+      const Key& key = keys[v.key];
+      hs[k] = v.h;
+      U2F_p256Sig sig = { &key.x, &key.y, &key.table, &hs[k], &v.r, &v.s };
+      sigs[k] = sig;
+    }
+    size_t tampered = arg_Count / 2;
+    P256_DIGIT(&hs[tampered], 0) ^= 1;
+    U2F_p256VerifyBatch(&sigs[0], sigs.size(), &results[0]);
+    bool ok = true;
+    for (size_t k = 0; k < results.size(); ++k) {
+      ok = ok && results[k] == (k == tampered ? 0 : 1);
+    }
+    hs[tampered] = vectors[tampered].h;
+
+    string name = string(native) + ", batched";
+    if (!ok) {
+      reportWrong(name);
+    } else {
+      uint64_t t = 0; U2Fob_deltaTime(&t);
+      U2F_p256VerifyBatch(&sigs[0], sigs.size(), &results[0]);
+      report(name, "verify", arg_Count, U2Fob_deltaTime(&t), baseline);
+    }
+  }
+
+  vector<const uint8_t*> data(arg_Count);
+  vector<size_t> lens(arg_Count, AUTH_MESSAGE_SIZE);
+  vector<uint8_t> expected(arg_Count * U2F_SHA256_SIZE);
+  vector<uint8_t> digests(arg_Count * U2F_SHA256_SIZE);
+  for (size_t i = 0; i < arg_Count; ++i) {
+    data[i] = (const uint8_t*) vectors[i].message.data();
+    p256_to_bin(&vectors[i].h, &expected[i * U2F_SHA256_SIZE]);
+  }
+
+  const char* nativeHash = U2F_sha256Impl();
+  baseline = 0;
+  for (size_t i = 0; i < sizeof(hashRuns) / sizeof(hashRuns[0]); ++i) {
+    const char* impl = hashRuns[i];
+    string name = string("SHA-256 ") + (*impl ? impl : "mincrypt");
+    if (*impl) {
+      if (!U2F_sha256Use(impl)) continue;
+      U2F_sha256Batch(&data[0], &lens[0], arg_Count, &digests[0]);
+      if (digests != expected) {
+        reportWrong(name);
+        continue;
+      }
+    }
+
+    uint64_t t = 0; U2Fob_deltaTime(&t);
+    if (*impl) {
+      U2F_sha256Batch(&data[0], &lens[0], arg_Count, &digests[0]);
+    } else {
+      for (size_t k = 0; k < arg_Count; ++k) {
+        SHA256_hash(data[k], AUTH_MESSAGE_SIZE,
+                    &digests[k * U2F_SHA256_SIZE]);
+      }
+    }
+    float seconds = U2Fob_deltaTime(&t);
+    if (!*impl) baseline = seconds;
+
+    report(name, "hash", arg_Count, seconds, *impl ? baseline : 0);
+  }
+  U2F_sha256Use(nativeHash);
+
+  // Self-signed attestation: the whole TBSCertificate of each key's
+  // certificate, against the state after its fixed prefix.
+  vector<string> tbs(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    tbs[i] = string((const char*) U2F_ASN1_SELF_SIGNED_TBS_PREFIX,
+                    sizeof(U2F_ASN1_SELF_SIGNED_TBS_PREFIX)) + pointOf(keys[i]);
+  }
+  U2F_sha256Ctx prefix;
+  U2F_sha256Init(&prefix);
+  U2F_sha256Update(&prefix, U2F_ASN1_SELF_SIGNED_TBS_PREFIX,
+                   sizeof(U2F_ASN1_SELF_SIGNED_TBS_PREFIX));
+  for (size_t k = 0; k < arg_Count; ++k) {
+    const string& t = tbs[vectors[k].key];
+    U2F_sha256(t.data(), t.size(), &expected[k * U2F_SHA256_SIZE]);
+  }
+
+  uint64_t t = 0; U2Fob_deltaTime(&t);
+  for (size_t k = 0; k < arg_Count; ++k) {
+    const string& cert = tbs[vectors[k].key];
+    U2F_sha256(cert.data(), cert.size(), &digests[k * U2F_SHA256_SIZE]);
+  }
+  baseline = U2Fob_deltaTime(&t);
+  report("self-signed TBS", "hash", arg_Count, baseline, 0);
+
+  for (size_t k = 0; k < arg_Count; ++k) {
+    U2F_sha256Ctx sha = prefix;
+    U2F_sha256Update(&sha, tbs[vectors[k].key].data() +
+                     sizeof(U2F_ASN1_SELF_SIGNED_TBS_PREFIX), P256_POINT_SIZE);
+    U2F_sha256Final(&sha, &digests[k * U2F_SHA256_SIZE]);
+  }
+  float seconds = U2Fob_deltaTime(&t);
+  if (digests != expected) {
+    reportWrong("self-signed midstate");
+  } else {
+    report("self-signed midstate", "hash", arg_Count, seconds, baseline);
+  }
+
+  // Each backend against libmincrypt, the first, on the same work.
+  baseline = 0;
+  const U2F_crypto* nativeCrypto = U2F_cryptoBackend();
+  for (size_t i = 0; U2F_cryptoBackends[i]; ++i) {
+    const U2F_crypto* crypto = U2F_cryptoBackends[i];
+    string name = string("crypto ") + crypto->name;
+    U2F_cryptoUse(crypto->name);
+
+    bool ok = true;
+    for (size_t k = 0; k < vectors.size() && ok; ++k) {
+      const Vector& v = vectors[k];
+      string bad = v.message;
+      bad[bad.size() - 1] ^= 1;
+      ok = verifyMessage(keys[v.key], v, v.message) == 1 &&
+           verifyMessage(keys[v.key], v, bad) == 0;
+    }
+    if (!ok) {
+      reportWrong(name);
+      continue;
+    }
+
+    U2Fob_deltaTime(&t);
+    for (size_t k = 0; k < vectors.size(); ++k) {
+      const Vector& v = vectors[k];
+      verifyMessage(keys[v.key], v, v.message);
+    }
+    seconds = U2Fob_deltaTime(&t);
+    if (i == 0) baseline = seconds;
+    report(name, "auth", arg_Count, seconds, i ? baseline : 0);
+
+    if (!crypto->sign) continue;
+
+    // Signing, with the signatures checked by the kernel afterwards.
+    vector<p256_int> r(arg_Count), s(arg_Count);
+    U2Fob_deltaTime(&t);
+    for (size_t k = 0; k < vectors.size() && ok; ++k) {
+      const Vector& v = vectors[k];
+      ok = crypto->sign(&keys[v.key].d, &v.h, &r[k], &s[k]);
+    }
+    seconds = U2Fob_deltaTime(&t);
+    for (size_t k = 0; k < vectors.size() && ok; ++k) {
+      const Key& key = keys[vectors[k].key];
+      ok = U2F_p256Verify(&key.x, &key.y, &vectors[k].h, &r[k], &s[k]) == 1;
+    }
+    if (!ok) {
+      reportWrong(name + " sign");
+      continue;
+    }
+    report(name + " sign", "sign", arg_Count, seconds, 0);
+  }
+  U2F_cryptoUse(nativeCrypto->name);
+
+  // Attestation as in an enrollment spike: each signature's key has a
+  // batch certificate from an intermediate under a root, and every
+  // enrollment checks its chain, in full or through the trust store.
+  Key root, ca;
+  makeKey(&root);
+  makeKey(&ca);
+  string rootName = makeName("U2FBench root");
+  string caName = makeName("U2FBench CA");
+  string rootCert = makeCert(root, rootName, root, rootName, 1);
+  string caCert = makeCert(ca, caName, root, rootName, 2);
+  vector<string> batch(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    batch[i] = makeCert(keys[i], makeName("U2FBench batch " + to_string(i)),
+                        ca, caName, (int) (3 + i));
+  }
+  string bad = batch[0];
+  bad[bad.size() / 2] ^= 1;
+
+  U2F_trustStore trust;
+  CHECK_EQ(true, trust.add((const uint8_t*) rootCert.data(), rootCert.size(),
+                           true));
+  CHECK_EQ(true, trust.add((const uint8_t*) caCert.data(), caCert.size(),
+                           false));
+
+  bool ok = verifyCertificate(pointOf(root), caCert) &&
+            !verifyCertificate(pointOf(ca), bad) &&
+            !trust.verify((const uint8_t*) bad.data(), bad.size());
+  for (size_t i = 0; i < batch.size() && ok; ++i) {
+    ok = verifyCertificate(pointOf(ca), batch[i]);
+  }
+  if (!ok) {
+    reportWrong("attestation chain");
+    return 0;
+  }
+
+  U2Fob_deltaTime(&t);
+  for (size_t k = 0; k < vectors.size(); ++k) {
+    verifyCertificate(pointOf(ca), batch[vectors[k].key]);
+    verifyCertificate(pointOf(root), caCert);
+  }
+  baseline = U2Fob_deltaTime(&t);
+  report("attestation chain", "enroll", arg_Count, baseline, 0);
+
+  for (size_t k = 0; k < vectors.size() && ok; ++k) {
+    const string& cert = batch[vectors[k].key];
+    ok = trust.verify((const uint8_t*) cert.data(), cert.size());
+  }
+  seconds = U2Fob_deltaTime(&t);
+  if (!ok) {
+    reportWrong("attestation cached");
+    return 0;
+  }
+  report("attestation cached", "enroll", arg_Count, seconds, baseline);
+
+  // Counter checks, each message under its own key handle, in a fresh
+  // store file.
+  const char* counterFile = "U2FBench.counters";
+  remove(counterFile);
+  U2F_counterStore counters;
+  CHECK_EQ(true, counters.open(counterFile, 2 * arg_Count));
+  vector<string> handles(arg_Count);
+  for (size_t k = 0; k < handles.size() && ok; ++k) {
+    handles[k] = vectors[k].message.substr(0, 32) + to_string(k);
+    ok = counters.advance((const uint8_t*) handles[k].data(),
+                          handles[k].size(), 1, NULL) == U2F_COUNTER_NEW;
+  }
+  U2Fob_deltaTime(&t);
+  for (size_t k = 0; k < handles.size() && ok; ++k) {
+    ok = counters.advance((const uint8_t*) handles[k].data(),
+                          handles[k].size(), 2, NULL) ==
+         U2F_COUNTER_ADVANCED;
+  }
+  seconds = U2Fob_deltaTime(&t);
+  for (size_t k = 0; k < handles.size() && ok; ++k) {
+    ok = counters.advance((const uint8_t*) handles[k].data(),
+                          handles[k].size(), 2, NULL) ==
+         U2F_COUNTER_REPLAYED;
+  }
+  counters.close();
+  remove(counterFile);
+  if (!ok) {
+    reportWrong("counter advance");
+    return 0;
+  }
+  report("counter advance", "auth", arg_Count, seconds, 0);
+
+  return 0;
+}
@@ -13,6 +13,7 @@
 
 #include <iostream>
 #include <iomanip>
+#include <map>
 
 #ifdef __OS_WIN
 #include <winsock2.h>  // ntohl, htonl
@@ -21,12 +22,16 @@
 #endif
 
 #include "u2f.h"
+#include "u2f_asn1.h"
+#include "u2f_counters.h"
+#include "u2f_crypto.h"
+#include "u2f_keycache.h"
+#include "u2f_pipeline.h"
+#include "u2f_trust.h"
 #include "u2f_util.h"
+#include "u2f_verify.h"
 
-#include "mincrypt/dsa_sig.h"
 #include "mincrypt/p256.h"
-#include "mincrypt/p256_ecdsa.h"
-#include "mincrypt/sha256.h"
 
 using namespace std;
 
@@ -65,6 +70,14 @@ struct U2Fob* device;
 U2F_REGISTER_REQ regReq;
 U2F_REGISTER_RESP regRsp;
 
+U2F_keyCache keyCache;
+U2F_trustStore trustStore;
+U2F_counterStore counterStore;
+
+// SHA-256 state after the self-signed certificate's TBSCertificate
+// prefix, which is the same for every fob.
+U2F_sha256Ctx selfSignedSha;
+
 void test_Version() {
   string rsp;
   int res = U2Fob_apdu(device, 0, U2F_INS_VERSION, 0, 0, "", &rsp);
@@ -150,66 +163,48 @@ void test_Enroll(int expectedSW12 = 0x9000) {
        << U2Fob_deltaTime(&t) << "s";
 
   // Check crypto of enroll response.
-  string cert;
-  CHECK_EQ(getCertificate(regRsp, &cert), true);
-  INFO << "cert: " << b2a(cert);
-
-  string pk;
-  CHECK_EQ(getSubjectPublicKey(cert, &pk), true);
-  INFO << "pk  : " << b2a(pk);
-
-  string sig;
-  CHECK_EQ(getSignature(regRsp, &sig), true);
-  INFO << "sig : " << b2a(sig);
-
-  // Parse signature into two integers.
-  p256_int sig_r, sig_s;
-  CHECK_EQ(1, dsa_sig_unpack((uint8_t*) (sig.data()), sig.size(),
-                             &sig_r, &sig_s));
-
-  // Compute hash as integer.
-  p256_int h;
-  SHA256_CTX sha;
-  SHA256_init(&sha);
-  uint8_t rfu = 0;
-  SHA256_update(&sha, &rfu, sizeof(rfu));  // 0x00
-  SHA256_update(&sha, regReq.appId, sizeof(regReq.appId));  // O
-  SHA256_update(&sha, regReq.nonce, sizeof(regReq.nonce));  // d
-  SHA256_update(&sha, regRsp.keyHandleCertSig, regRsp.keyHandleLen);  // hk
-  SHA256_update(&sha, &regRsp.pubKey, sizeof(regRsp.pubKey));  // pk
-  p256_from_bin(SHA256_final(&sha), &h);
-
-  // Parse subject public key into two integers.
-  CHECK_EQ(pk.size(), P256_POINT_SIZE);
-  p256_int pk_x, pk_y;
-  p256_from_bin((uint8_t*) pk.data() + 1, &pk_x);
-  p256_from_bin((uint8_t*) pk.data() + 1 + P256_SCALAR_SIZE, &pk_y);
+  U2F_derSpan userKey;
+  U2F_derRegister parts;
+  CHECK_GE(regRsp.keyHandleLen, 64);
+  CHECK_EQ(true, U2F_parseRegister((const uint8_t*) rsp.data(), rsp.size(),
+                                   &userKey, &parts));
+  INFO << "cert: " << b2a(parts.cert.data, parts.cert.len);
+  INFO << "pk  : " << b2a(parts.pubKey.data, parts.pubKey.len);
+  INFO << "sig : " << b2a(parts.sig.data, parts.sig.len);
 
   // Verify signature.
-  CHECK_EQ(1, p256_ecdsa_verify(&pk_x, &pk_y, &h, &sig_r, &sig_s));
+  CHECK_EQ(1, U2F_verifyRegister(regReq.appId, regReq.nonce, userKey, parts,
+                                 &keyCache));
 
-#if 0
   // Check for standard U2F self-signed certificate.
   // Implementations without batch attestation should use this minimalist
   // self-signed certificate for enroll.
   // Conforming to a standard self-signed certficate format and attributes
   // bins all such fobs into a single large batch, which helps privacy.
-  string selfSigned = a2b(
-      "3081B3A003020102020101300A06082A8648CE3D040302300E310C300A060355040A0C035532463022180F32303030303130313030303030305A180F32303939313233313233353935395A300E310C300A060355040313035532463059301306072A8648CE3D020106082A8648CE3D030107034200") + pk;
-
-  SHA256_init(&sha);
-  SHA256_update(&sha, selfSigned.data(), selfSigned.size());
-  p256_from_bin(SHA256_final(&sha), &h);
-
-  string certSig;
-  CHECK_EQ(getCertSignature(cert, &certSig), true);
-  INFO << "certSig : " << b2a(certSig);
-
-  CHECK_EQ(1, dsa_sig_unpack((uint8_t*) (certSig.data()), certSig.size(),
-                             &sig_r, &sig_s));
-  // Verify cert signature.
-  CHECK_EQ(1, p256_ecdsa_verify(&pk_x, &pk_y, &h, &sig_r, &sig_s));
-#endif
+  if (parts.tbs.len == sizeof(U2F_ASN1_SELF_SIGNED_TBS_PREFIX) +
+                       P256_POINT_SIZE &&
+      !memcmp(parts.tbs.data, U2F_ASN1_SELF_SIGNED_TBS_PREFIX,
+              sizeof(U2F_ASN1_SELF_SIGNED_TBS_PREFIX))) {
+    INFO << "self-signed certificate";
+    CHECK_EQ(parts.certAlg.len, sizeof(U2F_ASN1_ECDSA_SHA256));
+    CHECK_EQ(0, memcmp(parts.certAlg.data, U2F_ASN1_ECDSA_SHA256,
+                       sizeof(U2F_ASN1_ECDSA_SHA256)));
+
+    // Only the key is left to hash.
+    uint8_t digest[U2F_SHA256_SIZE];
+    U2F_sha256Ctx sha = selfSignedSha;
+    U2F_sha256Update(&sha, parts.pubKey.data, parts.pubKey.len);
+    U2F_sha256Final(&sha, digest);
+
+    INFO << "certSig : " << b2a(parts.certSig.data, parts.certSig.len);
+    // Verify cert signature.
+    CHECK_EQ(1, U2F_verifySignature(parts.pubKey.data, digest,
+                                    parts.certSig.data, parts.certSig.len,
+                                    &keyCache));
+  } else if (trustStore.roots()) {
+    // Batch certificate; check it chains to a trusted root.
+    CHECK_EQ(true, trustStore.verify(parts.cert.data, parts.cert.len));
+  }
 }
 
 // returns ctr
@@ -250,33 +245,453 @@ uint32_t test_Sign(int expectedSW12 = 0x9000, bool checkOnly = false) {
   INFO << "Sign: " << rsp.size() << " bytes in "
        << U2Fob_deltaTime(&t) << "s";
 
-  // Parse signature from authenticate response.
-  p256_int sig_r, sig_s;
-  CHECK_EQ(1, dsa_sig_unpack(resp.sig,
-                             rsp.size() - sizeof(resp.flags) - sizeof(resp.ctr),
-                             &sig_r, &sig_s));
-
-  // Compute hash as integer.
-  p256_int h;
-  SHA256_CTX sha;
-  SHA256_init(&sha);
-  SHA256_update(&sha, regReq.appId, sizeof(regReq.appId));  // O
-  SHA256_update(&sha, &resp.flags, sizeof(resp.flags));  // T
-  SHA256_update(&sha, &resp.ctr, sizeof(resp.ctr));  // CTR
-  SHA256_update(&sha, authReq.nonce, sizeof(authReq.nonce));  // d
-  p256_from_bin(SHA256_final(&sha), &h);
-
-  // Parse public key from registration response.
-  p256_int pk_x, pk_y;
-  p256_from_bin(regRsp.pubKey.x, &pk_x);
-  p256_from_bin(regRsp.pubKey.y, &pk_y);
-
-  // Verify signature.
-  CHECK_EQ(1, p256_ecdsa_verify(&pk_x, &pk_y, &h, &sig_r, &sig_s));
+  // Verify signature, with the public key from the registration response
+  // decoded, validated and precomputed once.
+  CHECK_EQ(1, U2F_verifyAuthenticate((uint8_t*) &regRsp.pubKey, regReq.appId,
+                                     authReq.nonce,
+                                     (const uint8_t*) rsp.data(), rsp.size(),
+                                     &keyCache));
+
+  if (counterStore.isOpen()) {
+    // A clone of the fob would sooner or later repeat a counter.
+    uint32_t last = 0;
+    U2F_counterResult result =
+        counterStore.advance(authReq.keyHandle, authReq.keyHandleLen,
+                             ntohl(resp.ctr), &last);
+    INFO << "ctr " << ntohl(resp.ctr) << ": "
+         << U2F_counterResultName(result);
+    if (result == U2F_COUNTER_REPLAYED) INFO << "last ctr " << last;
+    CHECK_NE(U2F_COUNTER_REPLAYED, result);
+    CHECK_NE(U2F_COUNTER_FULL, result);
+  }
 
   return ntohl(resp.ctr);
 }
 
+// Soak mode: a weighted random mix of operations for hours, reporting
+// latency percentiles, outcomes and channel recoveries at fixed intervals.
+
+enum { SOAK_PING, SOAK_INIT, SOAK_VERSION, SOAK_AUTHENTICATE, SOAK_SIGN,
+       SOAK_OPS };
+
+static const struct {
+  const char* name;
+  int weight;
+} soakOps[SOAK_OPS] = {
+  { "PING", 40 },
+  { "INIT", 10 },
+  { "VERSION", 30 },
+  { "AUTHENTICATE", 20 },  // check-only, no user presence needed
+  { "SIGN", 10 },  // enforce, only for fobs without a button (-b)
+};
+
+// Samples kept for a whole run; the median of 100000 is within about
+// 0.3 percentile points of the true one.
+#define SOAK_KEEP  100000
+
+struct SoakStats {
+  uint64_t ops;
+  U2F_samples latency[SOAK_OPS];  // seconds, successful ops only
+  map<string, uint64_t> outcomes;  // "ok", ERR_* name, SW12 or "bad reply"
+  uint64_t reinits;  // channel recovered by INIT
+  uint64_t reopens;  // channel recovered by reopening the device
+  uint64_t lost;  // not recovered
+  U2F_samples recovery;  // seconds to recover
+
+  SoakStats() : ops(0), reinits(0), reopens(0), lost(0) {}
+
+  // Bounds the memory taken by the samples; see U2F_samples::limit().
+  void limit(size_t capacity) {
+    for (int i = 0; i < SOAK_OPS; ++i) latency[i].limit(capacity);
+    recovery.limit(capacity);
+  }
+
+  void clear() {
+    ops = reinits = reopens = lost = 0;
+    for (int i = 0; i < SOAK_OPS; ++i) latency[i].clear();
+    outcomes.clear();
+    recovery.clear();
+  }
+};
+
+static
+string outcomeName(int res) {
+  switch (-res) {
+    case ERR_INVALID_CMD: return "ERR_INVALID_CMD";
+    case ERR_INVALID_PAR: return "ERR_INVALID_PAR";
+    case ERR_INVALID_LEN: return "ERR_INVALID_LEN";
+    case ERR_INVALID_SEQ: return "ERR_INVALID_SEQ";
+    case ERR_MSG_TIMEOUT: return "ERR_MSG_TIMEOUT";
+    case ERR_CHANNEL_BUSY: return "ERR_CHANNEL_BUSY";
+    case ERR_LOCK_REQUIRED: return "ERR_LOCK_REQUIRED";
+    case ERR_INVALID_CID: return "ERR_INVALID_CID";
+    case ERR_OTHER: return "ERR_OTHER";
+  }
+  char buf[16];
+  if (res > 0) {
+    sprintf(buf, "SW %04X", res);
+  } else {
+    sprintf(buf, "ERR %d", -res);
+  }
+  return buf;
+}
+
+static
+string soak_Ping() {
+  uint8_t out[128], in[128];
+  size_t len = rand() % sizeof(out);
+  for (size_t i = 0; i < len; ++i) out[i] = rand();
+
+  int res = U2Fob_send(device, U2FHID_PING, out, len);
+  if (res != 0) return outcomeName(res);
+
+  uint8_t cmd;
+  res = U2Fob_recv(device, &cmd, in, sizeof(in), 2.0);
+  if (res < 0) return outcomeName(res);
+  if (cmd != U2FHID_PING || (size_t) res != len || memcmp(in, out, len)) {
+    return "bad reply";
+  }
+  return "ok";
+}
+
+static
+string soak_Init() {
+  int res = U2Fob_init(device);
+  return res ? outcomeName(res) : "ok";
+}
+
+static
+string soak_Version() {
+  string rsp;
+  int res = U2Fob_apdu(device, 0, U2F_INS_VERSION, 0, 0, "", &rsp);
+  if (res != 0x9000) return outcomeName(res);
+  return rsp == "U2F_V2" ? "ok" : "bad reply";
+}
+
+static
+string soak_Authenticate() {
+  U2F_AUTHENTICATE_REQ authReq;
+  for (size_t i = 0; i < sizeof(authReq.nonce); ++i)
+      authReq.nonce[i] = rand();
+  memcpy(authReq.appId, regReq.appId, sizeof(authReq.appId));
+  authReq.keyHandleLen = regRsp.keyHandleLen;
+  memcpy(authReq.keyHandle, regRsp.keyHandleCertSig, authReq.keyHandleLen);
+
+  // Known key handle, check-only: expect "user presence required".
+  string rsp;
+  int res = U2Fob_apdu(device, 0, U2F_INS_AUTHENTICATE, U2F_AUTH_CHECK_ONLY, 0,
+                       string(reinterpret_cast<char*>(&authReq),
+                              U2F_NONCE_SIZE + U2F_APPID_SIZE + 1 +
+                              authReq.keyHandleLen),
+                       &rsp);
+  if (res != 0x6985) return outcomeName(res);
+  return rsp.empty() ? "ok" : "bad reply";
+}
+
+// Counters seen by SIGN, to catch one that fails to go up.
+struct SoakCounter {
+  bool have;
+  uint32_t last;
+
+  SoakCounter() : have(false), last(0) {}
+};
+
+static
+string soak_Sign(SoakCounter* counter) {
+  U2F_AUTHENTICATE_REQ authReq;
+  for (size_t i = 0; i < sizeof(authReq.nonce); ++i)
+      authReq.nonce[i] = rand();
+  memcpy(authReq.appId, regReq.appId, sizeof(authReq.appId));
+  authReq.keyHandleLen = regRsp.keyHandleLen;
+  memcpy(authReq.keyHandle, regRsp.keyHandleCertSig, authReq.keyHandleLen);
+
+  string rsp;
+  int res = U2Fob_apdu(device, 0, U2F_INS_AUTHENTICATE, U2F_AUTH_ENFORCE, 0,
+                       string(reinterpret_cast<char*>(&authReq),
+                              U2F_NONCE_SIZE + U2F_APPID_SIZE + 1 +
+                              authReq.keyHandleLen),
+                       &rsp);
+  if (res != 0x9000) return outcomeName(res);
+  if (rsp.size() <= U2F_AUTH_HEADER_SIZE) return "bad reply";
+  if (U2F_verifyAuthenticate((uint8_t*) &regRsp.pubKey, regReq.appId,
+                             authReq.nonce, (const uint8_t*) rsp.data(),
+                             rsp.size(), &keyCache) != 1) {
+    return "bad signature";
+  }
+
+  uint32_t ctr;
+  memcpy(&ctr, rsp.data() + 1, sizeof(ctr));
+  ctr = ntohl(ctr);
+  if (counter->have && ctr <= counter->last) {
+    INFO << "SIGN: ctr " << ctr << " after " << counter->last;
+    counter->last = ctr;
+    return "ctr not rising";
+  }
+  counter->have = true;
+  counter->last = ctr;
+  if (counterStore.isOpen()) {
+    U2F_counterResult result =
+        counterStore.advance(authReq.keyHandle, authReq.keyHandleLen, ctr,
+                             NULL);
+    if (result == U2F_COUNTER_REPLAYED) return "ctr replayed";
+    if (result == U2F_COUNTER_FULL) return "ctr store full";
+  }
+  return "ok";
+}
+
+// Get the channel working again after a failed operation.
+static
+void soak_Recover(SoakStats* interval, SoakStats* total) {
+  uint64_t t = 0; U2Fob_deltaTime(&t);
+
+  if (U2Fob_init(device) == 0) {
+    interval->reinits++;
+    total->reinits++;
+  } else if (U2Fob_reopen(device) == 0 && U2Fob_init(device) == 0) {
+    interval->reopens++;
+    total->reopens++;
+  } else {
+    interval->lost++;
+    total->lost++;
+    usleep(1000000);  // don't spin on an unplugged device
+  }
+
+  float dt = U2Fob_deltaTime(&t);
+  interval->recovery.add(dt);
+  total->recovery.add(dt);
+}
+
+static
+void soak_Report(const char* title, float elapsed, const SoakStats& s,
+                 const float* baseline) {
+  streamsize precision = cout.precision();
+  cout << fixed << setprecision(1)
+       << title << " t+" << elapsed << "s: " << s.ops << " ops" << endl;
+  cout << setw(14) << left << "  op" << right
+       << setw(8) << "n" << setw(9) << "p50ms" << setw(9) << "p90ms"
+       << setw(9) << "p99ms" << setw(9) << "maxms" << setw(9) << "drift"
+       << endl;
+  for (int i = 0; i < SOAK_OPS; ++i) {
+    const U2F_samples& l = s.latency[i];
+    float p50 = l.percentile(.5f);
+    cout << "  " << setw(12) << left << soakOps[i].name << right
+         << setprecision(2)
+         << setw(8) << l.size()
+         << setw(9) << p50 * 1000
+         << setw(9) << l.percentile(.9f) * 1000
+         << setw(9) << l.percentile(.99f) * 1000
+         << setw(9) << l.percentile(1) * 1000;
+    // Median relative to the first interval's.
+    if (baseline[i] > 0 && l.size()) {
+      cout << setw(8) << setprecision(1) << showpos
+           << (p50 / baseline[i] - 1) * 100 << noshowpos << "%";
+    }
+    cout << endl;
+  }
+
+  cout << "  outcomes:";
+  for (map<string, uint64_t>::const_iterator it = s.outcomes.begin();
+       it != s.outcomes.end(); ++it) {
+    cout << " " << it->first << " " << it->second;
+  }
+  cout << endl;
+
+  cout << "  recovery: init " << s.reinits << ", reopen " << s.reopens
+       << ", lost " << s.lost;
+  if (s.recovery.size()) {
+    cout << setprecision(2) << ", p50 " << s.recovery.percentile(.5f) * 1000
+         << "ms, max " << s.recovery.percentile(1) * 1000 << "ms";
+  }
+  cout << endl;
+
+  cout.unsetf(ios::floatfield);
+  cout.precision(precision);
+}
+
+// Runs the mix for |seconds|, reporting every |every| seconds; SIGN is
+// in it only if |sign|, as it needs a fob that signs without a touch.
+// Returns the number of failed operations.
+uint64_t soak(float seconds, float every, bool sign) {
+  SoakStats interval, total;
+  SoakCounter counter;
+  float baseline[SOAK_OPS] = { 0 };
+  bool haveBaseline = false;
+  total.limit(SOAK_KEEP);
+
+  int weight[SOAK_OPS], totalWeight = 0;
+  for (int i = 0; i < SOAK_OPS; ++i) {
+    weight[i] = i == SOAK_SIGN && !sign ? 0 : soakOps[i].weight;
+    totalWeight += weight[i];
+  }
+
+  uint64_t clock = 0; U2Fob_deltaTime(&clock);
+  float elapsed = 0, sinceReport = 0;
+
+  while (elapsed < seconds) {
+    int op = 0;
+    for (int w = rand() % totalWeight; w >= weight[op]; ++op) {
+      w -= weight[op];
+    }
+
+    uint64_t t = 0; U2Fob_deltaTime(&t);
+    string outcome;
+    switch (op) {
+      case SOAK_PING: outcome = soak_Ping(); break;
+      case SOAK_INIT: outcome = soak_Init(); break;
+      case SOAK_VERSION: outcome = soak_Version(); break;
+      case SOAK_AUTHENTICATE: outcome = soak_Authenticate(); break;
+      case SOAK_SIGN: outcome = soak_Sign(&counter); break;
+    }
+    float dt = U2Fob_deltaTime(&t);
+
+    interval.ops++;
+    total.ops++;
+    interval.outcomes[outcome]++;
+    total.outcomes[outcome]++;
+
+    if (outcome == "ok") {
+      interval.latency[op].add(dt);
+      total.latency[op].add(dt);
+    } else {
+      INFO << soakOps[op].name << ": " << outcome;
+      // A status word, signature or counter is the application talking;
+      // the channel is fine.
+      if (outcome.compare(0, 3, "SW ") && outcome.compare(0, 4, "ctr ") &&
+          outcome != "bad signature") {
+        soak_Recover(&interval, &total);
+      }
+    }
+
+    float d = U2Fob_deltaTime(&clock);
+    elapsed += d;
+    sinceReport += d;
+    if (sinceReport >= every || elapsed >= seconds) {
+      if (!haveBaseline) {
+        for (int i = 0; i < SOAK_OPS; ++i) {
+          baseline[i] = interval.latency[i].percentile(.5f);
+        }
+        haveBaseline = true;
+      }
+      soak_Report("soak", elapsed, interval, baseline);
+      interval.clear();
+      sinceReport = 0;
+    }
+  }
+
+  soak_Report("soak total", elapsed, total, baseline);
+  return total.ops - total.outcomes["ok"];
+}
+
+// Bulk mode: signatures back to back, each verified on a worker while
+// the next AUTHENTICATE is with the device.
+
+struct BulkStats {
+  uint64_t ok, failed;
+  float verify;  // seconds spent verifying
+  bool haveCtr;
+  uint32_t ctr;  // last counter
+
+  BulkStats() : ok(0), failed(0), verify(0), haveCtr(false), ctr(0) {}
+};
+
+// Checks a verified response; jobs come back in the order they were
+// sent, so the counter has to go up every time.
+static
+void bulk_Check(const U2F_pipelineJob& job, BulkStats* stats) {
+  stats->verify += job.seconds;
+  if (job.result != 1) {
+    INFO << "signature " << job.seq << ": " << job.result;
+    stats->failed++;
+    return;
+  }
+  uint32_t ctr;
+  memcpy(&ctr, job.rsp.data() + 1, sizeof(ctr));
+  ctr = ntohl(ctr);
+  if (stats->haveCtr && ctr <= stats->ctr) {
+    INFO << "signature " << job.seq << ": ctr " << ctr << " after "
+         << stats->ctr;
+    stats->failed++;
+    return;
+  }
+  stats->haveCtr = true;
+  stats->ctr = ctr;
+  if (counterStore.isOpen()) {
+    U2F_counterResult result =
+        counterStore.advance(regRsp.keyHandleCertSig, regRsp.keyHandleLen,
+                             ctr, NULL);
+    if (result == U2F_COUNTER_REPLAYED || result == U2F_COUNTER_FULL) {
+      INFO << "signature " << job.seq << ": ctr "
+           << U2F_counterResultName(result);
+      stats->failed++;
+      return;
+    }
+  }
+  stats->ok++;
+}
+
+// Runs |count| signatures with the registered key handle, stopping at
+// the first that wants a touch.
+// Returns the number that failed.
+uint64_t bulk(size_t count) {
+  U2F_pipeline pipeline(1, 4, &keyCache);
+  U2F_pipelineJob job, done;
+  memcpy(job.appId, regReq.appId, sizeof(job.appId));
+  memcpy(job.userKey, &regRsp.pubKey, sizeof(job.userKey));
+
+  U2F_AUTHENTICATE_REQ authReq;
+  memcpy(authReq.appId, regReq.appId, sizeof(authReq.appId));
+  authReq.keyHandleLen = regRsp.keyHandleLen;
+  memcpy(authReq.keyHandle, regRsp.keyHandleCertSig, authReq.keyHandleLen);
+
+  BulkStats stats;
+  float busy = 0;  // seconds the device took
+  uint64_t clock = 0; U2Fob_deltaTime(&clock);
+
+  for (size_t i = 0; i < count; ++i) {
+    for (size_t j = 0; j < sizeof(authReq.nonce); ++j)
+        authReq.nonce[j] = rand();
+
+    uint64_t t = 0; U2Fob_deltaTime(&t);
+    string rsp;
+    int res = U2Fob_apdu(device, 0, U2F_INS_AUTHENTICATE, U2F_AUTH_ENFORCE, 0,
+                         string(reinterpret_cast<char*>(&authReq),
+                                U2F_NONCE_SIZE + U2F_APPID_SIZE + 1 +
+                                authReq.keyHandleLen),
+                         &rsp);
+    busy += U2Fob_deltaTime(&t);
+
+    if (res == 0x6985) {
+      // Nobody is there to touch the fob for every signature.
+      cerr << "bulk: AUTHENTICATE wants user presence (6985) after " << i
+           << " signatures; -m is for fobs that sign without a touch"
+           << endl;
+      stats.failed++;
+      break;
+    }
+    if (res != 0x9000 || rsp.size() <= U2F_AUTH_HEADER_SIZE) {
+      INFO << "AUTHENTICATE: " << outcomeName(res);
+      stats.failed++;
+    } else {
+      memcpy(job.challenge, authReq.nonce, sizeof(job.challenge));
+      job.rsp = rsp;
+      pipeline.submit(job);
+    }
+    while (pipeline.poll(&done)) bulk_Check(done, &stats);
+  }
+  while (pipeline.next(&done)) bulk_Check(done, &stats);
+
+  float elapsed = U2Fob_deltaTime(&clock);
+  streamsize precision = cout.precision();
+  cout << fixed << setprecision(2)
+       << "bulk: " << stats.ok << " signatures in " << elapsed << "s, "
+       << stats.ok / elapsed << "/s, " << stats.failed << " failed" << endl
+       << "  device " << busy << "s, verify " << stats.verify
+       << "s, serial would take " << busy + stats.verify << "s" << endl;
+  cout.unsetf(ios::floatfield);
+  cout.precision(precision);
+  return stats.failed;
+}
+
 void check_Compilation() {
   // Couple of sanity checks.
   CHECK_EQ(sizeof(P256_POINT), 65);
@@ -287,7 +702,9 @@ void check_Compilation() {
 int main(int argc, char* argv[]) {
   if (argc < 2) {
     cerr << "Usage: " << argv[0]
-         << " <device-path> [-a] [-v] [-V] [-p] [-b]" << endl;
+         << " <device-path> [-a] [-v] [-V] [-p] [-b]"
+         << " [-s<seconds>] [-i<seconds>] [-c<crypto>] [-t<roots>]"
+         << " [-k<counters>] [-m<count>]" << endl;
     return -1;
   }
 
@@ -295,6 +712,9 @@ int main(int argc, char* argv[]) {
 
   char* arg_DeviceName = argv[1];
   bool arg_hasButton = true;  // fob has button
+  float arg_Soak = 0;  // seconds of soak mode, 0 for the compliance tests
+  float arg_SoakInterval = 60;  // seconds between soak reports
+  size_t arg_Bulk = 0;  // signatures in bulk mode, 0 for the tests
 
   while (--argc > 1) {
     if (!strncmp(argv[argc], "-v", 2)) {
@@ -318,15 +738,65 @@ int main(int argc, char* argv[]) {
       // Fob does not have button
       arg_hasButton = false;
     }
+    if (!strncmp(argv[argc], "-s", 2)) {
+      // Soak for this many seconds instead of testing
+      arg_Soak = (float) atof(argv[argc] + 2);
+    }
+    if (!strncmp(argv[argc], "-i", 2)) {
+      // Soak report interval
+      arg_SoakInterval = (float) atof(argv[argc] + 2);
+    }
+    if (!strncmp(argv[argc], "-m", 2)) {
+      // Bulk signatures instead of testing
+      arg_Bulk = (size_t) atol(argv[argc] + 2);
+    }
+    if (!strncmp(argv[argc], "-c", 2)) {
+      // Crypto backend
+      if (!U2F_cryptoUse(argv[argc] + 2)) {
+        cerr << "No crypto backend " << argv[argc] + 2 << endl;
+        return -1;
+      }
+    }
+    if (!strncmp(argv[argc], "-t", 2)) {
+      // Attestation roots to check enrollments against
+      if (trustStore.load(argv[argc] + 2, true) <= 0) {
+        cerr << "Cannot load roots from " << argv[argc] + 2 << endl;
+        return -1;
+      }
+    }
+    if (!strncmp(argv[argc], "-k", 2)) {
+      // Signature counters to check and record
+      if (!counterStore.open(argv[argc] + 2)) {
+        cerr << "Cannot open counters in " << argv[argc] + 2 << endl;
+        return -1;
+      }
+    }
   }
 
   srand((unsigned int) time(NULL));
 
+  U2F_sha256Init(&selfSignedSha);
+  U2F_sha256Update(&selfSignedSha, U2F_ASN1_SELF_SIGNED_TBS_PREFIX,
+                   sizeof(U2F_ASN1_SELF_SIGNED_TBS_PREFIX));
+
   CHECK_EQ(0, U2Fob_open(device, arg_DeviceName));
   CHECK_EQ(0, U2Fob_init(device));
 
   PASS(check_Compilation());
 
+  if (arg_Soak > 0 || arg_Bulk > 0) {
+    // One enrollment gives AUTHENTICATE a valid key handle.
+    PASS(test_Version());
+    WaitForUserPresence(device, arg_hasButton);
+    PASS(test_Enroll(0x9000));
+
+    uint64_t failed = arg_Bulk > 0 ? bulk(arg_Bulk) :
+                                      soak(arg_Soak, arg_SoakInterval,
+                                           !arg_hasButton);
+    U2Fob_destroy(device);
+    return failed ? 1 : 0;
+  }
+
   PASS(test_Version());
   PASS(test_UnknownINS());
   PASS(test_WrongLength_U2F_VERSION());
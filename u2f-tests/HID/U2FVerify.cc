@@ -0,0 +1,200 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Offline audit of logged U2F signatures.
+//
+// Reads lines of
+//   <public key> <digest | message> <signature>
+// in hex: 65 byte uncompressed point, 32 byte SHA-256 or the longer
+// message it is taken over, DER signature. Hashes and verifies them in
+// batches across all cores and reports the lines that do not verify.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "u2f_batch.h"
+#include "u2f_crypto.h"
+#include "u2f_keycache.h"
+#include "u2f_p256.h"
+#include "u2f_util.h"
+
+#include "mincrypt/p256.h"
+
+using namespace std;
+
+int arg_Verbose = 0;  // default
+bool arg_Combined = false;  // default
+
+// Lines verified per batch; bounds memory on large logs.
+#define VERIFY_CHUNK  65536
+
+U2F_keyCache keyCache;
+
+// Parses one log line into |item|, holding its key in |key|.
+// A line that has the message rather than its digest leaves the message
+// in |message| to be hashed with the rest of the batch.
+static
+bool parseLine(const string& line, U2F_verifyItem* item,
+               shared_ptr<const U2F_key>* key, string* message) {
+  istringstream in(line);
+  string pkHex, hHex, sigHex;
+  if (!(in >> pkHex >> hHex >> sigHex)) return false;
+
+  string pk = a2b(pkHex), h = a2b(hHex), sig = a2b(sigHex);
+  if (pk.size() != P256_POINT_SIZE) return false;
+  if (h.size() < P256_SCALAR_SIZE) return false;
+
+  // Logs repeat the same few keys; decode, check and precompute each
+  // only once.
+  *key = keyCache.get((const uint8_t*) pk.data());
+  if (!*key) return false;
+  item->x = (*key)->x;
+  item->y = (*key)->y;
+  item->key = (*key)->hasTable ? &(*key)->table : NULL;
+  if (h.size() == P256_SCALAR_SIZE) {
+    p256_from_bin((const uint8_t*) h.data(), &item->h);
+  } else {
+    message->swap(h);
+  }
+  return U2F_cryptoBackend()->sigDecode((const uint8_t*) sig.data(),
+                                        sig.size(), &item->r, &item->s);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0]
+         << " <log-file | -> [-v] [-j<threads>] [-c<crypto>] [-b]" << endl;
+    return -1;
+  }
+
+  char* arg_LogName = argv[1];
+  unsigned arg_Threads = 0;  // one per core
+
+  while (--argc > 1) {
+    if (!strncmp(argv[argc], "-v", 2)) {
+      // Print every line's result
+      arg_Verbose |= 1;
+    }
+    if (!strncmp(argv[argc], "-j", 2)) {
+      // Threads to verify on
+      arg_Threads = (unsigned) atoi(argv[argc] + 2);
+    }
+    if (!strncmp(argv[argc], "-b", 2)) {
+      // Check signatures a batch at a time
+      arg_Combined = true;
+    }
+    if (!strncmp(argv[argc], "-c", 2)) {
+      // Crypto backend
+      if (!U2F_cryptoUse(argv[argc] + 2)) {
+        cerr << "No crypto backend " << argv[argc] + 2 << endl;
+        return -1;
+      }
+    }
+  }
+  const U2F_crypto* crypto = U2F_cryptoBackend();
+
+  ifstream file;
+  if (strcmp(arg_LogName, "-")) {
+    file.open(arg_LogName);
+    if (!file) {
+      cerr << "Cannot open " << arg_LogName << endl;
+      return -1;
+    }
+  }
+  istream& log = strcmp(arg_LogName, "-") ? file : cin;
+
+  vector<U2F_verifyItem> items;
+  vector<shared_ptr<const U2F_key> > keys;  // pinned while items use them
+  vector<size_t> lineNumbers;
+  vector<string> messages;  // and the items they are for
+  vector<size_t> messageItems;
+  items.reserve(VERIFY_CHUNK);
+  keys.reserve(VERIFY_CHUNK);
+  lineNumbers.reserve(VERIFY_CHUNK);
+
+  size_t lineNumber = 0, total = 0, valid = 0, malformed = 0;
+  float seconds = 0;
+  string line;
+
+  for (bool more = true; more; ) {
+    items.clear();
+    keys.clear();
+    lineNumbers.clear();
+    messages.clear();
+    messageItems.clear();
+    while (items.size() < VERIFY_CHUNK && (more = !!getline(log, line))) {
+      ++lineNumber;
+      if (line.empty() || line[0] == '#') continue;
+      U2F_verifyItem item;
+      shared_ptr<const U2F_key> key;
+      string message;
+      if (!parseLine(line, &item, &key, &message)) {
+        cout << "line " << lineNumber << ": malformed" << endl;
+        ++malformed;
+        continue;
+      }
+      if (!message.empty()) {
+        messages.push_back(string());
+        messages.back().swap(message);
+        messageItems.push_back(items.size());
+      }
+      items.push_back(item);
+      keys.push_back(key);
+      lineNumbers.push_back(lineNumber);
+    }
+    if (items.empty()) continue;
+
+    uint64_t t = 0; U2Fob_deltaTime(&t);
+    if (!messages.empty()) {
+      vector<const uint8_t*> data(messages.size());
+      vector<size_t> lens(messages.size());
+      for (size_t i = 0; i < messages.size(); ++i) {
+        data[i] = (const uint8_t*) messages[i].data();
+        lens[i] = messages[i].size();
+      }
+      vector<uint8_t> digests(messages.size() * U2F_SHA256_SIZE);
+      crypto->sha256Batch(&data[0], &lens[0], messages.size(), &digests[0]);
+      for (size_t i = 0; i < messages.size(); ++i) {
+        p256_from_bin(&digests[i * U2F_SHA256_SIZE],
+                      &items[messageItems[i]].h);
+      }
+    }
+    valid += U2F_verifyBatch(&items[0], items.size(), arg_Threads,
+                             arg_Combined);
+    seconds += U2Fob_deltaTime(&t);
+    total += items.size();
+
+    for (size_t i = 0; i < items.size(); ++i) {
+      if (!items[i].result) {
+        cout << "line " << lineNumbers[i] << ": \x1b[31mBAD\x1b[0m" << endl;
+      } else if (arg_Verbose) {
+        cout << "line " << lineNumbers[i] << ": ok" << endl;
+      }
+    }
+  }
+
+  cout << total << " signatures, " << valid << " valid, "
+       << total - valid << " bad, " << malformed << " malformed, "
+       << keyCache.misses() << " key decodes, " << crypto->name << " crypto";
+  if (crypto->keyTables) {
+    cout << " (" << U2F_p256Impl() << " arithmetic, "
+         << U2F_sha256Impl() << " SHA-256)";
+  }
+  if (seconds > 0) {
+    cout << " in " << fixed << setprecision(2) << seconds << "s ("
+         << setprecision(0) << total / seconds << "/s)";
+  }
+  cout << endl;
+
+  return (total != valid || malformed) ? 1 : 0;
+}
@@ -0,0 +1,43 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Fixed DER encodings in attestation certificates.
+
+#ifndef __U2F_ASN1_H_INCLUDED__
+#define __U2F_ASN1_H_INCLUDED__
+
+#include <stdint.h>
+
+// SubjectPublicKeyInfo of a P-256 key, up to the uncompressed point:
+// SEQUENCE { SEQUENCE { id-ecPublicKey, prime256v1 }, BIT STRING 0x00 ..
+static const uint8_t U2F_ASN1_P256_PUBKEY_PREFIX[] = {
+  0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x02,
+  0x01, 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x03, 0x01, 0x07, 0x03,
+  0x42, 0x00
+};
+
+// AlgorithmIdentifier ecdsa-with-SHA256.
+static const uint8_t U2F_ASN1_ECDSA_SHA256[] = {
+  0x30, 0x0A, 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x04, 0x03, 0x02
+};
+
+// TBSCertificate of the minimalist self-signed attestation certificate,
+// up to the point: v3, serial 1, ecdsa-with-SHA256, issuer and subject
+// O=U2F and CN=U2F, valid 2000 through 2099, P-256 key.
+static const uint8_t U2F_ASN1_SELF_SIGNED_TBS_PREFIX[] = {
+  0x30, 0x81, 0xB3, 0xA0, 0x03, 0x02, 0x01, 0x02, 0x02, 0x01, 0x01, 0x30,
+  0x0A, 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x04, 0x03, 0x02, 0x30,
+  0x0E, 0x31, 0x0C, 0x30, 0x0A, 0x06, 0x03, 0x55, 0x04, 0x0A, 0x0C, 0x03,
+  0x55, 0x32, 0x46, 0x30, 0x22, 0x18, 0x0F, 0x32, 0x30, 0x30, 0x30, 0x30,
+  0x31, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x5A, 0x18, 0x0F,
+  0x32, 0x30, 0x39, 0x39, 0x31, 0x32, 0x33, 0x31, 0x32, 0x33, 0x35, 0x39,
+  0x35, 0x39, 0x5A, 0x30, 0x0E, 0x31, 0x0C, 0x30, 0x0A, 0x06, 0x03, 0x55,
+  0x04, 0x03, 0x13, 0x03, 0x55, 0x32, 0x46, 0x30, 0x59, 0x30, 0x13, 0x06,
+  0x07, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x02, 0x01, 0x06, 0x08, 0x2A, 0x86,
+  0x48, 0xCE, 0x3D, 0x03, 0x01, 0x07, 0x03, 0x42, 0x00
+};
+
+#endif  // __U2F_ASN1_H_INCLUDED__
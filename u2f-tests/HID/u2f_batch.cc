@@ -0,0 +1,151 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "u2f_batch.h"
+
+// Items a thread takes from its own share at a time.
+#define BATCH_GRAIN  8
+
+// With combined checks, a thread that lately saw more than 1 bad
+// signature in BATCH_BREAK_EVEN checks the next items one at a time.
+#define BATCH_BREAK_EVEN  32
+// Items "lately" spans, roughly.
+#define BATCH_WINDOW  256
+
+namespace {
+
+// The part of the batch a thread still owns: [begin, end).
+// The owner takes from the front, thieves take half from the back.
+struct Share {
+  std::mutex lock;
+  size_t begin;
+  size_t end;
+};
+
+struct Batch {
+  U2F_verifyItem* items;
+  const U2F_crypto* crypto;
+  bool combined;
+  std::vector<Share> shares;
+  std::atomic<size_t> valid;
+
+  explicit Batch(size_t threads) : shares(threads), valid(0) {}
+};
+
+// Takes the next few items of our own share.
+bool take(Share* own, size_t* begin, size_t* end) {
+  std::lock_guard<std::mutex> hold(own->lock);
+  if (own->begin == own->end) return false;
+  *begin = own->begin;
+  *end = own->end - own->begin > BATCH_GRAIN ?
+      own->begin + BATCH_GRAIN : own->end;
+  own->begin = *end;
+  return true;
+}
+
+// Moves the back half of |victim|'s share into our empty |own| share.
+bool steal(Share* victim, Share* own) {
+  size_t begin, end;
+  {
+    std::lock_guard<std::mutex> hold(victim->lock);
+    size_t left = victim->end - victim->begin;
+    if (left == 0) return false;
+    end = victim->end;
+    begin = victim->end - (left + 1) / 2;
+    victim->end = begin;
+  }
+  std::lock_guard<std::mutex> hold(own->lock);
+  own->begin = begin;
+  own->end = end;
+  return true;
+}
+
+void work(Batch* batch, size_t self) {
+  size_t threads = batch->shares.size();
+  size_t valid = 0;
+  size_t seen = 0, bad = 0;  // lately
+
+  for (;;) {
+    size_t begin, end;
+    if (!take(&batch->shares[self], &begin, &end)) {
+      bool stolen = false;
+      for (size_t k = 1; k < threads && !stolen; ++k) {
+        stolen = steal(&batch->shares[(self + k) % threads],
+                       &batch->shares[self]);
+      }
+      if (!stolen) break;  // nothing left anywhere
+      continue;
+    }
+
+    size_t good = 0;
+    if (batch->combined && bad * BATCH_BREAK_EVEN <= seen) {
+      U2F_p256Sig sigs[BATCH_GRAIN];
+      int results[BATCH_GRAIN];
+      for (size_t i = begin; i < end; ++i) {
+        const U2F_verifyItem& item = batch->items[i];
+        U2F_p256Sig sig = { &item.x, &item.y, item.key, &item.h, &item.r,
+                            &item.s };
+        sigs[i - begin] = sig;
+      }
+      U2F_p256VerifyBatch(sigs, end - begin, results);
+      for (size_t i = begin; i < end; ++i) {
+        batch->items[i].result = results[i - begin];
+        good += results[i - begin];
+      }
+    } else {
+      for (size_t i = begin; i < end; ++i) {
+        U2F_verifyItem& item = batch->items[i];
+        const U2F_crypto* crypto = batch->crypto;
+        item.result = item.key && crypto->keyTables ?
+            U2F_p256VerifyKey(item.key, &item.h, &item.r, &item.s) :
+            crypto->verify(&item.x, &item.y, &item.h, &item.r, &item.s);
+        good += item.result;
+      }
+    }
+    valid += good;
+
+    seen += end - begin;
+    bad += end - begin - good;
+    if (seen > BATCH_WINDOW) {
+      seen /= 2;
+      bad /= 2;
+    }
+  }
+
+  batch->valid += valid;
+}
+
+}  // namespace
+
+size_t U2F_verifyBatch(U2F_verifyItem* items, size_t n, unsigned threads,
+                       bool combined) {
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+  if (threads > n) threads = n ? (unsigned) n : 1;
+
+  Batch batch(threads);
+  batch.items = items;
+  batch.crypto = U2F_cryptoBackend();
+  batch.combined = combined && batch.crypto->keyTables;
+  for (size_t t = 0; t < threads; ++t) {
+    batch.shares[t].begin = n * t / threads;
+    batch.shares[t].end = n * (t + 1) / threads;
+  }
+
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; ++t) {
+    pool.push_back(std::thread(work, &batch, t));
+  }
+  work(&batch, 0);
+  for (size_t t = 0; t < pool.size(); ++t) pool[t].join();
+
+  return batch.valid;
+}
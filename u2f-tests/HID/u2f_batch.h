@@ -0,0 +1,43 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Batch P-256 ECDSA verification on a pool of threads.
+
+#ifndef __U2F_BATCH_H_INCLUDED__
+#define __U2F_BATCH_H_INCLUDED__
+
+#include <stddef.h>
+
+#include "u2f_crypto.h"
+#include "u2f_p256.h"
+
+#include "mincrypt/p256.h"
+
+// One signature to check.
+struct U2F_verifyItem {
+  p256_int x, y;  // public key
+  const U2F_p256Key* key;  // same key precomputed, or NULL
+  p256_int h;  // digest, as from p256_from_bin
+  p256_int r, s;  // signature, as from dsa_sig_unpack
+  int result;  // out: 1 if the signature verifies, else 0
+};
+
+// Verifies |n| items with the crypto backend in use, spread over
+// |threads| threads, 0 for one per core.
+// Each thread starts on an equal share and steals from the others once
+// its own share runs out, so slow items do not leave cores idle.
+// With |combined|, and a backend that uses the u2f_p256 kernel, checks
+// the items a few at a time through U2F_p256VerifyBatch(); that is
+// faster when most signatures are good, more so for runs of items under
+// the same key. Each bad signature costs the batch it is in a few more
+// checks, so past about 1 bad signature in 32 (the break-even, for 8 at
+// a time under one key) it is slower; a thread that lately saw more
+// than that checks one at a time until the rate drops again.
+// Returns the number of valid signatures.
+size_t U2F_verifyBatch(U2F_verifyItem* items, size_t n, unsigned threads,
+                       bool combined = false);
+
+#endif  // __U2F_BATCH_H_INCLUDED__
@@ -0,0 +1,233 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __OS_WIN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <string>
+
+#include "u2f_counters.h"
+#include "u2f_sha256.h"
+
+// File layout, in native byte order: a 64 byte header (magic, slot
+// count, slots in use) and then the slots.
+#define STORE_MAGIC        "U2FCTR01"
+#define STORE_HEADER_SIZE  64
+
+namespace {
+
+struct Header {
+  char magic[8];
+  uint64_t slots;  // a power of two
+  std::atomic<uint64_t> used;
+};
+
+// One key handle. |ctr| is its last counter plus one, 0 before the
+// first; |tag| is 0 while the slot is free.
+struct Slot {
+  std::atomic<uint64_t> tag;
+  std::atomic<uint64_t> ctr;
+};
+
+static_assert(sizeof(Header) <= STORE_HEADER_SIZE, "header too big");
+static_assert(sizeof(Slot) == 16, "slots must pack");
+
+size_t fileSize(uint64_t slots) {
+  return STORE_HEADER_SIZE + slots * sizeof(Slot);
+}
+
+// Records |ctr| in |slot| if it is above the one there.
+U2F_counterResult advanceSlot(Slot* slot, uint32_t ctr, uint32_t* last) {
+  uint64_t next = (uint64_t) ctr + 1;
+  uint64_t seen = slot->ctr.load(std::memory_order_acquire);
+  do {
+    if (seen >= next) {
+      if (last) *last = (uint32_t) (seen - 1);
+      return U2F_COUNTER_REPLAYED;
+    }
+  } while (!slot->ctr.compare_exchange_weak(seen, next,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire));
+  return seen ? U2F_COUNTER_ADVANCED : U2F_COUNTER_NEW;
+}
+
+#ifdef __OS_WIN
+
+// Builds an empty store beside |path| and moves it into place, unless
+// another process did first.
+bool createFile(const char* path, const uint8_t* header, uint64_t slots) {
+  std::string tmp = std::string(path) + "." +
+                    std::to_string(GetCurrentProcessId());
+  HANDLE f = CreateFileA(tmp.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                         CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (f == INVALID_HANDLE_VALUE) return false;
+  DWORD written = 0;
+  LARGE_INTEGER end;
+  end.QuadPart = (LONGLONG) fileSize(slots);
+  bool ok = WriteFile(f, header, STORE_HEADER_SIZE, &written, NULL) &&
+            written == STORE_HEADER_SIZE &&
+            SetFilePointerEx(f, end, NULL, FILE_BEGIN) && SetEndOfFile(f);
+  CloseHandle(f);
+  ok = ok && (MoveFileExA(tmp.c_str(), path, 0) ||
+              GetLastError() == ERROR_ALREADY_EXISTS);
+  DeleteFileA(tmp.c_str());
+  return ok;
+}
+
+// Maps all of |path| shared and writable. Returns NULL if it is missing.
+void* mapFile(const char* path, size_t* size) {
+  HANDLE f = CreateFileA(path, GENERIC_READ | GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (f == INVALID_HANDLE_VALUE) return NULL;
+  LARGE_INTEGER len;
+  void* map = NULL;
+  if (GetFileSizeEx(f, &len) && len.QuadPart >= STORE_HEADER_SIZE) {
+    // The view keeps the file and mapping open.
+    HANDLE m = CreateFileMappingA(f, NULL, PAGE_READWRITE, 0, 0, NULL);
+    if (m) {
+      map = MapViewOfFile(m, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+      CloseHandle(m);
+    }
+    *size = (size_t) len.QuadPart;
+  }
+  CloseHandle(f);
+  return map;
+}
+
+void unmapFile(void* map, size_t) {
+  UnmapViewOfFile(map);
+}
+
+#else
+
+// Builds an empty store beside |path| and links it into place, unless
+// another process did first.
+bool createFile(const char* path, const uint8_t* header, uint64_t slots) {
+  std::string tmp = std::string(path) + ".XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) return false;
+  bool ok = ftruncate(fd, fileSize(slots)) == 0 &&
+            pwrite(fd, header, STORE_HEADER_SIZE, 0) == STORE_HEADER_SIZE;
+  ::close(fd);
+  ok = ok && (link(tmp.c_str(), path) == 0 || errno == EEXIST);
+  unlink(tmp.c_str());
+  return ok;
+}
+
+// Maps all of |path| shared and writable. Returns NULL if it is missing.
+void* mapFile(const char* path, size_t* size) {
+  int fd = ::open(path, O_RDWR);
+  if (fd < 0) return NULL;
+  struct stat st;
+  void* map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= STORE_HEADER_SIZE) {
+    *size = (size_t) st.st_size;
+    map = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  return map == MAP_FAILED ? NULL : map;
+}
+
+void unmapFile(void* map, size_t size) {
+  munmap(map, size);
+}
+
+#endif  // __OS_WIN
+
+}  // namespace
+
+const char* U2F_counterResultName(U2F_counterResult result) {
+  switch (result) {
+    case U2F_COUNTER_NEW: return "new";
+    case U2F_COUNTER_ADVANCED: return "advanced";
+    case U2F_COUNTER_REPLAYED: return "replayed";
+    case U2F_COUNTER_FULL: return "full";
+  }
+  return "?";
+}
+
+bool U2F_counterStore::open(const char* path, size_t capacity) {
+  close();
+  // Sharing between processes needs the atomics to be plain memory.
+  if (!std::atomic<uint64_t>().is_lock_free()) return false;
+
+  size_t size = 0;
+  void* map = mapFile(path, &size);
+  if (!map) {
+    uint64_t slots = 1;
+    while (slots < capacity) slots <<= 1;
+    uint8_t header[STORE_HEADER_SIZE] = { 0 };
+    memcpy(header, STORE_MAGIC, 8);
+    memcpy(header + 8, &slots, sizeof(slots));
+    if (!createFile(path, header, slots)) return false;
+    map = mapFile(path, &size);
+    if (!map) return false;
+  }
+  map_ = map;
+  size_ = size;
+
+  const Header* h = static_cast<const Header*>(map_);
+  if (memcmp(h->magic, STORE_MAGIC, 8) || !h->slots ||
+      (h->slots & (h->slots - 1)) || fileSize(h->slots) != size_) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void U2F_counterStore::close() {
+  if (map_) unmapFile(map_, size_);
+  map_ = NULL;
+  size_ = 0;
+}
+
+U2F_counterResult U2F_counterStore::advance(const uint8_t* kh, size_t len,
+                                            uint32_t ctr, uint32_t* last) {
+  Header* h = static_cast<Header*>(map_);
+  Slot* slots = reinterpret_cast<Slot*>(static_cast<uint8_t*>(map_) +
+                                        STORE_HEADER_SIZE);
+
+  uint8_t digest[U2F_SHA256_SIZE];
+  U2F_sha256(kh, len, digest);
+  uint64_t tag = 0;
+  for (int i = 0; i < 8; ++i) tag = (tag << 8) | digest[i];
+  if (!tag) tag = 1;  // 0 marks a free slot
+
+  uint64_t mask = h->slots - 1;
+  for (uint64_t i = 0; i <= mask; ++i) {
+    Slot* slot = &slots[(tag + i) & mask];
+    uint64_t seen = slot->tag.load(std::memory_order_acquire);
+    if (!seen) {
+      if (slot->tag.compare_exchange_strong(seen, tag,
+                                            std::memory_order_acq_rel)) {
+        h->used.fetch_add(1, std::memory_order_relaxed);
+        return advanceSlot(slot, ctr, last);
+      }
+      // Another verifier claimed it first; |seen| is now its tag.
+    }
+    if (seen == tag) return advanceSlot(slot, ctr, last);
+  }
+  return U2F_COUNTER_FULL;
+}
+
+size_t U2F_counterStore::capacity() const {
+  return (size_t) static_cast<const Header*>(map_)->slots;
+}
+
+size_t U2F_counterStore::size() const {
+  return (size_t) static_cast<const Header*>(map_)->used.load();
+}
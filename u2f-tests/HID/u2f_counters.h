@@ -0,0 +1,63 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Signature counters of many key handles in a memory-mapped file, to
+// catch cloned tokens: a clone's counter sooner or later fails to
+// advance past the one last seen.
+//
+// The file is an open-addressing hash table with linear probing, keyed
+// by the first 8 bytes of SHA-256 of the key handle. Slots are claimed
+// and counters advanced by compare-and-swap on the mapping, so any
+// number of threads and processes can share one file without a lock.
+// Slots are never freed; size the table at about twice the key handles
+// it will hold.
+
+#ifndef __U2F_COUNTERS_H_INCLUDED__
+#define __U2F_COUNTERS_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum U2F_counterResult {
+  U2F_COUNTER_NEW,       // first counter seen for the key handle
+  U2F_COUNTER_ADVANCED,  // above the last one
+  U2F_COUNTER_REPLAYED,  // not above the last one
+  U2F_COUNTER_FULL,      // new key handle, but no free slot
+};
+
+const char* U2F_counterResultName(U2F_counterResult result);
+
+class U2F_counterStore {
+ public:
+  U2F_counterStore() : map_(NULL), size_(0) {}
+  ~U2F_counterStore() { close(); }
+
+  // Maps the store in |path|, first creating it with room for
+  // |capacity| key handles, rounded up to a power of two, if there is
+  // no such file. Processes racing to create it end up sharing one.
+  // Returns false if it cannot be created or mapped, or is not a store.
+  bool open(const char* path, size_t capacity = 1 << 20);
+  void close();
+
+  bool isOpen() const { return map_ != NULL; }
+
+  // Records |ctr| for the |len| byte key handle |kh| if it is above the
+  // last one. |last| (may be NULL) gets the last one when replayed.
+  U2F_counterResult advance(const uint8_t* kh, size_t len, uint32_t ctr,
+                            uint32_t* last);
+
+  size_t capacity() const;
+  size_t size() const;  // key handles held
+
+ private:
+  U2F_counterStore(const U2F_counterStore&);
+  void operator=(const U2F_counterStore&);
+
+  void* map_;
+  size_t size_;  // of the mapping
+};
+
+#endif  // __U2F_COUNTERS_H_INCLUDED__
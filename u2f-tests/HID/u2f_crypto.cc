@@ -0,0 +1,100 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <string.h>
+
+#include <atomic>
+
+#include "u2f_crypto.h"
+#include "u2f_p256.h"
+
+#include "mincrypt/dsa_sig.h"
+#include "mincrypt/p256_ecdsa.h"
+#include "mincrypt/sha256.h"
+
+#ifndef U2F_CRYPTO_DEFAULT
+#define U2F_CRYPTO_DEFAULT  "u2f"
+#endif
+
+namespace {
+
+// Batch hashing for backends without their own.
+template <void (*hash)(const void*, size_t, uint8_t*)>
+void hashEach(const uint8_t* const* data, const size_t* len, size_t n,
+              uint8_t* digests) {
+  for (size_t i = 0; i < n; ++i) {
+    hash(data[i], len[i], digests + i * U2F_SHA256_SIZE);
+  }
+}
+
+void minSha256(const void* data, size_t len, uint8_t* digest) {
+  SHA256_hash(data, (int) len, digest);
+}
+
+bool minSigDecode(const uint8_t* der, size_t len,
+                  p256_int* r, p256_int* s) {
+  // dsa_sig_unpack() only reads the signature.
+  return dsa_sig_unpack(const_cast<uint8_t*>(der), (int) len, r, s) == 1;
+}
+
+int minVerify(const p256_int* x, const p256_int* y, const p256_int* h,
+              const p256_int* r, const p256_int* s) {
+  return p256_ecdsa_verify(x, y, h, r, s) ? 1 : 0;
+}
+
+const U2F_crypto kU2f = {
+  "u2f", U2F_sha256, U2F_sha256Batch, minSigDecode, U2F_p256Verify,
+  NULL, true
+};
+
+const U2F_crypto kMincrypt = {
+  "mincrypt", minSha256, hashEach<minSha256>, minSigDecode, minVerify,
+  NULL, false
+};
+
+std::atomic<const U2F_crypto*> active(nullptr);
+
+}  // namespace
+
+#ifdef U2F_CRYPTO_OPENSSL
+// In its own file: OpenSSL and libmincrypt both define SHA256_CTX.
+extern const U2F_crypto U2F_cryptoOpenssl;
+#endif
+
+const U2F_crypto* const U2F_cryptoBackends[] = {
+  &kMincrypt,
+  &kU2f,
+#ifdef U2F_CRYPTO_OPENSSL
+  &U2F_cryptoOpenssl,
+#endif
+  NULL
+};
+
+const U2F_crypto* U2F_cryptoFind(const char* name) {
+  for (size_t i = 0; U2F_cryptoBackends[i]; ++i) {
+    if (!strcmp(name, U2F_cryptoBackends[i]->name)) {
+      return U2F_cryptoBackends[i];
+    }
+  }
+  return NULL;
+}
+
+const U2F_crypto* U2F_cryptoBackend() {
+  const U2F_crypto* crypto = active.load(std::memory_order_acquire);
+  if (!crypto) {
+    crypto = U2F_cryptoFind(U2F_CRYPTO_DEFAULT);
+    if (!crypto) crypto = &kU2f;
+    active.store(crypto, std::memory_order_release);
+  }
+  return crypto;
+}
+
+bool U2F_cryptoUse(const char* name) {
+  const U2F_crypto* crypto = U2F_cryptoFind(name);
+  if (!crypto) return false;
+  active.store(crypto, std::memory_order_release);
+  return true;
+}
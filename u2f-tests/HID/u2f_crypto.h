@@ -0,0 +1,64 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// The crypto the tests need, behind one interface with several backends:
+//   "u2f"       u2f_sha256 and the u2f_p256 kernel
+//   "mincrypt"  plain libmincrypt
+//   "openssl"   OpenSSL or BoringSSL, in builds with U2F_CRYPTO_OPENSSL
+// The build picks the default with U2F_CRYPTO_DEFAULT ("u2f" if unset);
+// tools can switch at run time.
+
+#ifndef __U2F_CRYPTO_H_INCLUDED__
+#define __U2F_CRYPTO_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "u2f_sha256.h"
+
+#include "mincrypt/p256.h"
+
+struct U2F_crypto {
+  const char* name;
+
+  void (*sha256)(const void* data, size_t len,
+                 uint8_t digest[U2F_SHA256_SIZE]);
+
+  // Hashes |n| messages, as U2F_sha256Batch().
+  void (*sha256Batch)(const uint8_t* const* data, const size_t* len,
+                      size_t n, uint8_t* digests);
+
+  // Decodes a DER ECDSA-Sig-Value into (r, s).
+  // Returns false if it is malformed.
+  bool (*sigDecode)(const uint8_t* der, size_t len, p256_int* r, p256_int* s);
+
+  // Returns 1 if (r, s) signs digest |h| under public key (x, y), else 0.
+  int (*verify)(const p256_int* x, const p256_int* y, const p256_int* h,
+                const p256_int* r, const p256_int* s);
+
+  // Signs digest |h| with private key |d|. NULL if the backend cannot.
+  bool (*sign)(const p256_int* d, const p256_int* h,
+               p256_int* r, p256_int* s);
+
+  // Whether U2F_p256VerifyKey() on a cached key table may stand in for
+  // verify().
+  bool keyTables;
+};
+
+// The backends in this build, libmincrypt first, NULL terminated.
+extern const U2F_crypto* const U2F_cryptoBackends[];
+
+// The backend in use.
+const U2F_crypto* U2F_cryptoBackend();
+
+// Returns the named backend, or NULL if this build does not have it.
+const U2F_crypto* U2F_cryptoFind(const char* name);
+
+// Switches to the named backend.
+// Returns false if this build does not have it.
+bool U2F_cryptoUse(const char* name);
+
+#endif  // __U2F_CRYPTO_H_INCLUDED__
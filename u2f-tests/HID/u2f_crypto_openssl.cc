@@ -0,0 +1,116 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// The OpenSSL crypto backend; BoringSSL has the same calls.
+
+#define OPENSSL_SUPPRESS_DEPRECATED  // EC_KEY is all BoringSSL has
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+#include <openssl/sha.h>
+
+#include "u2f_crypto.h"
+
+namespace {
+
+BIGNUM* toBn(const p256_int* a) {
+  uint8_t b[P256_NBYTES];
+  p256_to_bin(a, b);
+  return BN_bin2bn(b, sizeof(b), NULL);
+}
+
+bool fromBn(const BIGNUM* bn, p256_int* a) {
+  uint8_t b[P256_NBYTES] = { 0 };
+  int n = BN_num_bytes(bn);
+  if (BN_is_negative(bn) || n > (int) sizeof(b)) return false;
+  BN_bn2bin(bn, b + sizeof(b) - n);
+  p256_from_bin(b, a);
+  return true;
+}
+
+void sslSha256(const void* data, size_t len, uint8_t* digest) {
+  SHA256(reinterpret_cast<const uint8_t*>(data), len, digest);
+}
+
+bool sslSigDecode(const uint8_t* der, size_t len, p256_int* r, p256_int* s) {
+  const uint8_t* p = der;
+  ECDSA_SIG* sig = d2i_ECDSA_SIG(NULL, &p, (long) len);
+  if (!sig) return false;
+  const BIGNUM *br, *bs;
+  ECDSA_SIG_get0(sig, &br, &bs);
+  bool ok = fromBn(br, r) && fromBn(bs, s);
+  ECDSA_SIG_free(sig);
+  return ok;
+}
+
+int sslVerify(const p256_int* x, const p256_int* y, const p256_int* h,
+              const p256_int* r, const p256_int* s) {
+  EC_KEY* key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  ECDSA_SIG* sig = ECDSA_SIG_new();
+  BIGNUM* bx = toBn(x);
+  BIGNUM* by = toBn(y);
+  BIGNUM* br = toBn(r);
+  BIGNUM* bs = toBn(s);
+  if (sig && br && bs && ECDSA_SIG_set0(sig, br, bs)) br = bs = NULL;
+
+  uint8_t digest[P256_NBYTES];
+  p256_to_bin(h, digest);
+  bool ok = key && sig && bx && by && !br &&
+      EC_KEY_set_public_key_affine_coordinates(key, bx, by) == 1 &&
+      ECDSA_do_verify(digest, sizeof(digest), sig, key) == 1;
+
+  BN_free(bx);
+  BN_free(by);
+  BN_free(br);
+  BN_free(bs);
+  ECDSA_SIG_free(sig);
+  EC_KEY_free(key);
+  return ok ? 1 : 0;
+}
+
+bool sslSign(const p256_int* d, const p256_int* h, p256_int* r, p256_int* s) {
+  EC_KEY* key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  EC_POINT* pub = key ? EC_POINT_new(EC_KEY_get0_group(key)) : NULL;
+  BIGNUM* bd = toBn(d);
+  ECDSA_SIG* sig = NULL;
+
+  uint8_t digest[P256_NBYTES];
+  p256_to_bin(h, digest);
+  if (pub && bd && EC_KEY_set_private_key(key, bd) == 1 &&
+      EC_POINT_mul(EC_KEY_get0_group(key), pub, bd, NULL, NULL, NULL) == 1 &&
+      EC_KEY_set_public_key(key, pub) == 1) {
+    sig = ECDSA_do_sign(digest, sizeof(digest), key);
+  }
+
+  bool ok = false;
+  if (sig) {
+    const BIGNUM *br, *bs;
+    ECDSA_SIG_get0(sig, &br, &bs);
+    ok = fromBn(br, r) && fromBn(bs, s);
+  }
+
+  ECDSA_SIG_free(sig);
+  BN_clear_free(bd);
+  EC_POINT_free(pub);
+  EC_KEY_free(key);
+  return ok;
+}
+
+void sslSha256Batch(const uint8_t* const* data, const size_t* len, size_t n,
+                    uint8_t* digests) {
+  for (size_t i = 0; i < n; ++i) {
+    SHA256(data[i], len[i], digests + i * U2F_SHA256_SIZE);
+  }
+}
+
+}  // namespace
+
+extern const U2F_crypto U2F_cryptoOpenssl;
+const U2F_crypto U2F_cryptoOpenssl = {
+  "openssl", sslSha256, sslSha256Batch, sslSigDecode, sslVerify,
+  sslSign, false
+};
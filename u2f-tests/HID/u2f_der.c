@@ -0,0 +1,124 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <string.h>
+
+#include "u2f_asn1.h"
+#include "u2f_der.h"
+
+#define DER_SEQUENCE    0x30
+#define DER_INTEGER     0x02
+#define DER_BIT_STRING  0x03
+#define DER_VERSION     0xA0  // [0] EXPLICIT, in a TBSCertificate
+
+#define POINT_SIZE  65  // uncompressed P-256 point
+
+int U2F_derRead(U2F_derSpan* in, uint8_t tag,
+                U2F_derSpan* value, U2F_derSpan* element) {
+  const uint8_t* p = in->data;
+  size_t avail = in->len;
+  size_t header = 2;
+  size_t len;
+
+  if (avail < 2 || p[0] != tag) return 0;
+
+  len = p[1];
+  if (len & 0x80) {
+    size_t n = len & 0x7F;
+    size_t i;
+    // 0x80 is the indefinite form, which DER does not allow.
+    if (n == 0 || n > 4 || avail < 2 + n) return 0;
+    len = 0;
+    for (i = 0; i < n; ++i) len = (len << 8) | p[2 + i];
+    header += n;
+  }
+  if (len > avail - header) return 0;
+
+  if (value) {
+    value->data = p + header;
+    value->len = len;
+  }
+  if (element) {
+    element->data = p;
+    element->len = header + len;
+  }
+  in->data += header + len;
+  in->len -= header + len;
+  return 1;
+}
+
+// Reads a BIT STRING holding whole bytes into |bits|.
+static int readBits(U2F_derSpan* in, U2F_derSpan* bits) {
+  U2F_derSpan value;
+  if (!U2F_derRead(in, DER_BIT_STRING, &value, NULL)) return 0;
+  if (value.len < 1 || value.data[0] != 0) return 0;
+  bits->data = value.data + 1;
+  bits->len = value.len - 1;
+  return 1;
+}
+
+int U2F_derParseCert(const uint8_t* data, size_t len, U2F_derCert* cert) {
+  U2F_derSpan in, body, tbs;
+
+  memset(cert, 0, sizeof(*cert));
+  in.data = data;
+  in.len = len;
+
+  // Certificate ::= SEQUENCE { tbsCertificate, signatureAlgorithm,
+  //                            signatureValue BIT STRING }
+  if (!U2F_derRead(&in, DER_SEQUENCE, &body, &cert->cert)) return 0;
+  if (!U2F_derRead(&body, DER_SEQUENCE, &tbs, &cert->tbs)) return 0;
+  if (!U2F_derRead(&body, DER_SEQUENCE, NULL, &cert->certAlg)) return 0;
+  if (!readBits(&body, &cert->certSig)) return 0;
+  if (body.len != 0) return 0;
+
+  // TBSCertificate ::= SEQUENCE { [0] version OPTIONAL, serialNumber,
+  //     signature, issuer, validity, subject, subjectPublicKeyInfo, ...
+  U2F_derRead(&tbs, DER_VERSION, NULL, NULL);
+  if (!U2F_derRead(&tbs, DER_INTEGER, NULL, NULL)) return 0;
+  if (!U2F_derRead(&tbs, DER_SEQUENCE, NULL, NULL)) return 0;
+  if (!U2F_derRead(&tbs, DER_SEQUENCE, NULL, &cert->issuer)) return 0;
+  if (!U2F_derRead(&tbs, DER_SEQUENCE, NULL, NULL)) return 0;
+  if (!U2F_derRead(&tbs, DER_SEQUENCE, NULL, &cert->subject)) return 0;
+  if (!U2F_derRead(&tbs, DER_SEQUENCE, NULL, &cert->spki)) return 0;
+
+  // A P-256 key has exactly one encoding, up to the point.
+  if (cert->spki.len == sizeof(U2F_ASN1_P256_PUBKEY_PREFIX) + POINT_SIZE &&
+      !memcmp(cert->spki.data, U2F_ASN1_P256_PUBKEY_PREFIX,
+              sizeof(U2F_ASN1_P256_PUBKEY_PREFIX)) &&
+      cert->spki.data[sizeof(U2F_ASN1_P256_PUBKEY_PREFIX)] == 0x04) {
+    cert->pubKey.data = cert->spki.data + sizeof(U2F_ASN1_P256_PUBKEY_PREFIX);
+    cert->pubKey.len = POINT_SIZE;
+  }
+  return 1;
+}
+
+int U2F_derParseRegister(const uint8_t* data, size_t len,
+                         size_t keyHandleLen, U2F_derRegister* parts) {
+  U2F_derSpan rest;
+  U2F_derCert cert;
+
+  memset(parts, 0, sizeof(*parts));
+  if (keyHandleLen >= len) return 0;
+  parts->keyHandle.data = data;
+  parts->keyHandle.len = keyHandleLen;
+
+  if (!U2F_derParseCert(data + keyHandleLen, len - keyHandleLen, &cert)) {
+    return 0;
+  }
+  if (!cert.pubKey.len) return 0;  // U2F attestation keys are P-256
+  parts->cert = cert.cert;
+  parts->tbs = cert.tbs;
+  parts->spki = cert.spki;
+  parts->pubKey = cert.pubKey;
+  parts->certAlg = cert.certAlg;
+  parts->certSig = cert.certSig;
+
+  // The signature comes last; the rest of the buffer is unused.
+  rest.data = cert.cert.data + cert.cert.len;
+  rest.len = len - keyHandleLen - cert.cert.len;
+  return U2F_derRead(&rest, DER_SEQUENCE, NULL, &parts->sig);
+}
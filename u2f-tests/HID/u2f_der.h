@@ -0,0 +1,78 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Bounds-checked DER walker for registration responses.
+// Nothing is copied: results are spans into the caller's buffer.
+
+#ifndef __U2F_DER_H_INCLUDED__
+#define __U2F_DER_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  const uint8_t* data;
+  size_t len;
+} U2F_derSpan;
+
+// The parts of an X.509 certificate.
+typedef struct {
+  U2F_derSpan cert;      // the whole certificate, tag and length included
+  U2F_derSpan tbs;       // its TBSCertificate, which the signature covers
+  U2F_derSpan issuer;    // issuer Name
+  U2F_derSpan subject;   // subject Name
+  U2F_derSpan spki;      // SubjectPublicKeyInfo
+  U2F_derSpan pubKey;    // the point in spki if it is a P-256 key, else empty
+  U2F_derSpan certAlg;   // signatureAlgorithm
+  U2F_derSpan certSig;   // signature, a DER ECDSA-Sig-Value when certAlg is
+                         // ecdsa-with-SHA256
+} U2F_derCert;
+
+// The parts of the key handle, certificate and signature that follow
+// the public key in a registration response.
+typedef struct {
+  U2F_derSpan keyHandle;
+  U2F_derSpan cert;      // attestation certificate, tag and length included
+  U2F_derSpan tbs;       // its TBSCertificate, which the cert signature covers
+  U2F_derSpan spki;      // its SubjectPublicKeyInfo
+  U2F_derSpan pubKey;    // the P-256 point in spki, P256_POINT_SIZE bytes
+  U2F_derSpan certAlg;   // the certificate's signatureAlgorithm
+  U2F_derSpan certSig;   // the certificate's signature, a DER ECDSA-Sig-Value
+                         // when certAlg is ecdsa-with-SHA256
+  U2F_derSpan sig;       // registration signature, DER ECDSA-Sig-Value
+} U2F_derRegister;
+
+// Reads one element with tag |tag| from the front of |in| and advances
+// |in| past it. |value| (may be NULL) gets the contents and |element|
+// (may be NULL) the whole element. Definite lengths of up to 4 bytes
+// and single byte tags only.
+// Returns 0 if the element is malformed, overruns |in| or has another
+// tag; |in| is then unchanged.
+int U2F_derRead(U2F_derSpan* in, uint8_t tag,
+                U2F_derSpan* value, U2F_derSpan* element);
+
+// Parses the certificate at the front of |len| bytes at |data|; the
+// bytes after it are ignored. The key may be of any type.
+// Returns 0 if it is malformed or overruns |len|.
+int U2F_derParseCert(const uint8_t* data, size_t len, U2F_derCert* cert);
+
+// Splits |len| bytes of key handle, certificate and signature, the
+// first |keyHandleLen| of which are the key handle. The certificate
+// must be a well formed X.509 certificate with a P-256 key; its
+// signature may use any algorithm.
+// Returns 0 if any part is malformed or out of bounds.
+int U2F_derParseRegister(const uint8_t* data, size_t len,
+                         size_t keyHandleLen, U2F_derRegister* parts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __U2F_DER_H_INCLUDED__
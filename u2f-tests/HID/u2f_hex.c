@@ -0,0 +1,242 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "u2f_hex.h"
+
+#if defined(__x86_64__) || defined(__i386__) || \
+    defined(_M_X64) || defined(_M_IX86)
+#define U2F_HEX_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET(features)
+#else
+#include <cpuid.h>
+#define TARGET(features) __attribute__((target(features)))
+#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define U2F_HEX_SSE2
+#endif
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+static
+int hexValue(char c, size_t* bad) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  ++*bad;
+  return 0;
+}
+
+#if defined(U2F_HEX_SSE2) || defined(U2F_HEX_AVX2)
+static
+size_t countBits(uint32_t x) {
+  size_t n = 0;
+  for (; x; x &= x - 1) ++n;
+  return n;
+}
+#endif
+
+#ifdef U2F_HEX_SSE2
+// Hex digits for 16 nibbles.
+static
+__m128i digits128(__m128i n) {
+  __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)),
+                                 _mm_set1_epi8('A' - '0' - 10));
+  return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letter);
+}
+
+// Values of 16 hex digits; non-digits are 0 and flagged in |*bad|.
+static
+__m128i values128(__m128i c, uint32_t* bad) {
+  __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+  __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)),
+                           _mm_set1_epi8('a'));
+  __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+  __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+  *bad = ~_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) & 0xffff;
+  return _mm_or_si128(
+      _mm_and_si128(isDigit, d),
+      _mm_and_si128(isLetter, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+// Joins digit pairs into 8 16-bit lanes, each holding one byte.
+static
+__m128i join128(__m128i v) {
+  return _mm_or_si128(
+      _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xff)), 4),
+      _mm_srli_epi16(v, 8));
+}
+#endif  // U2F_HEX_SSE2
+
+#ifdef U2F_HEX_AVX2
+// Whether the CPU and OS run AVX2, as u2f_sha256.c checks.
+static
+int detectAvx2(void) {
+  unsigned int b, c;
+#ifdef _MSC_VER
+  int r[4];
+  __cpuid(r, 0);
+  if (r[0] < 7) return 0;
+  __cpuid(r, 1);
+  c = (unsigned int) r[2];
+  if (!(c & (1 << 27)) || (_xgetbv(0) & 6) != 6) return 0;
+  __cpuidex(r, 7, 0);
+  b = (unsigned int) r[1];
+#else
+  unsigned int a, d, lo, hi;
+  if (__get_cpuid_max(0, NULL) < 7) return 0;
+  __cpuid(1, a, b, c, d);
+  if (!(c & (1 << 27))) return 0;  // OSXSAVE: ask whether ymm is saved
+  __asm__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+  if ((lo & 6) != 6) return 0;
+  __cpuid_count(7, 0, a, b, c, d);
+#endif
+  return !!(b & (1 << 5));
+}
+
+// Set once from cpuid; racing first calls store the same value.
+static volatile int avx2 = -1;
+
+static
+int haveAvx2(void) {
+  if (avx2 < 0) avx2 = detectAvx2();
+  return avx2;
+}
+
+static TARGET("avx2")
+__m256i digits256(__m256i n) {
+  __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9)),
+                                    _mm256_set1_epi8('A' - '0' - 10));
+  return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), letter);
+}
+
+static TARGET("avx2")
+__m256i values256(__m256i c, uint32_t* bad) {
+  __m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+  __m256i l = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)),
+                              _mm256_set1_epi8('a'));
+  __m256i isDigit =
+      _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+  __m256i isLetter =
+      _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+  *bad = ~(uint32_t) _mm256_movemask_epi8(_mm256_or_si256(isDigit, isLetter));
+  return _mm256_or_si256(
+      _mm256_and_si256(isDigit, d),
+      _mm256_and_si256(isLetter, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+}
+
+static TARGET("avx2")
+__m256i join256(__m256i v) {
+  return _mm256_or_si256(
+      _mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0xff)), 4),
+      _mm256_srli_epi16(v, 8));
+}
+
+// Encodes whole 32 byte blocks of |in|; returns how many bytes.
+static TARGET("avx2")
+size_t encode256(const uint8_t* p, size_t size, char* out) {
+  size_t done = 0;
+  for (; size - done >= 32; done += 32, p += 32, out += 64) {
+    __m256i b = _mm256_loadu_si256((const __m256i*) p);
+    __m256i hi = digits256(
+        _mm256_and_si256(_mm256_srli_epi16(b, 4), _mm256_set1_epi8(15)));
+    __m256i lo = digits256(_mm256_and_si256(b, _mm256_set1_epi8(15)));
+    // Unpack works within 128 bit lanes; put the lanes back in order.
+    __m256i a = _mm256_unpacklo_epi8(hi, lo);
+    __m256i c = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256((__m256i*) out, _mm256_permute2x128_si256(a, c, 0x20));
+    _mm256_storeu_si256((__m256i*) (out + 32),
+                        _mm256_permute2x128_si256(a, c, 0x31));
+  }
+  return done;
+}
+
+// Decodes whole 64 digit blocks of |in|, counting non-digits in |*bad|;
+// returns how many digits.
+static TARGET("avx2")
+size_t decode256(const char* in, size_t len, uint8_t* out, size_t* bad) {
+  size_t done = 0;
+  for (; len - done >= 64; done += 64, in += 64, out += 32) {
+    uint32_t bad0, bad1;
+    __m256i v0 = join256(values256(
+        _mm256_loadu_si256((const __m256i*) in), &bad0));
+    __m256i v1 = join256(values256(
+        _mm256_loadu_si256((const __m256i*) (in + 32)), &bad1));
+    // Pack works within 128 bit lanes; put the quadwords back in order.
+    _mm256_storeu_si256((__m256i*) out, _mm256_permute4x64_epi64(
+        _mm256_packus_epi16(v0, v1), 0xD8));
+    *bad += countBits(bad0) + countBits(bad1);
+  }
+  return done;
+}
+#endif  // U2F_HEX_AVX2
+
+void U2F_hexEncode(const void* in, size_t size, char* out) {
+  const uint8_t* p = (const uint8_t*) in;
+
+#ifdef U2F_HEX_AVX2
+  if (haveAvx2()) {
+    size_t n = encode256(p, size, out);
+    p += n;
+    size -= n;
+    out += 2 * n;
+  }
+#endif
+
+#ifdef U2F_HEX_SSE2
+  for (; size >= 16; size -= 16, p += 16, out += 32) {
+    __m128i b = _mm_loadu_si128((const __m128i*) p);
+    __m128i hi = digits128(
+        _mm_and_si128(_mm_srli_epi16(b, 4), _mm_set1_epi8(15)));
+    __m128i lo = digits128(_mm_and_si128(b, _mm_set1_epi8(15)));
+    _mm_storeu_si128((__m128i*) out, _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i*) (out + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+#endif
+
+  for (; size; --size, ++p) {
+    *out++ = hexDigits[*p >> 4];
+    *out++ = hexDigits[*p & 15];
+  }
+}
+
+size_t U2F_hexDecode(const char* in, size_t len, uint8_t* out) {
+  size_t bad = 0;
+
+#ifdef U2F_HEX_AVX2
+  if (haveAvx2()) {
+    size_t n = decode256(in, len, out, &bad);
+    in += n;
+    len -= n;
+    out += n / 2;
+  }
+#endif
+
+#ifdef U2F_HEX_SSE2
+  for (; len >= 32; len -= 32, in += 32, out += 16) {
+    uint32_t bad0, bad1;
+    __m128i v0 = join128(values128(
+        _mm_loadu_si128((const __m128i*) in), &bad0));
+    __m128i v1 = join128(values128(
+        _mm_loadu_si128((const __m128i*) (in + 16)), &bad1));
+    _mm_storeu_si128((__m128i*) out, _mm_packus_epi16(v0, v1));
+    bad += countBits(bad0) + countBits(bad1);
+  }
+#endif
+
+  for (; len >= 2; len -= 2, in += 2) {
+    int hi = hexValue(in[0], &bad);
+    *out++ = (uint8_t) (hi << 4 | hexValue(in[1], &bad));
+  }
+
+  return bad;
+}
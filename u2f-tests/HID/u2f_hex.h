@@ -0,0 +1,34 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Hex codec for logs and test vectors.
+// Vectorized with SSE2 when the compiler targets it, and with AVX2 where
+// the CPU has it.
+
+#ifndef __U2F_HEX_H_INCLUDED__
+#define __U2F_HEX_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Encodes |size| bytes at |in| as 2 * |size| upper case hex digits at
+// |out|. No terminator is written.
+void U2F_hexEncode(const void* in, size_t size, char* out);
+
+// Decodes |len| hex digits at |in| into |len| / 2 bytes at |out|;
+// a trailing odd digit is ignored. Either case is accepted.
+// Returns the number of non-hex characters seen, which decode as 0.
+size_t U2F_hexDecode(const char* in, size_t len, uint8_t* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __U2F_HEX_H_INCLUDED__
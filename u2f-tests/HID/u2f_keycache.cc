@@ -0,0 +1,68 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "u2f_keycache.h"
+#include "u2f.h"
+#include "u2f_crypto.h"
+
+std::shared_ptr<const U2F_key> U2F_keyCache::get(const uint8_t* pk) {
+  std::string id(reinterpret_cast<const char*>(pk), P256_POINT_SIZE);
+  bool tables = U2F_cryptoBackend()->keyTables;
+  {
+    std::lock_guard<std::mutex> hold(lock_);
+    std::map<std::string, std::list<Entry>::iterator>::iterator it =
+        index_.find(id);
+    // A key cached under a backend without tables is decoded again.
+    if (it != index_.end() && (it->second->key->hasTable || !tables)) {
+      ++hits_;
+      lru_.splice(lru_.begin(), lru_, it->second);
+      return it->second->key;
+    }
+    ++misses_;
+  }
+
+  if (pk[0] != UNCOMPRESSED_POINT) return std::shared_ptr<const U2F_key>();
+
+  // Build the table outside the lock; a racing miss on the same key
+  // just builds it twice.
+  std::shared_ptr<U2F_key> key(new U2F_key);
+  p256_from_bin(pk + 1, &key->x);
+  p256_from_bin(pk + 1 + P256_SCALAR_SIZE, &key->y);
+  key->hasTable = tables;
+  if (tables ? !U2F_p256KeyInit(&key->table, &key->x, &key->y) :
+               !p256_is_valid_point(&key->x, &key->y)) {
+    return std::shared_ptr<const U2F_key>();
+  }
+
+  std::lock_guard<std::mutex> hold(lock_);
+  std::map<std::string, std::list<Entry>::iterator>::iterator it =
+      index_.find(id);
+  if (it != index_.end()) {
+    if (tables && !it->second->key->hasTable) it->second->key = key;
+  } else {
+    Entry e;
+    e.pk = id;
+    e.key = key;
+    lru_.push_front(e);
+    index_[id] = lru_.begin();
+    if (lru_.size() > capacity_) {
+      index_.erase(lru_.back().pk);
+      lru_.pop_back();
+    }
+  }
+  return key;
+}
+
+int U2F_keyCache::verify(const uint8_t* pk, const p256_int* h,
+                         const p256_int* r, const p256_int* s) {
+  std::shared_ptr<const U2F_key> key = get(pk);
+  if (!key) return 0;
+  const U2F_crypto* crypto = U2F_cryptoBackend();
+  if (crypto->keyTables && key->hasTable) {
+    return U2F_p256VerifyKey(&key->table, h, r, s);
+  }
+  return crypto->verify(&key->x, &key->y, h, r, s);
+}
@@ -0,0 +1,72 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Cache of decoded, validated P-256 public keys, so that a key seen
+// again skips decoding, the on-curve check and, for crypto backends that
+// use them, building its wNAF table.
+
+#ifndef __U2F_KEYCACHE_H_INCLUDED__
+#define __U2F_KEYCACHE_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "u2f_p256.h"
+
+#include "mincrypt/p256.h"
+
+// A public key known to be on the curve.
+struct U2F_key {
+  p256_int x, y;
+  bool hasTable;
+  U2F_p256Key table;  // for U2F_p256VerifyKey(), if hasTable
+};
+
+// Least recently used keys are dropped past |capacity|.
+// Safe to share between threads.
+class U2F_keyCache {
+ public:
+  explicit U2F_keyCache(size_t capacity = 4096)
+      : capacity_(capacity), hits_(0), misses_(0) {}
+
+  // Looks up the 65 byte uncompressed point |pk|, decoding and
+  // validating it on first use, and building its table while the crypto
+  // backend in use has keyTables. The key stays valid for as long as the
+  // returned pointer is held, even once evicted.
+  // Returns NULL if |pk| is not a point on the curve.
+  std::shared_ptr<const U2F_key> get(const uint8_t* pk);
+
+  // Verifies with the key from the cache and the crypto backend in use,
+  // with the key's table where the backend allows.
+  // Returns 1 if the signature verifies, 0 if not or |pk| is invalid.
+  int verify(const uint8_t* pk, const p256_int* h,
+             const p256_int* r, const p256_int* s);
+
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+
+ private:
+  struct Entry {
+    std::string pk;
+    std::shared_ptr<const U2F_key> key;
+  };
+
+  std::mutex lock_;
+  std::list<Entry> lru_;  // most recent first
+  std::map<std::string, std::list<Entry>::iterator> index_;
+  size_t capacity_;
+  std::atomic<size_t> hits_;
+  std::atomic<size_t> misses_;
+};
+
+#endif  // __U2F_KEYCACHE_H_INCLUDED__
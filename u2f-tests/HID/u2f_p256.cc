@@ -0,0 +1,535 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <string.h>
+
+#include <atomic>
+#include <random>
+#include <vector>
+
+#include "u2f_p256.h"
+
+#include "mincrypt/p256_ecdsa.h"
+
+#if defined(__SIZEOF_INT128__) || defined(_M_X64)
+#define U2F_P256_FAST
+#endif
+
+#if defined(U2F_P256_FAST) && defined(__x86_64__) && defined(__GNUC__)
+#define U2F_P256_ADX
+#include <cpuid.h>
+#endif
+
+#if defined(_M_X64)
+#include <intrin.h>
+#endif
+
+// The generator.
+static const p256_int kGx = {{
+  0xd898c296, 0xf4a13945, 0x2deb33a0, 0x77037d81,
+  0x63a440f2, 0xf8bce6e5, 0xe12c4247, 0x6b17d1f2 }};
+static const p256_int kGy = {{
+  0x37bf51f5, 0xcbb64068, 0x6b315ece, 0x2bce3357,
+  0x7c0f9e16, 0x8ee7eb4a, 0xfe1a7f9b, 0x4fe342e2 }};
+
+#ifdef U2F_P256_FAST
+
+namespace {
+
+// Modulus limbs, least significant first, then -m^-1 mod 2^64.
+#define FIELD_P  0xffffffffffffffffULL, 0x00000000ffffffffULL, \
+                 0x0000000000000000ULL, 0xffffffff00000001ULL, 1ULL
+#define ORDER_N  0xf3b9cac2fc632551ULL, 0xbce6faada7179e84ULL, \
+                 0xffffffffffffffffULL, 0xffffffff00000000ULL, \
+                 0xccd1c8aaee00bc4fULL
+
+// wNAF windows: G from a 2^(9-2) point table built once, one-shot keys
+// from a small table built per call.
+#define G_WINDOW  9
+#define Q_WINDOW  5
+
+const uint64_t kP[4] = {
+  0xffffffffffffffffULL, 0x00000000ffffffffULL,
+  0x0000000000000000ULL, 0xffffffff00000001ULL };
+const uint64_t kN[4] = {
+  0xf3b9cac2fc632551ULL, 0xbce6faada7179e84ULL,
+  0xffffffffffffffffULL, 0xffffffff00000000ULL };
+const uint64_t kPminus2[4] = {
+  0xfffffffffffffffdULL, 0x00000000ffffffffULL,
+  0x0000000000000000ULL, 0xffffffff00000001ULL };
+const uint64_t kNminus2[4] = {
+  0xf3b9cac2fc63254fULL, 0xbce6faada7179e84ULL,
+  0xffffffffffffffffULL, 0xffffffff00000000ULL };
+// (p + 1) / 4, for square roots mod p.
+const uint64_t kPplus1over4[4] = {
+  0x0000000000000000ULL, 0x0000000040000000ULL,
+  0x4000000000000000ULL, 0x3fffffffc0000000ULL };
+const uint64_t kPminusN[4] = {
+  0x0c46353d039cdaaeULL, 0x4319055358e8617bULL, 0, 0 };
+
+// 2^512 mod p and mod n, to enter Montgomery form.
+const uint64_t kRRP[4] = {
+  0x0000000000000003ULL, 0xfffffffbffffffffULL,
+  0xfffffffffffffffeULL, 0x00000004fffffffdULL };
+const uint64_t kRRN[4] = {
+  0x83244c95be79eea2ULL, 0x4699799c49bd6fa6ULL,
+  0x2845b2392b6bec59ULL, 0x66e12d94f3d95620ULL };
+
+// 1 and b in Montgomery form, and plain 1 to leave it.
+const uint64_t kOneP[4] = {
+  0x0000000000000001ULL, 0xffffffff00000000ULL,
+  0xffffffffffffffffULL, 0x00000000fffffffeULL };
+const uint64_t kBMont[4] = {
+  0xd89cdf6229c4bddfULL, 0xacf005cd78843090ULL,
+  0xe5a220abf7212ed6ULL, 0xdc30061d04874834ULL };
+const uint64_t kOneInt[4] = { 1, 0, 0, 0 };
+const uint64_t kZero[4] = { 0, 0, 0, 0 };
+
+struct Affine {
+  uint64_t x[4], y[4];
+};
+
+// One signature of a combined check, under the key table |q|.
+struct BatchItem {
+  const Affine* q;
+  int qWindow;
+  const p256_int* h;
+  const p256_int* r;
+  const p256_int* s;
+};
+
+// Returns the low half of a * b + c + d, the high half in |hi|.
+inline uint64_t mulAdd(uint64_t a, uint64_t b, uint64_t c, uint64_t d,
+                       uint64_t* hi) {
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 t = (unsigned __int128) a * b + c + d;
+  *hi = (uint64_t) (t >> 64);
+  return (uint64_t) t;
+#else
+  unsigned __int64 h, l = _umul128(a, b, &h);
+  h += _addcarry_u64(0, l, c, &l);
+  h += _addcarry_u64(0, l, d, &l);
+  *hi = h;
+  return l;
+#endif
+}
+
+// Returns a + b + *carry, the carry out in |carry|.
+inline uint64_t addCarry(uint64_t a, uint64_t b, uint64_t* carry) {
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 t = (unsigned __int128) a + b + *carry;
+  *carry = (uint64_t) (t >> 64);
+  return (uint64_t) t;
+#else
+  unsigned __int64 r;
+  *carry = _addcarry_u64((unsigned char) *carry, a, b, &r);
+  return r;
+#endif
+}
+
+// Returns a - b - *borrow, the borrow out in |borrow|.
+inline uint64_t subBorrow(uint64_t a, uint64_t b, uint64_t* borrow) {
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 t = (unsigned __int128) a - b - *borrow;
+  *borrow = (uint64_t) (t >> 64) & 1;
+  return (uint64_t) t;
+#else
+  unsigned __int64 r;
+  *borrow = _subborrow_u64((unsigned char) *borrow, a, b, &r);
+  return r;
+#endif
+}
+
+inline bool isZero(const uint64_t a[4]) {
+  return !(a[0] | a[1] | a[2] | a[3]);
+}
+
+inline bool equal(const uint64_t a[4], const uint64_t b[4]) {
+  return !((a[0] ^ b[0]) | (a[1] ^ b[1]) | (a[2] ^ b[2]) | (a[3] ^ b[3]));
+}
+
+// a < b as plain integers.
+inline bool less(const uint64_t a[4], const uint64_t b[4]) {
+  uint64_t bw = 0;
+  for (int i = 0; i < 4; ++i) subBorrow(a[i], b[i], &bw);
+  return bw != 0;
+}
+
+inline void add(uint64_t r[4], const uint64_t a[4], const uint64_t b[4]) {
+  uint64_t c = 0;
+  for (int i = 0; i < 4; ++i) r[i] = addCarry(a[i], b[i], &c);
+}
+
+inline void sub(uint64_t r[4], const uint64_t a[4], const uint64_t b[4]) {
+  uint64_t bw = 0;
+  for (int i = 0; i < 4; ++i) r[i] = subBorrow(a[i], b[i], &bw);
+}
+
+void fromInt(uint64_t r[4], const p256_int* a) {
+  for (int i = 0; i < 4; ++i) {
+    r[i] = P256_DIGIT(a, 2 * i) | (uint64_t) P256_DIGIT(a, 2 * i + 1) << 32;
+  }
+}
+
+void toInt(p256_int* r, const uint64_t a[4]) {
+  for (int i = 0; i < 4; ++i) {
+    P256_DIGIT(r, 2 * i) = (p256_digit) a[i];
+    P256_DIGIT(r, 2 * i + 1) = (p256_digit) (a[i] >> 32);
+  }
+}
+
+// Width |w| NAF of |k|, least significant digit first: odd digits under
+// 2^(w-1) in magnitude, at least w-1 zeros between them.
+// Returns the number of digits, at most 257.
+int toWnaf(int16_t* out, const uint64_t k[4], int w) {
+  uint64_t d[5] = { k[0], k[1], k[2], k[3], 0 };
+  int len = 0;
+
+  while (d[0] | d[1] | d[2] | d[3] | d[4]) {
+    int digit = 0;
+    if (d[0] & 1) {
+      digit = (int) (d[0] & ((1u << w) - 1));
+      if (digit >= 1 << (w - 1)) digit -= 1 << w;
+
+      // d -= digit
+      uint64_t c = 0;
+      if (digit > 0) {
+        d[0] = subBorrow(d[0], (uint64_t) digit, &c);
+        for (int i = 1; i < 5; ++i) d[i] = subBorrow(d[i], 0, &c);
+      } else {
+        d[0] = addCarry(d[0], (uint64_t) -digit, &c);
+        for (int i = 1; i < 5; ++i) d[i] = addCarry(d[i], 0, &c);
+      }
+    }
+    out[len++] = (int16_t) digit;
+
+    for (int i = 0; i < 4; ++i) d[i] = (d[i] >> 1) | (d[i + 1] << 63);
+    d[4] >>= 1;
+  }
+  return len;
+}
+
+#ifdef U2F_P256_ADX
+// t = a * b in 8 limbs, with mulx and two carry chains, adcx for the low
+// halves and adox for the high halves of each row.
+#define MULX_ROW(off, a0, a1, a2, a3, top) \
+  "movq " #off "(%[b]), %%rdx\n\t" \
+  "xorl %%" top "d, %%" top "d\n\t" \
+  "mulxq 0(%[a]), %%rax, %%rcx\n\t" \
+  "adcxq %%rax, %%" a0 "\n\t" \
+  "adoxq %%rcx, %%" a1 "\n\t" \
+  "mulxq 8(%[a]), %%rax, %%rcx\n\t" \
+  "adcxq %%rax, %%" a1 "\n\t" \
+  "adoxq %%rcx, %%" a2 "\n\t" \
+  "mulxq 16(%[a]), %%rax, %%rcx\n\t" \
+  "adcxq %%rax, %%" a2 "\n\t" \
+  "adoxq %%rcx, %%" a3 "\n\t" \
+  "mulxq 24(%[a]), %%rax, %%rcx\n\t" \
+  "adcxq %%rax, %%" a3 "\n\t" \
+  "adoxq %%rcx, %%" top "\n\t" \
+  "movl $0, %%eax\n\t" \
+  "adcxq %%rax, %%" top "\n\t" \
+  "movq %%" a0 ", " #off "(%[t])\n\t"
+
+inline void mulx512(uint64_t t[8], const uint64_t a[4], const uint64_t b[4]) {
+  __asm__(
+      "movq 0(%[b]), %%rdx\n\t"
+      "mulxq 0(%[a]), %%r8, %%r9\n\t"
+      "mulxq 8(%[a]), %%rax, %%r10\n\t"
+      "addq %%rax, %%r9\n\t"
+      "mulxq 16(%[a]), %%rax, %%r11\n\t"
+      "adcq %%rax, %%r10\n\t"
+      "mulxq 24(%[a]), %%rax, %%r12\n\t"
+      "adcq %%rax, %%r11\n\t"
+      "adcq $0, %%r12\n\t"
+      "movq %%r8, 0(%[t])\n\t"
+      MULX_ROW(8, "r9", "r10", "r11", "r12", "r13")
+      MULX_ROW(16, "r10", "r11", "r12", "r13", "r14")
+      MULX_ROW(24, "r11", "r12", "r13", "r14", "r15")
+      "movq %%r12, 32(%[t])\n\t"
+      "movq %%r13, 40(%[t])\n\t"
+      "movq %%r14, 48(%[t])\n\t"
+      "movq %%r15, 56(%[t])\n\t"
+      :
+      : [a] "r" (a), [b] "r" (b), [t] "r" (t)
+      : "rax", "rcx", "rdx", "r8", "r9", "r10", "r11", "r12", "r13", "r14",
+        "r15", "cc", "memory");
+}
+#endif  // U2F_P256_ADX
+
+namespace generic {
+#include "u2f_p256_impl.h"
+}  // namespace generic
+
+#ifdef U2F_P256_ADX
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("bmi2,adx"))), \
+                             apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("bmi2,adx")
+#endif
+namespace adx {
+#define U2F_P256_MULX
+#include "u2f_p256_impl.h"
+#undef U2F_P256_MULX
+}  // namespace adx
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif  // U2F_P256_ADX
+
+// One set of field code.
+struct Impl {
+  const char* name;
+  bool (*toPoint)(Affine* out, const p256_int* x, const p256_int* y);
+  void (*makeTable)(Affine* out, int count, const Affine* p);
+  int (*verify)(const Affine* g, const Affine* q, int qWindow,
+                const p256_int* h, const p256_int* r, const p256_int* s);
+  bool (*pointsMul)(const Affine* g, const p256_int* u1, const p256_int* u2,
+                    const Affine* q, int qWindow,
+                    p256_int* out_x, p256_int* out_y);
+  bool (*verifyCombined)(const Affine* g, const BatchItem* items, int count,
+                         const uint64_t* z);
+};
+
+const Impl kGeneric = {
+  "64-bit", generic::toPoint, generic::makeTable, generic::verify,
+  generic::pointsMul, generic::verifyCombined
+};
+
+#ifdef U2F_P256_ADX
+const Impl kAdx = {
+  "mulx/adx", adx::toPoint, adx::makeTable, adx::verify, adx::pointsMul,
+  adx::verifyCombined
+};
+
+bool cpuHasAdx() {
+  unsigned a, b, c, d;
+  if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) return false;
+  return (b & (1u << 8)) && (b & (1u << 19));  // bmi2, adx
+}
+#endif
+
+// Squaring and reduction are the same C in both, so mulx/adx has not
+// measured faster; it only runs when asked for by U2F_p256Use().
+std::atomic<const Impl*> active(&kGeneric);
+
+const Impl* current() {
+  return active.load();
+}
+
+// Odd multiples of G.
+struct GTable {
+  Affine points[1 << (G_WINDOW - 2)];
+
+  GTable() {
+    Affine g;
+    current()->toPoint(&g, &kGx, &kGy);
+    current()->makeTable(points, 1 << (G_WINDOW - 2), &g);
+  }
+};
+
+// Built on first use; static initialization is thread safe.
+const Affine* gTable() {
+  static const GTable table;
+  return table.points;
+}
+
+// Checks items[idx[0 .. count)] together, halving batches that fail.
+void verifySplit(const Impl* impl, const BatchItem* items, const int* idx,
+                 int count, const uint64_t* z, int* results) {
+  if (count == 1) {
+    const BatchItem& item = items[idx[0]];
+    results[idx[0]] = impl->verify(gTable(), item.q, item.qWindow,
+                                   item.h, item.r, item.s);
+    return;
+  }
+
+  BatchItem part[U2F_P256_BATCH_MAX];
+  uint64_t zs[U2F_P256_BATCH_MAX];
+  for (int i = 0; i < count; ++i) {
+    part[i] = items[idx[i]];
+    zs[i] = z[idx[i]];
+  }
+  if (impl->verifyCombined(gTable(), part, count, zs)) {
+    for (int i = 0; i < count; ++i) results[idx[i]] = 1;
+    return;
+  }
+  verifySplit(impl, items, idx, count / 2, z, results);
+  verifySplit(impl, items, idx + count / 2, count - count / 2, z, results);
+}
+
+// Random 64-bit multipliers, odd so that none is 0. They must not be
+// predictable from the signatures, or bad ones could cancel out.
+void randomize(uint64_t* z, int count) {
+  static thread_local std::mt19937_64 rng(
+      ((uint64_t) std::random_device()() << 32) ^ std::random_device()());
+  for (int i = 0; i < count; ++i) z[i] = rng() | 1;
+}
+
+}  // namespace
+
+bool U2F_p256KeyInit(U2F_p256Key* key, const p256_int* x, const p256_int* y) {
+  Affine p;
+  if (!current()->toPoint(&p, x, y)) return false;
+  current()->makeTable(reinterpret_cast<Affine*>(key->table),
+                       1 << (U2F_P256_KEY_WINDOW - 2), &p);
+  return true;
+}
+
+int U2F_p256Verify(const p256_int* x, const p256_int* y, const p256_int* h,
+                   const p256_int* r, const p256_int* s) {
+  const Impl* impl = current();
+  Affine p, q[1 << (Q_WINDOW - 2)];
+  if (!impl->toPoint(&p, x, y)) return 0;
+  impl->makeTable(q, 1 << (Q_WINDOW - 2), &p);
+  return impl->verify(gTable(), q, Q_WINDOW, h, r, s);
+}
+
+int U2F_p256VerifyKey(const U2F_p256Key* key, const p256_int* h,
+                      const p256_int* r, const p256_int* s) {
+  return current()->verify(gTable(),
+                           reinterpret_cast<const Affine*>(key->table),
+                           U2F_P256_KEY_WINDOW, h, r, s);
+}
+
+void U2F_p256VerifyBatch(const U2F_p256Sig* sigs, size_t n, int* results) {
+  const Impl* impl = current();
+  for (size_t base = 0; base < n; base += U2F_P256_BATCH_MAX) {
+    int count = n - base < U2F_P256_BATCH_MAX ?
+        (int) (n - base) : U2F_P256_BATCH_MAX;
+    const U2F_p256Sig* sig = sigs + base;
+
+    // Tables for keys that come without one, one per distinct key.
+    Affine tables[U2F_P256_BATCH_MAX][1 << (Q_WINDOW - 2)];
+    int built[U2F_P256_BATCH_MAX], tableCount = 0;
+    BatchItem items[U2F_P256_BATCH_MAX];
+    int idx[U2F_P256_BATCH_MAX], live = 0;
+    for (int i = 0; i < count; ++i) {
+      BatchItem& item = items[i];
+      item.h = sig[i].h;
+      item.r = sig[i].r;
+      item.s = sig[i].s;
+      if (sig[i].key) {
+        item.q = reinterpret_cast<const Affine*>(sig[i].key->table);
+        item.qWindow = U2F_P256_KEY_WINDOW;
+      } else {
+        int k = 0;
+        while (k < tableCount &&
+               (memcmp(sig[built[k]].x, sig[i].x, sizeof(p256_int)) ||
+                memcmp(sig[built[k]].y, sig[i].y, sizeof(p256_int)))) {
+          ++k;
+        }
+        if (k == tableCount) {
+          Affine p;
+          if (!impl->toPoint(&p, sig[i].x, sig[i].y)) {
+            results[base + i] = 0;
+            continue;
+          }
+          impl->makeTable(tables[k], 1 << (Q_WINDOW - 2), &p);
+          built[tableCount++] = i;
+        }
+        item.q = tables[k];
+        item.qWindow = Q_WINDOW;
+      }
+      idx[live++] = i;
+    }
+    if (!live) continue;
+
+    uint64_t z[U2F_P256_BATCH_MAX];
+    randomize(z, count);
+    verifySplit(impl, items, idx, live, z, results + base);
+  }
+}
+
+bool U2F_p256PointsMul(const p256_int* u1, const p256_int* u2,
+                       const p256_int* x, const p256_int* y,
+                       p256_int* out_x, p256_int* out_y) {
+  const Impl* impl = current();
+  Affine p, q[1 << (Q_WINDOW - 2)];
+  if (!impl->toPoint(&p, x ? x : &kGx, y ? y : &kGy)) return false;
+  impl->makeTable(q, 1 << (Q_WINDOW - 2), &p);
+  return impl->pointsMul(gTable(), u1, u2, q, Q_WINDOW, out_x, out_y);
+}
+
+const char* U2F_p256Impl() {
+  return current()->name;
+}
+
+bool U2F_p256Use(const char* impl) {
+  if (!strcmp(impl, kGeneric.name)) {
+    active.store(&kGeneric);
+    return true;
+  }
+#ifdef U2F_P256_ADX
+  if (!strcmp(impl, kAdx.name) && cpuHasAdx()) {
+    active.store(&kAdx);
+    return true;
+  }
+#endif
+  return false;
+}
+
+#else  // U2F_P256_FAST
+
+// No 64-bit multiply: hand everything to libmincrypt.
+
+extern "C" void p256_points_mul_vartime(
+    const p256_int* n1, const p256_int* n2,
+    const p256_int* in_x, const p256_int* in_y,
+    p256_int* out_x, p256_int* out_y);
+
+bool U2F_p256KeyInit(U2F_p256Key* key, const p256_int* x, const p256_int* y) {
+  if (!p256_is_valid_point(x, y)) return false;
+  memcpy(key->table[0], x, sizeof(*x));
+  memcpy(key->table[0] + 4, y, sizeof(*y));
+  return true;
+}
+
+int U2F_p256Verify(const p256_int* x, const p256_int* y, const p256_int* h,
+                   const p256_int* r, const p256_int* s) {
+  return p256_ecdsa_verify(x, y, h, r, s) ? 1 : 0;
+}
+
+int U2F_p256VerifyKey(const U2F_p256Key* key, const p256_int* h,
+                      const p256_int* r, const p256_int* s) {
+  return U2F_p256Verify((const p256_int*) key->table[0],
+                        (const p256_int*) (key->table[0] + 4), h, r, s);
+}
+
+void U2F_p256VerifyBatch(const U2F_p256Sig* sigs, size_t n, int* results) {
+  for (size_t i = 0; i < n; ++i) {
+    results[i] = sigs[i].key ?
+        U2F_p256VerifyKey(sigs[i].key, sigs[i].h, sigs[i].r, sigs[i].s) :
+        U2F_p256Verify(sigs[i].x, sigs[i].y, sigs[i].h, sigs[i].r,
+                       sigs[i].s);
+  }
+}
+
+bool U2F_p256PointsMul(const p256_int* u1, const p256_int* u2,
+                       const p256_int* x, const p256_int* y,
+                       p256_int* out_x, p256_int* out_y) {
+  if (!x || !y) {
+    x = &kGx;
+    y = &kGy;
+  }
+  if (!p256_is_valid_point(x, y)) return false;
+  p256_points_mul_vartime(u1, u2, x, y, out_x, out_y);
+  return true;
+}
+
+const char* U2F_p256Impl() {
+  return "mincrypt";
+}
+
+bool U2F_p256Use(const char* impl) {
+  return !strcmp(impl, "mincrypt");
+}
+
+#endif  // U2F_P256_FAST
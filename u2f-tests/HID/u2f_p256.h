@@ -0,0 +1,84 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Fast variable time P-256 ECDSA verification.
+//
+// Computes u1*G + u2*Q in one pass over interleaved wNAF digits, with a
+// large table of odd multiples of G built on first use, in a 64-bit
+// Montgomery field: plain 64-bit code by default, or mulx/adx code for
+// the 4x4 limb multiply on CPUs that have it, through U2F_p256Use().
+// Builds without a 64x64->128 bit multiply fall back to libmincrypt.
+//
+// Only ever feed it public data; none of it is constant time.
+
+#ifndef __U2F_P256_H_INCLUDED__
+#define __U2F_P256_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mincrypt/p256.h"
+
+// wNAF window for precomputed keys; the table holds 2^(w-2) points.
+#define U2F_P256_KEY_WINDOW  7
+
+// Signatures checked together by U2F_p256VerifyBatch().
+#define U2F_P256_BATCH_MAX  8
+
+// A public key with its odd multiples P, 3P, 5P, .. precomputed, for
+// keys that verify many signatures.
+struct U2F_p256Key {
+  uint64_t table[1 << (U2F_P256_KEY_WINDOW - 2)][8];  // affine x, y
+};
+
+// Checks that (x, y) is on the curve and fills in |key|.
+// Returns false if it is not.
+bool U2F_p256KeyInit(U2F_p256Key* key, const p256_int* x, const p256_int* y);
+
+// Drop-in for p256_ecdsa_verify().
+// Returns 1 if (r, s) signs digest |h| under (x, y), else 0.
+int U2F_p256Verify(const p256_int* x, const p256_int* y, const p256_int* h,
+                   const p256_int* r, const p256_int* s);
+
+// U2F_p256Verify() for a precomputed key.
+int U2F_p256VerifyKey(const U2F_p256Key* key, const p256_int* h,
+                      const p256_int* r, const p256_int* s);
+
+// One signature for U2F_p256VerifyBatch(): under |key| if not NULL,
+// else under (x, y).
+struct U2F_p256Sig {
+  const p256_int* x;
+  const p256_int* y;
+  const U2F_p256Key* key;
+  const p256_int* h;
+  const p256_int* r;
+  const p256_int* s;
+};
+
+// Verifies |n| signatures, setting results[i] as U2F_p256Verify() would.
+// Up to U2F_P256_BATCH_MAX at a time are checked as one random linear
+// combination, with the R points recovered from r and one long
+// multiplication for all of them; a batch that fails is split in half
+// until the bad signatures are found. Pays off when most signatures are
+// good and keys repeat.
+void U2F_p256VerifyBatch(const U2F_p256Sig* sigs, size_t n, int* results);
+
+// (out_x, out_y) = u1*G + u2*(x, y), for tools that need raw points;
+// (x, y) may be NULL for G itself.
+// Returns false if (x, y) is not on the curve or the result is the point
+// at infinity.
+bool U2F_p256PointsMul(const p256_int* u1, const p256_int* u2,
+                       const p256_int* x, const p256_int* y,
+                       p256_int* out_x, p256_int* out_y);
+
+// Name of the field code in use: "mulx/adx", "64-bit" or "mincrypt".
+const char* U2F_p256Impl();
+
+// Switches to the named field code, for benchmarks; "64-bit" until then.
+// Returns false if this CPU or build does not have it.
+bool U2F_p256Use(const char* impl);
+
+#endif  // __U2F_P256_H_INCLUDED__
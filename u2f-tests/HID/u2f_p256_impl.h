@@ -0,0 +1,651 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Field, scalar and point arithmetic of u2f_p256.cc, which includes this
+// file once per instruction set it picks between at run time.
+// Deliberately without include guard.
+//
+// Field elements are 4 64-bit limbs, least significant first, kept in
+// Montgomery form (times 2^256) and fully reduced.
+
+typedef uint64_t Fe[4];
+
+// r = |borrow| ? t : s, without a branch; the sign of a subtraction is
+// as good as random and mispredicts half the time.
+inline void select(Fe r, uint64_t borrow,
+                   uint64_t t0, uint64_t t1, uint64_t t2, uint64_t t3,
+                   uint64_t s0, uint64_t s1, uint64_t s2, uint64_t s3) {
+  uint64_t mask = 0 - borrow;
+  r[0] = s0 ^ ((s0 ^ t0) & mask);
+  r[1] = s1 ^ ((s1 ^ t1) & mask);
+  r[2] = s2 ^ ((s2 ^ t2) & mask);
+  r[3] = s3 ^ ((s3 ^ t3) & mask);
+}
+
+// r = a * b / 2^256 mod m, for a, b < m.
+template <uint64_t M0, uint64_t M1, uint64_t M2, uint64_t M3, uint64_t K0>
+inline void montMul(Fe r, const Fe a, const Fe b) {
+  uint64_t t0 = 0, t1 = 0, t2 = 0, t3 = 0, t4 = 0, t5, c, q;
+
+  for (int i = 0; i < 4; ++i) {
+    // t += a * b[i]
+    t0 = mulAdd(a[0], b[i], t0, 0, &c);
+    t1 = mulAdd(a[1], b[i], t1, c, &c);
+    t2 = mulAdd(a[2], b[i], t2, c, &c);
+    t3 = mulAdd(a[3], b[i], t3, c, &c);
+    t5 = 0;
+    t4 = addCarry(t4, c, &t5);
+
+    // t = (t + q * m) / 2^64, q chosen to clear the low limb
+    q = t0 * K0;
+    mulAdd(q, M0, t0, 0, &c);
+    t0 = mulAdd(q, M1, t1, c, &c);
+    t1 = mulAdd(q, M2, t2, c, &c);
+    t2 = mulAdd(q, M3, t3, c, &c);
+    uint64_t cy = 0;
+    t3 = addCarry(t4, c, &cy);
+    t4 = t5 + cy;
+  }
+
+  // t < 2m; subtract m once if needed
+  uint64_t bw = 0;
+  uint64_t s0 = subBorrow(t0, M0, &bw);
+  uint64_t s1 = subBorrow(t1, M1, &bw);
+  uint64_t s2 = subBorrow(t2, M2, &bw);
+  uint64_t s3 = subBorrow(t3, M3, &bw);
+  subBorrow(t4, 0, &bw);
+  select(r, bw, t0, t1, t2, t3, s0, s1, s2, s3);
+}
+
+// r = a + b mod m
+template <uint64_t M0, uint64_t M1, uint64_t M2, uint64_t M3, uint64_t K0>
+inline void modAdd(Fe r, const Fe a, const Fe b) {
+  uint64_t c = 0, bw = 0;
+  uint64_t t0 = addCarry(a[0], b[0], &c);
+  uint64_t t1 = addCarry(a[1], b[1], &c);
+  uint64_t t2 = addCarry(a[2], b[2], &c);
+  uint64_t t3 = addCarry(a[3], b[3], &c);
+  uint64_t s0 = subBorrow(t0, M0, &bw);
+  uint64_t s1 = subBorrow(t1, M1, &bw);
+  uint64_t s2 = subBorrow(t2, M2, &bw);
+  uint64_t s3 = subBorrow(t3, M3, &bw);
+  subBorrow(c, 0, &bw);
+  select(r, bw, t0, t1, t2, t3, s0, s1, s2, s3);
+}
+
+// r = a - b mod m
+template <uint64_t M0, uint64_t M1, uint64_t M2, uint64_t M3, uint64_t K0>
+inline void modSub(Fe r, const Fe a, const Fe b) {
+  uint64_t bw = 0;
+  r[0] = subBorrow(a[0], b[0], &bw);
+  r[1] = subBorrow(a[1], b[1], &bw);
+  r[2] = subBorrow(a[2], b[2], &bw);
+  r[3] = subBorrow(a[3], b[3], &bw);
+  uint64_t mask = 0 - bw, c = 0;
+  r[0] = addCarry(r[0], M0 & mask, &c);
+  r[1] = addCarry(r[1], M1 & mask, &c);
+  r[2] = addCarry(r[2], M2 & mask, &c);
+  r[3] = addCarry(r[3], M3 & mask, &c);
+}
+
+// r = a^e in the Montgomery domain of m, 4 bits at a time.
+// The top nibble of |e| must not be zero.
+template <uint64_t M0, uint64_t M1, uint64_t M2, uint64_t M3, uint64_t K0>
+void montPow(Fe r, const Fe a, const uint64_t e[4]) {
+  Fe tab[16];
+  memcpy(tab[1], a, sizeof(Fe));
+  for (int i = 2; i < 16; ++i) {
+    montMul<M0, M1, M2, M3, K0>(tab[i], tab[i - 1], a);
+  }
+
+  Fe acc;
+  memcpy(acc, tab[e[3] >> 60], sizeof(Fe));
+  for (int bit = 248; bit >= 0; bit -= 4) {
+    int nibble = (int) ((e[bit / 64] >> (bit % 64)) & 15);
+    for (int k = 0; k < 4; ++k) montMul<M0, M1, M2, M3, K0>(acc, acc, acc);
+    if (nibble) montMul<M0, M1, M2, M3, K0>(acc, acc, tab[nibble]);
+  }
+  memcpy(r, acc, sizeof(Fe));
+}
+
+// r = t / 2^256 mod p, for t < p 2^256 in 8 limbs.
+// p = 2^256 - 2^224 + 2^192 + 2^96 - 1, so -p^-1 mod 2^64 is 1 and all
+// but the top limb of q p are shifts of q.
+inline void feReduce(Fe r, const uint64_t t[8]) {
+  uint64_t w0 = t[0], w1 = t[1], w2 = t[2], w3 = t[3], c, hi, lo;
+
+  for (int i = 0; i < 4; ++i) {
+    // w = (w + q p) / 2^64, q = w0
+    uint64_t q = w0;
+    c = 0;
+    w0 = addCarry(w1, q << 32, &c);
+    w1 = addCarry(w2, q >> 32, &c);
+    lo = mulAdd(q, 0xffffffff00000001ULL, 0, 0, &hi);
+    w2 = addCarry(w3, lo, &c);
+    w3 = hi + c;
+  }
+
+  // add the high half; the sum is below 2p
+  c = 0;
+  w0 = addCarry(w0, t[4], &c);
+  w1 = addCarry(w1, t[5], &c);
+  w2 = addCarry(w2, t[6], &c);
+  w3 = addCarry(w3, t[7], &c);
+  uint64_t bw = 0;
+  uint64_t s0 = subBorrow(w0, kP[0], &bw);
+  uint64_t s1 = subBorrow(w1, kP[1], &bw);
+  uint64_t s2 = subBorrow(w2, kP[2], &bw);
+  uint64_t s3 = subBorrow(w3, kP[3], &bw);
+  subBorrow(c, 0, &bw);
+  select(r, bw, w0, w1, w2, w3, s0, s1, s2, s3);
+}
+
+inline void feMul(Fe r, const Fe a, const Fe b) {
+  uint64_t t[8];
+#ifdef U2F_P256_MULX
+  mulx512(t, a, b);
+#else
+  uint64_t c;
+  t[0] = mulAdd(a[0], b[0], 0, 0, &c);
+  t[1] = mulAdd(a[1], b[0], c, 0, &c);
+  t[2] = mulAdd(a[2], b[0], c, 0, &c);
+  t[3] = mulAdd(a[3], b[0], c, 0, &t[4]);
+  for (int i = 1; i < 4; ++i) {
+    t[i] = mulAdd(a[0], b[i], t[i], 0, &c);
+    t[i + 1] = mulAdd(a[1], b[i], t[i + 1], c, &c);
+    t[i + 2] = mulAdd(a[2], b[i], t[i + 2], c, &c);
+    t[i + 3] = mulAdd(a[3], b[i], t[i + 3], c, &t[i + 4]);
+  }
+#endif
+  feReduce(r, t);
+}
+
+// 10 multiplies instead of 16: the cross products once, doubled.
+inline void feSqr(Fe r, const Fe a) {
+  uint64_t t[8], c, h;
+  t[1] = mulAdd(a[0], a[1], 0, 0, &c);
+  t[2] = mulAdd(a[0], a[2], c, 0, &c);
+  t[3] = mulAdd(a[0], a[3], c, 0, &t[4]);
+  t[3] = mulAdd(a[1], a[2], t[3], 0, &c);
+  t[4] = mulAdd(a[1], a[3], t[4], c, &t[5]);
+  t[5] = mulAdd(a[2], a[3], t[5], 0, &t[6]);
+
+  t[7] = t[6] >> 63;
+  t[6] = (t[6] << 1) | (t[5] >> 63);
+  t[5] = (t[5] << 1) | (t[4] >> 63);
+  t[4] = (t[4] << 1) | (t[3] >> 63);
+  t[3] = (t[3] << 1) | (t[2] >> 63);
+  t[2] = (t[2] << 1) | (t[1] >> 63);
+  t[1] <<= 1;
+
+  c = 0;
+  t[0] = mulAdd(a[0], a[0], 0, 0, &h);
+  t[1] = addCarry(t[1], h, &c);
+  uint64_t lo = mulAdd(a[1], a[1], 0, 0, &h);
+  t[2] = addCarry(t[2], lo, &c);
+  t[3] = addCarry(t[3], h, &c);
+  lo = mulAdd(a[2], a[2], 0, 0, &h);
+  t[4] = addCarry(t[4], lo, &c);
+  t[5] = addCarry(t[5], h, &c);
+  lo = mulAdd(a[3], a[3], 0, 0, &h);
+  t[6] = addCarry(t[6], lo, &c);
+  t[7] = addCarry(t[7], h, &c);
+  feReduce(r, t);
+}
+inline void feAdd(Fe r, const Fe a, const Fe b) { modAdd<FIELD_P>(r, a, b); }
+inline void feSub(Fe r, const Fe a, const Fe b) { modSub<FIELD_P>(r, a, b); }
+
+// Fermat: a^(p - 2).
+void feInv(Fe r, const Fe a) { montPow<FIELD_P>(r, a, kPminus2); }
+
+// A point in Jacobian coordinates, (x/z^2, y/z^3); z == 0 at infinity.
+struct Jacobian {
+  Fe x, y, z;
+};
+
+// r = 2a, for curves with a = -3 (dbl-2001-b).
+void pointDouble(Jacobian* r, const Jacobian* a) {
+  if (isZero(a->z)) {
+    *r = *a;
+    return;
+  }
+
+  Fe delta, gamma, beta, alpha, t1, t2;
+  feSqr(delta, a->z);
+  feSqr(gamma, a->y);
+  feMul(beta, a->x, gamma);
+
+  // alpha = 3 (x - delta)(x + delta)
+  feSub(t1, a->x, delta);
+  feAdd(t2, a->x, delta);
+  feMul(t1, t1, t2);
+  feAdd(alpha, t1, t1);
+  feAdd(alpha, alpha, t1);
+
+  // z3 = (y + z)^2 - gamma - delta
+  feAdd(t1, a->y, a->z);
+  feSqr(t1, t1);
+  feSub(t1, t1, gamma);
+  feSub(r->z, t1, delta);
+
+  // x3 = alpha^2 - 8 beta
+  feAdd(beta, beta, beta);
+  feAdd(beta, beta, beta);
+  feSqr(t1, alpha);
+  feSub(t1, t1, beta);
+  feSub(r->x, t1, beta);
+
+  // y3 = alpha (4 beta - x3) - 8 gamma^2
+  feSub(t2, beta, r->x);
+  feMul(t2, alpha, t2);
+  feSqr(t1, gamma);
+  feAdd(t1, t1, t1);
+  feAdd(t1, t1, t1);
+  feAdd(t1, t1, t1);
+  feSub(r->y, t2, t1);
+}
+
+// r = a + b, b in affine coordinates, negated if |negate| (madd-2007-bl).
+void pointAddAffine(Jacobian* r, const Jacobian* a, const Affine* b,
+                    bool negate) {
+  Fe y2;
+  if (negate) {
+    feSub(y2, kZero, b->y);
+  } else {
+    memcpy(y2, b->y, sizeof(Fe));
+  }
+
+  if (isZero(a->z)) {
+    memcpy(r->x, b->x, sizeof(Fe));
+    memcpy(r->y, y2, sizeof(Fe));
+    memcpy(r->z, kOneP, sizeof(Fe));
+    return;
+  }
+
+  Fe z1z1, u2, s2, h, rr, hh, i, j, v, t;
+  feSqr(z1z1, a->z);
+  feMul(u2, b->x, z1z1);
+  feMul(s2, y2, a->z);
+  feMul(s2, s2, z1z1);
+  feSub(h, u2, a->x);
+  feSub(rr, s2, a->y);
+  feAdd(rr, rr, rr);
+
+  if (isZero(h)) {
+    if (isZero(rr)) {
+      pointDouble(r, a);
+    } else {
+      memset(r, 0, sizeof(*r));
+    }
+    return;
+  }
+
+  feSqr(hh, h);
+  feAdd(i, hh, hh);
+  feAdd(i, i, i);
+  feMul(j, h, i);
+  feMul(v, a->x, i);
+
+  // z3 = (z1 + h)^2 - z1z1 - hh
+  feAdd(t, a->z, h);
+  feSqr(t, t);
+  feSub(t, t, z1z1);
+  feSub(r->z, t, hh);
+
+  // x3 = rr^2 - j - 2v, y3 = rr (v - x3) - 2 y1 j
+  feMul(s2, a->y, j);
+  feSqr(t, rr);
+  feSub(t, t, j);
+  feSub(t, t, v);
+  feSub(r->x, t, v);
+  feSub(v, v, r->x);
+  feMul(v, rr, v);
+  feAdd(s2, s2, s2);
+  feSub(r->y, v, s2);
+}
+
+// r = a + b (add-2007-bl).
+void pointAdd(Jacobian* r, const Jacobian* a, const Jacobian* b) {
+  if (isZero(a->z)) {
+    *r = *b;
+    return;
+  }
+  if (isZero(b->z)) {
+    *r = *a;
+    return;
+  }
+
+  Fe z1z1, z2z2, u1, u2, s1, s2, h, i, j, rr, v, t;
+  feSqr(z1z1, a->z);
+  feSqr(z2z2, b->z);
+  feMul(u1, a->x, z2z2);
+  feMul(u2, b->x, z1z1);
+  feMul(s1, a->y, b->z);
+  feMul(s1, s1, z2z2);
+  feMul(s2, b->y, a->z);
+  feMul(s2, s2, z1z1);
+  feSub(h, u2, u1);
+  feSub(rr, s2, s1);
+  feAdd(rr, rr, rr);
+
+  if (isZero(h)) {
+    if (isZero(rr)) {
+      pointDouble(r, a);
+    } else {
+      memset(r, 0, sizeof(*r));
+    }
+    return;
+  }
+
+  feAdd(i, h, h);
+  feSqr(i, i);
+  feMul(j, h, i);
+  feMul(v, u1, i);
+
+  // z3 = ((z1 + z2)^2 - z1z1 - z2z2) h
+  feAdd(t, a->z, b->z);
+  feSqr(t, t);
+  feSub(t, t, z1z1);
+  feSub(t, t, z2z2);
+  feMul(r->z, t, h);
+
+  // x3 = rr^2 - j - 2v, y3 = rr (v - x3) - 2 s1 j
+  feSqr(t, rr);
+  feSub(t, t, j);
+  feSub(t, t, v);
+  feSub(r->x, t, v);
+  feSub(v, v, r->x);
+  feMul(v, rr, v);
+  feMul(s1, s1, j);
+  feAdd(s1, s1, s1);
+  feSub(r->y, v, s1);
+}
+
+// Converts |count| points with z != 0 to affine, with one inversion.
+void normalize(Affine* out, const Jacobian* in, int count) {
+  // out[i].x = z0 z1 .. zi for now
+  memcpy(out[0].x, in[0].z, sizeof(Fe));
+  for (int i = 1; i < count; ++i) feMul(out[i].x, out[i - 1].x, in[i].z);
+
+  Fe inv, zinv, t;
+  feInv(inv, out[count - 1].x);
+  for (int i = count - 1; i >= 0; --i) {
+    if (i > 0) {
+      feMul(zinv, inv, out[i - 1].x);
+      feMul(inv, inv, in[i].z);
+    } else {
+      memcpy(zinv, inv, sizeof(Fe));
+    }
+    feSqr(t, zinv);
+    feMul(out[i].x, in[i].x, t);
+    feMul(t, t, zinv);
+    feMul(out[i].y, in[i].y, t);
+  }
+}
+
+// Decodes (x, y) into Montgomery form. Returns false if not on the curve.
+bool toPoint(Affine* out, const p256_int* x, const p256_int* y) {
+  Fe fx, fy;
+  fromInt(fx, x);
+  fromInt(fy, y);
+  if (!less(fx, kP) || !less(fy, kP)) return false;
+  feMul(out->x, fx, kRRP);
+  feMul(out->y, fy, kRRP);
+
+  // y^2 = x^3 - 3x + b
+  Fe y2, x3, t;
+  feSqr(y2, out->y);
+  feSqr(x3, out->x);
+  feMul(x3, x3, out->x);
+  feAdd(t, out->x, out->x);
+  feAdd(t, t, out->x);
+  feSub(x3, x3, t);
+  feAdd(x3, x3, kBMont);
+  return equal(y2, x3);
+}
+
+// Odd multiples p, 3p, .., (2 count - 1)p of affine |p|, into |out|.
+void makeTable(Affine* out, int count, const Affine* p) {
+  std::vector<Jacobian> jac(count);
+  Jacobian twice;
+  memcpy(jac[0].x, p->x, sizeof(Fe));
+  memcpy(jac[0].y, p->y, sizeof(Fe));
+  memcpy(jac[0].z, kOneP, sizeof(Fe));
+  pointDouble(&twice, &jac[0]);
+  for (int i = 1; i < count; ++i) pointAdd(&jac[i], &jac[i - 1], &twice);
+  normalize(out, &jac[0], count);
+}
+
+// acc = u1 G + u2 Q, from the odd multiple tables of G and Q.
+void mulTables(Jacobian* acc, const Affine* g, const Fe u1,
+               const Affine* q, int qWindow, const Fe u2) {
+  int16_t n1[257] = {0}, n2[257] = {0};
+  int len1 = toWnaf(n1, u1, G_WINDOW);
+  int len2 = toWnaf(n2, u2, qWindow);
+
+  memset(acc, 0, sizeof(*acc));
+  for (int i = (len1 > len2 ? len1 : len2) - 1; i >= 0; --i) {
+    pointDouble(acc, acc);
+    if (n1[i]) {
+      pointAddAffine(acc, acc, &g[(n1[i] < 0 ? -n1[i] : n1[i]) >> 1],
+                     n1[i] < 0);
+    }
+    if (n2[i]) {
+      pointAddAffine(acc, acc, &q[(n2[i] < 0 ? -n2[i] : n2[i]) >> 1],
+                     n2[i] < 0);
+    }
+  }
+}
+
+int verify(const Affine* g, const Affine* q, int qWindow,
+           const p256_int* h, const p256_int* r, const p256_int* s) {
+  Fe fh, fr, fs;
+  fromInt(fh, h);
+  fromInt(fr, r);
+  fromInt(fs, s);
+  if (isZero(fr) || !less(fr, kN)) return 0;
+  if (isZero(fs) || !less(fs, kN)) return 0;
+  if (!less(fh, kN)) sub(fh, fh, kN);
+
+  // w = R/s, so u1 = h w / R = h/s and u2 = r/s
+  Fe w, u1, u2;
+  montMul<ORDER_N>(w, fs, kRRN);
+  montPow<ORDER_N>(w, w, kNminus2);
+  montMul<ORDER_N>(u1, fh, w);
+  montMul<ORDER_N>(u2, fr, w);
+
+  Jacobian acc;
+  mulTables(&acc, g, u1, q, qWindow, u2);
+  if (isZero(acc.z)) return 0;
+
+  // x / z^2 mod n == r, without inverting z: x == r z^2 or (r + n) z^2.
+  Fe z2, rm, t;
+  feSqr(z2, acc.z);
+  feMul(rm, fr, kRRP);
+  feMul(t, rm, z2);
+  if (equal(t, acc.x)) return 1;
+  if (!less(fr, kPminusN)) return 0;
+  add(fr, fr, kN);
+  feMul(rm, fr, kRRP);
+  feMul(t, rm, z2);
+  return equal(t, acc.x) ? 1 : 0;
+}
+
+bool pointsMul(const Affine* g, const p256_int* u1, const p256_int* u2,
+               const Affine* q, int qWindow,
+               p256_int* out_x, p256_int* out_y) {
+  Fe f1, f2;
+  fromInt(f1, u1);
+  fromInt(f2, u2);
+
+  Jacobian acc;
+  mulTables(&acc, g, f1, q, qWindow, f2);
+  if (isZero(acc.z)) return false;
+
+  Fe zinv, t, x, y;
+  feInv(zinv, acc.z);
+  feSqr(t, zinv);
+  feMul(x, acc.x, t);
+  feMul(t, t, zinv);
+  feMul(y, acc.y, t);
+
+  // out of Montgomery form
+  feMul(x, x, kOneInt);
+  feMul(y, y, kOneInt);
+  toInt(out_x, x);
+  toInt(out_y, y);
+  return true;
+}
+
+// acc = u1 G + sum u2[k] Q[k] in one pass, Q[k] from its odd multiples
+// table q[k] of window qWindow[k].
+void mulMany(Jacobian* acc, const Affine* g, const Fe u1,
+             const Affine* const* q, const int* qWindow, const Fe* u2,
+             int count) {
+  int16_t n1[257] = {0}, n2[U2F_P256_BATCH_MAX][257];
+  int len = toWnaf(n1, u1, G_WINDOW);
+  for (int k = 0; k < count; ++k) {
+    memset(n2[k], 0, sizeof(n2[k]));
+    int lenK = toWnaf(n2[k], u2[k], qWindow[k]);
+    if (lenK > len) len = lenK;
+  }
+
+  memset(acc, 0, sizeof(*acc));
+  for (int i = len - 1; i >= 0; --i) {
+    pointDouble(acc, acc);
+    if (n1[i]) {
+      pointAddAffine(acc, acc, &g[(n1[i] < 0 ? -n1[i] : n1[i]) >> 1],
+                     n1[i] < 0);
+    }
+    for (int k = 0; k < count; ++k) {
+      int d = n2[k][i];
+      if (d) pointAddAffine(acc, acc, &q[k][(d < 0 ? -d : d) >> 1], d < 0);
+    }
+  }
+}
+
+// Checks sum z_i (u1_i G + u2_i Q_i) = sum +-z_i R_i over |count| <=
+// U2F_P256_BATCH_MAX signatures, R_i the points with x = r_i: one long
+// multiplication for the whole batch, with the u2 of signatures under
+// the same key table added up, instead of one per signature. r_i only
+// fixes R_i up to sign, so the right side is searched over all signs,
+// flipping one term at a time.
+// Returns true if all verify (but for a chance of about 2^(count - 65)
+// with random 64-bit z_i), false if any does not, or has an R the
+// batch cannot recover; see verify() for those.
+bool verifyCombined(const Affine* g, const BatchItem* items, int count,
+                    const uint64_t* z) {
+  if (count < 1 || count > U2F_P256_BATCH_MAX) return false;
+  Fe fh[U2F_P256_BATCH_MAX], fr[U2F_P256_BATCH_MAX];
+  Fe sm[U2F_P256_BATCH_MAX], prefix[U2F_P256_BATCH_MAX];
+  for (int i = 0; i < count; ++i) {
+    Fe fs;
+    fromInt(fh[i], items[i].h);
+    fromInt(fr[i], items[i].r);
+    fromInt(fs, items[i].s);
+    if (isZero(fr[i]) || !less(fr[i], kN)) return false;
+    if (isZero(fs) || !less(fs, kN)) return false;
+    if (!less(fh[i], kN)) sub(fh[i], fh[i], kN);
+    montMul<ORDER_N>(sm[i], fs, kRRN);
+    if (i == 0) {
+      memcpy(prefix[0], sm[0], sizeof(Fe));
+    } else {
+      montMul<ORDER_N>(prefix[i], prefix[i - 1], sm[i]);
+    }
+  }
+
+  // All the 1/s with one inversion, then u1 = z h/s and u2 = z r/s,
+  // u2 summed per key.
+  Fe inv, u1, u2[U2F_P256_BATCH_MAX];
+  const Affine* q[U2F_P256_BATCH_MAX];
+  int qWindow[U2F_P256_BATCH_MAX], keys = 0;
+  memset(u1, 0, sizeof(u1));
+  montPow<ORDER_N>(inv, prefix[count - 1], kNminus2);
+  for (int i = count - 1; i >= 0; --i) {
+    Fe w, zm, t;
+    if (i > 0) {
+      montMul<ORDER_N>(w, inv, prefix[i - 1]);
+      montMul<ORDER_N>(inv, inv, sm[i]);
+    } else {
+      memcpy(w, inv, sizeof(Fe));
+    }
+    const uint64_t zi[4] = { z[i], 0, 0, 0 };
+    montMul<ORDER_N>(zm, zi, kRRN);
+    montMul<ORDER_N>(w, w, zm);  // z/s, in Montgomery form
+    montMul<ORDER_N>(t, fh[i], w);
+    modAdd<ORDER_N>(u1, u1, t);
+    montMul<ORDER_N>(t, fr[i], w);
+
+    int k = 0;
+    while (k < keys && q[k] != items[i].q) ++k;
+    if (k == keys) {
+      q[k] = items[i].q;
+      qWindow[k] = items[i].qWindow;
+      memset(u2[k], 0, sizeof(Fe));
+      ++keys;
+    }
+    modAdd<ORDER_N>(u2[k], u2[k], t);
+  }
+
+  Jacobian sum;
+  mulMany(&sum, g, u1, q, qWindow, u2, keys);
+  if (isZero(sum.z)) return false;
+  Affine target;
+  normalize(&target, &sum, 1);
+
+  // z_i R_i and twice that, to flip the sign of a term.
+  Jacobian terms[2 * U2F_P256_BATCH_MAX];
+  for (int i = 0; i < count; ++i) {
+    // y = sqrt(x^3 - 3x + b) = (x^3 - 3x + b)^((p + 1) / 4)
+    Affine r;
+    Fe rhs, t;
+    feMul(r.x, fr[i], kRRP);
+    feSqr(rhs, r.x);
+    feMul(rhs, rhs, r.x);
+    feAdd(t, r.x, r.x);
+    feAdd(t, t, r.x);
+    feSub(rhs, rhs, t);
+    feAdd(rhs, rhs, kBMont);
+    montPow<FIELD_P>(r.y, rhs, kPplus1over4);
+    feSqr(t, r.y);
+    if (!equal(t, rhs)) return false;  // x = r + n, or no such point
+
+    const uint64_t zi[4] = { z[i], 0, 0, 0 };
+    int16_t naf[257] = {0};
+    Jacobian* term = &terms[2 * i];
+    memset(term, 0, sizeof(*term));
+    for (int b = toWnaf(naf, zi, 2) - 1; b >= 0; --b) {
+      pointDouble(term, term);
+      if (naf[b]) pointAddAffine(term, term, &r, naf[b] < 0);
+    }
+    pointDouble(&terms[2 * i + 1], term);
+  }
+  Affine flips[2 * U2F_P256_BATCH_MAX];
+  normalize(flips, terms, 2 * count);
+
+  // Gray code over the signs of all but the first term; matching x
+  // covers the negated signs too.
+  Jacobian acc;
+  memset(&acc, 0, sizeof(acc));
+  for (int i = 0; i < count; ++i) {
+    pointAddAffine(&acc, &acc, &flips[2 * i], false);
+  }
+  unsigned negated = 0;
+  for (unsigned step = 1; ; ++step) {
+    if (!isZero(acc.z)) {
+      Fe t;
+      feSqr(t, acc.z);
+      feMul(t, t, target.x);
+      if (equal(t, acc.x)) return true;
+    }
+    if (step >= 1u << (count - 1)) return false;
+    int flip = 1;
+    for (unsigned s = step; !(s & 1); s >>= 1) ++flip;
+    negated ^= 1u << flip;
+    pointAddAffine(&acc, &acc, &flips[2 * flip + 1],
+                   (negated >> flip) & 1);
+  }
+}
@@ -0,0 +1,100 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <chrono>
+
+#include "u2f_pipeline.h"
+#include "u2f_verify.h"
+
+U2F_pipeline::U2F_pipeline(unsigned threads, size_t depth,
+                           U2F_keyCache* keys)
+    : keys_(keys), depth_(depth ? depth : 1), submitted_(0), handed_(0),
+      stop_(false) {
+  if (threads == 0) threads = 1;
+  for (unsigned t = 0; t < threads; ++t) {
+    workers_.push_back(std::thread(&U2F_pipeline::work, this));
+  }
+}
+
+U2F_pipeline::~U2F_pipeline() {
+  {
+    std::lock_guard<std::mutex> hold(lock_);
+    stop_ = true;
+  }
+  queued_.notify_all();
+  for (size_t t = 0; t < workers_.size(); ++t) workers_[t].join();
+}
+
+uint64_t U2F_pipeline::submit(const U2F_pipelineJob& job) {
+  std::unique_lock<std::mutex> hold(lock_);
+  while (submitted_ - handed_ - finished_.size() >= depth_) {
+    done_.wait(hold);
+  }
+  queue_.push_back(job);
+  queue_.back().seq = submitted_;
+  queued_.notify_one();
+  return submitted_++;
+}
+
+bool U2F_pipeline::poll(U2F_pipelineJob* job) {
+  std::lock_guard<std::mutex> hold(lock_);
+  std::map<uint64_t, U2F_pipelineJob>::iterator it = finished_.find(handed_);
+  if (it == finished_.end()) return false;
+  *job = it->second;
+  finished_.erase(it);
+  ++handed_;
+  return true;
+}
+
+bool U2F_pipeline::next(U2F_pipelineJob* job) {
+  std::unique_lock<std::mutex> hold(lock_);
+  if (handed_ == submitted_) return false;
+  std::map<uint64_t, U2F_pipelineJob>::iterator it;
+  while ((it = finished_.find(handed_)) == finished_.end()) done_.wait(hold);
+  *job = it->second;
+  finished_.erase(it);
+  ++handed_;
+  return true;
+}
+
+size_t U2F_pipeline::outstanding() {
+  std::lock_guard<std::mutex> hold(lock_);
+  return (size_t) (submitted_ - handed_);
+}
+
+void U2F_pipeline::work() {
+  for (;;) {
+    U2F_pipelineJob job;
+    {
+      std::unique_lock<std::mutex> hold(lock_);
+      while (queue_.empty() && !stop_) queued_.wait(hold);
+      if (queue_.empty()) return;
+      job = queue_.front();
+      queue_.pop_front();
+    }
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    const uint8_t* rsp = reinterpret_cast<const uint8_t*>(job.rsp.data());
+    if (job.enroll) {
+      U2F_derSpan userKey;
+      U2F_derRegister parts;
+      job.result = U2F_parseRegister(rsp, job.rsp.size(), &userKey, &parts) ?
+          U2F_verifyRegister(job.appId, job.challenge, userKey, parts, keys_) :
+          -1;
+    } else {
+      job.result = U2F_verifyAuthenticate(job.userKey, job.appId,
+                                          job.challenge, rsp, job.rsp.size(),
+                                          keys_);
+    }
+    job.seconds = std::chrono::duration<float>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> hold(lock_);
+    finished_[job.seq] = job;
+    done_.notify_all();
+  }
+}
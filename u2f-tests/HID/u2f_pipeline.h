@@ -0,0 +1,85 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Response verification on worker threads, so that the next request can
+// go out to the device while the last response is hashed and verified.
+// Jobs finish in any order but are handed back in the order they were
+// submitted, so counters can be checked as the device issued them.
+
+#ifndef __U2F_PIPELINE_H_INCLUDED__
+#define __U2F_PIPELINE_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "u2f_keycache.h"
+
+// One response to verify.
+struct U2F_pipelineJob {
+  bool enroll;  // registration response, else authentication
+  uint8_t appId[32];
+  uint8_t challenge[32];
+  uint8_t userKey[65];  // authentication: the key to verify under
+  std::string rsp;  // response data, without the status word
+  uint64_t tag;  // for the caller; say which device or key handle
+
+  uint64_t seq;  // out: submission number, from 0
+  int result;  // out: as U2F_verifyRegister or U2F_verifyAuthenticate
+  float seconds;  // out: time spent verifying
+
+  U2F_pipelineJob() : enroll(false), tag(0), seq(0), result(-1),
+                      seconds(0) {}
+};
+
+class U2F_pipeline {
+ public:
+  // Verifies on |threads| workers, caching keys in |keys| (may be NULL),
+  // with at most |depth| jobs waiting for or in verification.
+  U2F_pipeline(unsigned threads, size_t depth, U2F_keyCache* keys);
+  ~U2F_pipeline();
+
+  // Queues a copy of |job|, first waiting while |depth| jobs are not
+  // yet verified. Returns its sequence number.
+  uint64_t submit(const U2F_pipelineJob& job);
+
+  // Hands back the oldest job if it is done. Returns false if not.
+  bool poll(U2F_pipelineJob* job);
+
+  // Hands back the oldest job, waiting for it to finish.
+  // Returns false if none is outstanding.
+  bool next(U2F_pipelineJob* job);
+
+  size_t outstanding();  // submitted but not handed back
+
+ private:
+  U2F_pipeline(const U2F_pipeline&);
+  void operator=(const U2F_pipeline&);
+
+  void work();
+
+  U2F_keyCache* keys_;
+  size_t depth_;
+  std::vector<std::thread> workers_;
+
+  std::mutex lock_;
+  std::condition_variable queued_;  // a job to verify, or stopping
+  std::condition_variable done_;  // a job finished
+  std::deque<U2F_pipelineJob> queue_;
+  std::map<uint64_t, U2F_pipelineJob> finished_;
+  uint64_t submitted_;
+  uint64_t handed_;  // sequence number of the next one to hand back
+  bool stop_;
+};
+
+#endif  // __U2F_PIPELINE_H_INCLUDED__
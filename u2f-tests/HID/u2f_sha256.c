@@ -0,0 +1,426 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <string.h>
+
+#include "u2f_sha256.h"
+
+#if defined(__x86_64__) || defined(__i386__) || \
+    defined(_M_X64) || defined(_M_IX86)
+#define U2F_SHA256_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET(features)
+#else
+#include <cpuid.h>
+#define TARGET(features) __attribute__((target(features)))
+#endif
+#endif
+
+// Messages a batch hashes side by side.
+#define LANES  8
+
+enum { PORTABLE, AVX2, SHANI };
+
+static const char* const implNames[] = { "portable", "avx2", "sha-ni" };
+
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t H0[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static
+uint32_t load32(const uint8_t* p) {
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+         ((uint32_t) p[2] << 8) | p[3];
+}
+
+static
+void store32(uint8_t* p, uint32_t x) {
+  p[0] = (uint8_t) (x >> 24);
+  p[1] = (uint8_t) (x >> 16);
+  p[2] = (uint8_t) (x >> 8);
+  p[3] = (uint8_t) x;
+}
+
+#define ROR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+static
+void compressPortable(uint32_t state[8], const uint8_t* data,
+                      size_t blocks) {
+  uint32_t w[64];
+  for (; blocks; --blocks, data += 64) {
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    int i;
+    for (i = 0; i < 16; ++i) w[i] = load32(data + 4 * i);
+    for (; i < 64; ++i) {
+      uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    for (i = 0; i < 64; ++i) {
+      uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) +
+                    ((e & f) ^ (~e & g)) + K[i] + w[i];
+      uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+                    ((a & b) ^ (c & (a ^ b)));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+  }
+}
+
+#ifdef U2F_SHA256_X86
+
+// The SHA extensions keep the state as ABEF and CDGH and do two rounds
+// per instruction.
+TARGET("sha,sse4.1") static
+void compressShani(uint32_t state[8], const uint8_t* data, size_t blocks) {
+  const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                      0x0405060700010203ULL);
+  __m128i t = _mm_shuffle_epi32(
+      _mm_loadu_si128((const __m128i*) &state[0]), 0xb1);  // CDAB
+  __m128i s1 = _mm_shuffle_epi32(
+      _mm_loadu_si128((const __m128i*) &state[4]), 0x1b);  // EFGH
+  __m128i s0 = _mm_alignr_epi8(t, s1, 8);  // ABEF
+  s1 = _mm_blend_epi16(s1, t, 0xf0);  // CDGH
+
+  for (; blocks; --blocks, data += 64) {
+    __m128i abef = s0, cdgh = s1, m[4], x;
+    int i;
+    for (i = 0; i < 16; ++i) {
+      if (i < 4) {
+        m[i] = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i*) (data + 16 * i)), swap);
+      } else {
+        x = _mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]);
+        x = _mm_add_epi32(x, _mm_alignr_epi8(m[(i + 3) & 3],
+                                             m[(i + 2) & 3], 4));
+        m[i & 3] = _mm_sha256msg2_epu32(x, m[(i + 3) & 3]);
+      }
+      x = _mm_add_epi32(m[i & 3],
+                        _mm_loadu_si128((const __m128i*) &K[4 * i]));
+      s1 = _mm_sha256rnds2_epu32(s1, s0, x);
+      s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(x, 0x0e));
+    }
+    s0 = _mm_add_epi32(s0, abef);
+    s1 = _mm_add_epi32(s1, cdgh);
+  }
+
+  t = _mm_shuffle_epi32(s0, 0x1b);  // FEBA
+  s1 = _mm_shuffle_epi32(s1, 0xb1);  // DCHG
+  _mm_storeu_si128((__m128i*) &state[0], _mm_blend_epi16(t, s1, 0xf0));
+  _mm_storeu_si128((__m128i*) &state[4], _mm_alignr_epi8(s1, t, 8));
+}
+
+#define ROR8(x, n) \
+    _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+// Transposes rows r[0..7] of 8 words into columns c[0..7].
+#define TRANSPOSE8(r, c) do { \
+    __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]); \
+    __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]); \
+    __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]); \
+    __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]); \
+    __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]); \
+    __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]); \
+    __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]); \
+    __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]); \
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2); \
+    __m256i u1 = _mm256_unpackhi_epi64(t0, t2); \
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3); \
+    __m256i u3 = _mm256_unpackhi_epi64(t1, t3); \
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6); \
+    __m256i u5 = _mm256_unpackhi_epi64(t4, t6); \
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7); \
+    __m256i u7 = _mm256_unpackhi_epi64(t5, t7); \
+    c[0] = _mm256_permute2x128_si256(u0, u4, 0x20); \
+    c[1] = _mm256_permute2x128_si256(u1, u5, 0x20); \
+    c[2] = _mm256_permute2x128_si256(u2, u6, 0x20); \
+    c[3] = _mm256_permute2x128_si256(u3, u7, 0x20); \
+    c[4] = _mm256_permute2x128_si256(u0, u4, 0x31); \
+    c[5] = _mm256_permute2x128_si256(u1, u5, 0x31); \
+    c[6] = _mm256_permute2x128_si256(u2, u6, 0x31); \
+    c[7] = _mm256_permute2x128_si256(u3, u7, 0x31); \
+  } while (0)
+
+// One block for each of 8 messages; s[j] holds word j of every state.
+// Lanes whose |keep| mask is set are left as they were.
+TARGET("avx2") static
+void compressAvx2(__m256i s[8], const uint8_t* const block[LANES],
+                  __m256i keep) {
+  const __m256i swap = _mm256_set_epi64x(
+      0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+      0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m256i w[16], r[8];
+  __m256i a = s[0], b = s[1], c = s[2], d = s[3];
+  __m256i e = s[4], f = s[5], g = s[6], h = s[7];
+  int i, half;
+
+  for (half = 0; half < 2; ++half) {
+    for (i = 0; i < LANES; ++i) {
+      r[i] = _mm256_loadu_si256((const __m256i*) (block[i] + 32 * half));
+    }
+    TRANSPOSE8(r, (w + 8 * half));
+    for (i = 0; i < 8; ++i) {
+      w[8 * half + i] = _mm256_shuffle_epi8(w[8 * half + i], swap);
+    }
+  }
+
+  for (i = 0; i < 64; ++i) {
+    __m256i t1, t2;
+    if (i >= 16) {
+      __m256i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+      __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROR8(w15, 7),
+          ROR8(w15, 18)), _mm256_srli_epi32(w15, 3));
+      __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROR8(w2, 17),
+          ROR8(w2, 19)), _mm256_srli_epi32(w2, 10));
+      w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0),
+                                   _mm256_add_epi32(w[(i - 7) & 15], s1));
+    }
+    t1 = _mm256_add_epi32(h, _mm256_xor_si256(_mm256_xor_si256(
+        ROR8(e, 6), ROR8(e, 11)), ROR8(e, 25)));
+    t1 = _mm256_add_epi32(t1, _mm256_xor_si256(_mm256_and_si256(e, f),
+                                               _mm256_andnot_si256(e, g)));
+    t1 = _mm256_add_epi32(t1, _mm256_add_epi32(
+        _mm256_set1_epi32((int) K[i]), w[i & 15]));
+    t2 = _mm256_add_epi32(_mm256_xor_si256(_mm256_xor_si256(
+        ROR8(a, 2), ROR8(a, 13)), ROR8(a, 22)),
+        _mm256_xor_si256(_mm256_and_si256(a, b),
+                         _mm256_and_si256(c, _mm256_xor_si256(a, b))));
+    h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+    d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+  }
+
+  s[0] = _mm256_blendv_epi8(_mm256_add_epi32(s[0], a), s[0], keep);
+  s[1] = _mm256_blendv_epi8(_mm256_add_epi32(s[1], b), s[1], keep);
+  s[2] = _mm256_blendv_epi8(_mm256_add_epi32(s[2], c), s[2], keep);
+  s[3] = _mm256_blendv_epi8(_mm256_add_epi32(s[3], d), s[3], keep);
+  s[4] = _mm256_blendv_epi8(_mm256_add_epi32(s[4], e), s[4], keep);
+  s[5] = _mm256_blendv_epi8(_mm256_add_epi32(s[5], f), s[5], keep);
+  s[6] = _mm256_blendv_epi8(_mm256_add_epi32(s[6], g), s[6], keep);
+  s[7] = _mm256_blendv_epi8(_mm256_add_epi32(s[7], h), s[7], keep);
+}
+
+#endif  // U2F_SHA256_X86
+
+// Writes the final one or two blocks of a |len| byte message, whose last
+// len % 64 bytes are at |tail|, to |out|. Returns the number of blocks.
+static
+size_t pad(const uint8_t* tail, uint64_t len, uint8_t out[128]) {
+  size_t rest = (size_t) (len % 64);
+  size_t blocks = rest < 56 ? 1 : 2;
+  memcpy(out, tail, rest);
+  out[rest] = 0x80;
+  memset(out + rest + 1, 0, 64 * blocks - rest - 9);
+  store32(out + 64 * blocks - 8, (uint32_t) (len >> 29));
+  store32(out + 64 * blocks - 4, (uint32_t) (len << 3));
+  return blocks;
+}
+
+#ifdef U2F_SHA256_X86
+
+// Hashes data[0..n), n <= LANES, side by side.
+TARGET("avx2") static
+void batchAvx2(const uint8_t* const* data, const size_t* len, size_t n,
+               uint8_t* digests) {
+  static const uint8_t zero[64] = { 0 };
+  uint8_t tails[LANES][128];
+  size_t full[LANES], blocks[LANES], most = 0, i, j;
+  const uint8_t* block[LANES];
+  uint32_t words[8][LANES];
+  __m256i s[8];
+
+  for (i = 0; i < LANES; ++i) {
+    full[i] = blocks[i] = 0;
+    if (i < n) {
+      full[i] = len[i] / 64;
+      blocks[i] = full[i] + pad(data[i] + 64 * full[i], len[i], tails[i]);
+      if (blocks[i] > most) most = blocks[i];
+    }
+  }
+  for (j = 0; j < 8; ++j) s[j] = _mm256_set1_epi32((int) H0[j]);
+
+  for (j = 0; j < most; ++j) {
+    int done[LANES];
+    for (i = 0; i < LANES; ++i) {
+      done[i] = j >= blocks[i] ? -1 : 0;
+      block[i] = done[i] ? zero :
+                 j < full[i] ? data[i] + 64 * j :
+                 tails[i] + 64 * (j - full[i]);
+    }
+    compressAvx2(s, block, _mm256_setr_epi32(done[0], done[1], done[2],
+        done[3], done[4], done[5], done[6], done[7]));
+  }
+
+  for (j = 0; j < 8; ++j) _mm256_storeu_si256((__m256i*) words[j], s[j]);
+  for (i = 0; i < n; ++i) {
+    for (j = 0; j < 8; ++j) {
+      store32(digests + U2F_SHA256_SIZE * i + 4 * j, words[j][i]);
+    }
+  }
+}
+
+static
+int detect(void) {
+  unsigned int b, c;
+  int avx2 = 0, found = 1 << PORTABLE;
+#ifdef _MSC_VER
+  int r[4];
+  __cpuid(r, 0);
+  if (r[0] < 7) return found;
+  __cpuid(r, 1);
+  c = (unsigned int) r[2];
+  __cpuidex(r, 7, 0);
+  b = (unsigned int) r[1];
+  if ((c & (1 << 27)) && (_xgetbv(0) & 6) == 6) avx2 = !!(b & (1 << 5));
+#else
+  unsigned int a, d;
+  if (__get_cpuid_max(0, NULL) < 7) return found;
+  __cpuid(1, a, b, c, d);
+  if (c & (1 << 27)) {  // OSXSAVE: ask whether the OS saves ymm state
+    unsigned int lo, hi;
+    __asm__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+    avx2 = (lo & 6) == 6;
+  }
+  __cpuid_count(7, 0, a, b, c, d);
+  avx2 = avx2 && (b & (1 << 5));
+#endif
+  if (avx2) found |= 1 << AVX2;
+  if (b & (1 << 29)) found |= 1 << SHANI;
+  return found;
+}
+
+#else
+
+static
+int detect(void) {
+  return 1 << PORTABLE;
+}
+
+#endif  // U2F_SHA256_X86
+
+// Set once from cpuid; racing first calls store the same values.
+static volatile int impl = -1;
+static int have;  // bit per implementation this CPU can run
+
+static
+int current(void) {
+  if (impl < 0) {
+    int i;
+    have = detect();
+    for (i = SHANI; !(have & (1 << i)); --i) {}
+    impl = i;
+  }
+  return impl;
+}
+
+static
+void compress(uint32_t state[8], const uint8_t* data, size_t blocks) {
+#ifdef U2F_SHA256_X86
+  if (current() == SHANI) {
+    compressShani(state, data, blocks);
+    return;
+  }
+#endif
+  compressPortable(state, data, blocks);
+}
+
+void U2F_sha256Init(U2F_sha256Ctx* ctx) {
+  memcpy(ctx->state, H0, sizeof(H0));
+  ctx->count = 0;
+}
+
+void U2F_sha256Update(U2F_sha256Ctx* ctx, const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*) data;
+  size_t used = (size_t) (ctx->count % 64);
+  ctx->count += len;
+  if (used) {
+    size_t take = 64 - used < len ? 64 - used : len;
+    memcpy(ctx->buf + used, p, take);
+    p += take;
+    len -= take;
+    if (used + take < 64) return;
+    compress(ctx->state, ctx->buf, 1);
+  }
+  if (len >= 64) {
+    compress(ctx->state, p, len / 64);
+    p += len & ~(size_t) 63;
+    len &= 63;
+  }
+  memcpy(ctx->buf, p, len);
+}
+
+void U2F_sha256Final(U2F_sha256Ctx* ctx, uint8_t digest[U2F_SHA256_SIZE]) {
+  uint8_t last[128];
+  int i;
+  compress(ctx->state, last, pad(ctx->buf, ctx->count, last));
+  for (i = 0; i < 8; ++i) store32(digest + 4 * i, ctx->state[i]);
+}
+
+void U2F_sha256(const void* data, size_t len,
+                uint8_t digest[U2F_SHA256_SIZE]) {
+  U2F_sha256Ctx ctx;
+  U2F_sha256Init(&ctx);
+  U2F_sha256Update(&ctx, data, len);
+  U2F_sha256Final(&ctx, digest);
+}
+
+void U2F_sha256Batch(const uint8_t* const* data, const size_t* len,
+                     size_t n, uint8_t* digests) {
+  size_t i = 0;
+#ifdef U2F_SHA256_X86
+  if (current() == AVX2) {
+    // A part-filled group costs as much as a full one.
+    for (; n - i >= LANES / 2; i += LANES) {
+      size_t m = n - i < LANES ? n - i : LANES;
+      batchAvx2(data + i, len + i, m, digests + U2F_SHA256_SIZE * i);
+      if (m < LANES) return;
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    U2F_sha256(data[i], len[i], digests + U2F_SHA256_SIZE * i);
+  }
+}
+
+const char* U2F_sha256Impl(void) {
+  return implNames[current()];
+}
+
+int U2F_sha256Use(const char* name) {
+  int i;
+  current();
+  for (i = PORTABLE; i <= SHANI; ++i) {
+    if ((have & (1 << i)) && !strcmp(name, implNames[i])) {
+      impl = i;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,56 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// SHA-256 for the registration and authentication digests.
+//
+// Uses the SHA extensions on CPUs that have them. CPUs without them but
+// with AVX2 hash batches eight messages at a time, one per 32-bit lane;
+// the rest use portable C. The choice is made at run time.
+
+#ifndef __U2F_SHA256_H_INCLUDED__
+#define __U2F_SHA256_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define U2F_SHA256_SIZE  32
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t count;  // bytes hashed so far
+  uint8_t buf[64];
+} U2F_sha256Ctx;
+
+void U2F_sha256Init(U2F_sha256Ctx* ctx);
+void U2F_sha256Update(U2F_sha256Ctx* ctx, const void* data, size_t len);
+void U2F_sha256Final(U2F_sha256Ctx* ctx, uint8_t digest[U2F_SHA256_SIZE]);
+
+// One-shot hash of |len| bytes at |data|.
+void U2F_sha256(const void* data, size_t len,
+                uint8_t digest[U2F_SHA256_SIZE]);
+
+// Hashes |n| messages, |len[i]| bytes at |data[i]|, into the
+// U2F_SHA256_SIZE bytes at digests + i * U2F_SHA256_SIZE.
+void U2F_sha256Batch(const uint8_t* const* data, const size_t* len,
+                     size_t n, uint8_t* digests);
+
+// Name of the code in use: "sha-ni", "avx2" (portable single messages,
+// 8-way batches) or "portable".
+const char* U2F_sha256Impl(void);
+
+// Switches to the named code, for benchmarks.
+// Returns 0 if this CPU or build does not have it.
+int U2F_sha256Use(const char* impl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __U2F_SHA256_H_INCLUDED__
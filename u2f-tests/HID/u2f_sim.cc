@@ -0,0 +1,350 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <deque>
+
+#include "u2f.h"
+#include "u2f_sim.h"
+
+#define SIM_CAPS  (CAPFLAG_WINK | CAPFLAG_LOCK)
+#define SIM_MAX_LOCK  10  // seconds
+
+struct U2Fsim {
+  // Partially received message, if busy.
+  bool busy;
+  uint32_t cid;
+  uint8_t cmd;
+  size_t len;
+  size_t got;
+  uint8_t seq;
+  double deadline;
+  uint8_t msg[U2FSIM_MAX_MSG];
+
+  // Channel holding LOCK, until lockUntil.
+  uint32_t lockCid;
+  double lockUntil;
+
+  uint32_t nextCid;
+
+  std::deque<U2FHID_FRAME> out;
+
+  uint16_t prevEdge;
+  uint8_t coverage[U2FSIM_COVERAGE_BITS / 8];
+};
+
+// Mark the branch at this line as taken, AFL style: the map bit is the
+// hash of the previous and the current branch.
+#define COVER(sim) cover(sim, __LINE__)
+
+static
+void cover(struct U2Fsim* sim, uint16_t line) {
+  uint16_t edge = (uint16_t) ((line * 2654435761u) >> 7);
+  uint16_t bit = (edge ^ sim->prevEdge) % U2FSIM_COVERAGE_BITS;
+  sim->coverage[bit / 8] |= 1 << (bit & 7);
+  sim->prevEdge = edge >> 1;
+}
+
+struct U2Fsim* U2Fsim_create() {
+  struct U2Fsim* sim = new U2Fsim;
+  sim->busy = false;
+  sim->lockCid = 0;
+  sim->lockUntil = 0;
+  sim->nextCid = 0x01000000 | (rand() & 0xffff);
+  sim->prevEdge = 0;
+  memset(sim->coverage, 0, sizeof(sim->coverage));
+  return sim;
+}
+
+void U2Fsim_destroy(struct U2Fsim* sim) {
+  delete sim;
+}
+
+static
+void reply(struct U2Fsim* sim, uint32_t cid, uint8_t cmd,
+           const uint8_t* data, size_t len) {
+  U2FHID_FRAME f;
+  size_t frameLen;
+  uint8_t seq = 0;
+
+  memset(&f, 0, sizeof(f));
+  f.cid = cid;
+  f.init.cmd = cmd;
+  f.init.bcnth = (uint8_t) (len >> 8);
+  f.init.bcntl = (uint8_t) len;
+  frameLen = len < sizeof(f.init.data) ? len : sizeof(f.init.data);
+  if (frameLen) memcpy(f.init.data, data, frameLen);
+  sim->out.push_back(f);
+
+  for (size_t off = frameLen; off < len; off += frameLen) {
+    memset(&f, 0, sizeof(f));
+    f.cid = cid;
+    f.cont.seq = seq++;
+    frameLen = len - off < sizeof(f.cont.data) ?
+        len - off : sizeof(f.cont.data);
+    memcpy(f.cont.data, data + off, frameLen);
+    sim->out.push_back(f);
+  }
+}
+
+static
+void error(struct U2Fsim* sim, uint32_t cid, uint8_t code) {
+  reply(sim, cid, U2FHID_ERROR, &code, 1);
+}
+
+// Minimal U2F application: answers VERSION, refuses everything else.
+static
+void apdu(struct U2Fsim* sim, uint32_t cid, const uint8_t* m, size_t len) {
+  static const uint8_t version[] = { 'U', '2', 'F', '_', 'V', '2', 0x90, 0 };
+  static const uint8_t badCla[] = { 0x6E, 0x00 };
+  static const uint8_t badIns[] = { 0x6D, 0x00 };
+  static const uint8_t badLen[] = { 0x67, 0x00 };
+
+  if (len < 4) {
+    COVER(sim);
+    reply(sim, cid, U2FHID_MSG, badLen, sizeof(badLen));
+  } else if (m[0] != 0) {
+    COVER(sim);
+    reply(sim, cid, U2FHID_MSG, badCla, sizeof(badCla));
+  } else if (m[1] != U2F_INS_VERSION) {
+    COVER(sim);
+    reply(sim, cid, U2FHID_MSG, badIns, sizeof(badIns));
+  } else if (len > 7) {
+    COVER(sim);
+    reply(sim, cid, U2FHID_MSG, badLen, sizeof(badLen));
+  } else {
+    COVER(sim);
+    reply(sim, cid, U2FHID_MSG, version, sizeof(version));
+  }
+}
+
+// Dispatch a completely received message.
+static
+void process(struct U2Fsim* sim, uint32_t cid, uint8_t cmd,
+             const uint8_t* m, size_t len, double now) {
+  switch (cmd) {
+    case U2FHID_INIT: {
+      if (len != INIT_NONCE_SIZE) {
+        COVER(sim);
+        error(sim, cid, ERR_INVALID_LEN);
+        return;
+      }
+      uint32_t newCid = cid;
+      if (cid == (uint32_t) CID_BROADCAST) {
+        COVER(sim);
+        newCid = sim->nextCid++;
+      }
+      uint8_t rsp[sizeof(U2FHID_INIT_RESP)];
+      memcpy(rsp, m, INIT_NONCE_SIZE);
+      rsp[8] = (uint8_t) (newCid >> 24);
+      rsp[9] = (uint8_t) (newCid >> 16);
+      rsp[10] = (uint8_t) (newCid >> 8);
+      rsp[11] = (uint8_t) newCid;
+      rsp[12] = U2FHID_IF_VERSION;
+      rsp[13] = 1;  // major
+      rsp[14] = 0;  // minor
+      rsp[15] = 0;  // build
+      rsp[16] = SIM_CAPS;
+      reply(sim, cid, U2FHID_INIT, rsp, sizeof(rsp));
+      return;
+    }
+    case U2FHID_PING:
+      COVER(sim);
+      reply(sim, cid, U2FHID_PING, m, len);
+      return;
+    case U2FHID_WINK:
+      if (len) {
+        COVER(sim);
+        error(sim, cid, ERR_INVALID_LEN);
+        return;
+      }
+      COVER(sim);
+      reply(sim, cid, U2FHID_WINK, NULL, 0);
+      return;
+    case U2FHID_LOCK:
+      if (len != 1 || m[0] > SIM_MAX_LOCK) {
+        COVER(sim);
+        error(sim, cid, ERR_INVALID_PAR);
+        return;
+      }
+      if (m[0]) {
+        COVER(sim);
+        sim->lockCid = cid;
+        sim->lockUntil = now + m[0];
+      } else {
+        COVER(sim);
+        sim->lockCid = 0;
+      }
+      reply(sim, cid, U2FHID_LOCK, NULL, 0);
+      return;
+    case U2FHID_MSG:
+      COVER(sim);
+      apdu(sim, cid, m, len);
+      return;
+    default:
+      COVER(sim);
+      error(sim, cid, ERR_INVALID_CMD);
+      return;
+  }
+}
+
+// Expire a pending message that did not complete in time.
+static
+void expire(struct U2Fsim* sim, double now) {
+  if (sim->busy && now >= sim->deadline) {
+    COVER(sim);
+    sim->busy = false;
+    error(sim, sim->cid, ERR_MSG_TIMEOUT);
+  }
+  if (sim->lockCid && now >= sim->lockUntil) {
+    COVER(sim);
+    sim->lockCid = 0;
+  }
+}
+
+static
+void writeInit(struct U2Fsim* sim, const U2FHID_FRAME* f, double now) {
+  uint32_t cid = f->cid;
+  uint8_t cmd = f->init.cmd;
+  size_t len = MSG_LEN(*f);
+
+  if (cid == (uint32_t) CID_BROADCAST && cmd != U2FHID_INIT) {
+    COVER(sim);
+    error(sim, cid, ERR_INVALID_CID);
+    return;
+  }
+
+  if (sim->lockCid && sim->lockCid != cid && cmd != U2FHID_INIT) {
+    COVER(sim);
+    error(sim, cid, ERR_CHANNEL_BUSY);
+    return;
+  }
+
+  if (sim->busy) {
+    if (sim->cid != cid) {
+      if (cmd != U2FHID_INIT) {
+        COVER(sim);
+        error(sim, cid, ERR_CHANNEL_BUSY);
+        return;
+      }
+      // INIT on another channel is answered without disturbing
+      // the pending message.
+      COVER(sim);
+    } else if (cmd == U2FHID_INIT) {
+      // INIT aborts our own pending message.
+      COVER(sim);
+      sim->busy = false;
+    } else {
+      COVER(sim);
+      sim->busy = false;
+      error(sim, cid, ERR_INVALID_SEQ);
+      return;
+    }
+  }
+
+  if (len > U2FSIM_MAX_MSG) {
+    COVER(sim);
+    error(sim, cid, ERR_INVALID_LEN);
+    return;
+  }
+
+  if (len <= sizeof(f->init.data)) {
+    COVER(sim);
+    process(sim, cid, cmd, f->init.data, len, now);
+    return;
+  }
+
+  if (cmd == U2FHID_INIT) {
+    // Too long to be an INIT, and INIT never blocks the device.
+    COVER(sim);
+    error(sim, cid, ERR_INVALID_LEN);
+    return;
+  }
+
+  COVER(sim);
+  sim->busy = true;
+  sim->cid = cid;
+  sim->cmd = cmd;
+  sim->len = len;
+  sim->got = sizeof(f->init.data);
+  sim->seq = 0;
+  sim->deadline = now + U2FSIM_MSG_TIMEOUT;
+  memcpy(sim->msg, f->init.data, sim->got);
+}
+
+static
+void writeCont(struct U2Fsim* sim, const U2FHID_FRAME* f, double now) {
+  if (!sim->busy || sim->cid != f->cid) {
+    // Spurious continuation; ignored.
+    COVER(sim);
+    return;
+  }
+
+  if (FRAME_SEQ(*f) != sim->seq) {
+    COVER(sim);
+    sim->busy = false;
+    error(sim, f->cid, ERR_INVALID_SEQ);
+    return;
+  }
+
+  size_t frameLen = sim->len - sim->got;
+  if (frameLen > sizeof(f->cont.data)) frameLen = sizeof(f->cont.data);
+  memcpy(sim->msg + sim->got, f->cont.data, frameLen);
+  sim->got += frameLen;
+  sim->seq++;
+  sim->deadline = now + U2FSIM_MSG_TIMEOUT;
+
+  if (sim->got == sim->len) {
+    COVER(sim);
+    sim->busy = false;
+    process(sim, sim->cid, sim->cmd, sim->msg, sim->len, now);
+  } else {
+    COVER(sim);
+  }
+}
+
+void U2Fsim_write(struct U2Fsim* sim, const U2FHID_FRAME* f, double now) {
+  expire(sim, now);
+
+  if (f->cid == 0) {
+    COVER(sim);
+    if (FRAME_TYPE(*f) == TYPE_INIT) error(sim, 0, ERR_INVALID_CID);
+    return;
+  }
+
+  if (FRAME_TYPE(*f) == TYPE_INIT) {
+    writeInit(sim, f, now);
+  } else {
+    writeCont(sim, f, now);
+  }
+}
+
+int U2Fsim_read(struct U2Fsim* sim, U2FHID_FRAME* f, double now) {
+  expire(sim, now);
+  if (sim->out.empty()) return -ERR_MSG_TIMEOUT;
+  *f = sim->out.front();
+  sim->out.pop_front();
+  return 0;
+}
+
+double U2Fsim_deadline(const struct U2Fsim* sim) {
+  return sim->busy ? sim->deadline : 0;
+}
+
+size_t U2Fsim_pending(const struct U2Fsim* sim) {
+  return sim->out.size();
+}
+
+const uint8_t* U2Fsim_coverage(const struct U2Fsim* sim) {
+  return sim->coverage;
+}
+
+void U2Fsim_clearCoverage(struct U2Fsim* sim) {
+  memset(sim->coverage, 0, sizeof(sim->coverage));
+  sim->prevEdge = 0;
+}
@@ -0,0 +1,58 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Software model of a U2FHID token's framing layer.
+// Used as a stand-in device (open path "sim") and as the reference
+// oracle for HIDFuzz.
+
+#ifndef __U2F_SIM_H_INCLUDED__
+#define __U2F_SIM_H_INCLUDED__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "u2f_hid.h"
+
+#define U2FSIM_PATH  "sim"
+
+// Bits in the coverage map, i.e. distinct (previous, current) branch
+// pairs the model can tell apart.
+#define U2FSIM_COVERAGE_BITS  4096
+
+// Largest message the model accepts: one INIT + 128 CONT frames.
+#define U2FSIM_MAX_MSG  (57 + 128 * 59)
+
+// Message timeout, seconds.
+#define U2FSIM_MSG_TIMEOUT  0.5
+
+struct U2Fsim;
+
+struct U2Fsim* U2Fsim_create();
+
+void U2Fsim_destroy(struct U2Fsim* sim);
+
+// Feeds a host to device frame, cid in host order.
+// |now| is a monotonic time in seconds, used for message timeouts
+// and LOCK expiry.
+void U2Fsim_write(struct U2Fsim* sim, const U2FHID_FRAME* f, double now);
+
+// Pops the next device to host frame, cid in host order.
+// Returns 0, or -ERR_MSG_TIMEOUT if none is queued at |now|.
+int U2Fsim_read(struct U2Fsim* sim, U2FHID_FRAME* f, double now);
+
+// Time at which the pending partial message times out, or 0 if none.
+double U2Fsim_deadline(const struct U2Fsim* sim);
+
+// Number of frames queued for the host.
+size_t U2Fsim_pending(const struct U2Fsim* sim);
+
+// Coverage map of the model's branches, U2FSIM_COVERAGE_BITS bits.
+// Cleared with U2Fsim_clearCoverage.
+const uint8_t* U2Fsim_coverage(const struct U2Fsim* sim);
+
+void U2Fsim_clearCoverage(struct U2Fsim* sim);
+
+#endif  // __U2F_SIM_H_INCLUDED__
@@ -0,0 +1,216 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <stdio.h>
+#include <string.h>
+
+#include "u2f_trust.h"
+#include "u2f.h"
+#include "u2f_asn1.h"
+#include "u2f_crypto.h"
+
+// Longest chain followed, counting the leaf.
+#define MAX_DEPTH  8
+
+namespace {
+
+// Hashes the TBSCertificate and decodes the signature of |cert|.
+// Returns false unless it is signed with ecdsa-with-SHA256.
+bool certSignature(const U2F_derCert& cert,
+                   p256_int* h, p256_int* r, p256_int* s) {
+  if (cert.certAlg.len != sizeof(U2F_ASN1_ECDSA_SHA256) ||
+      memcmp(cert.certAlg.data, U2F_ASN1_ECDSA_SHA256,
+             sizeof(U2F_ASN1_ECDSA_SHA256))) {
+    return false;
+  }
+  const U2F_crypto* crypto = U2F_cryptoBackend();
+  uint8_t digest[U2F_SHA256_SIZE];
+  crypto->sha256(cert.tbs.data, cert.tbs.len, digest);
+  p256_from_bin(digest, h);
+  return crypto->sigDecode(cert.certSig.data, cert.certSig.len, r, s);
+}
+
+std::string digestOf(const uint8_t* der, size_t len) {
+  uint8_t digest[U2F_SHA256_SIZE];
+  U2F_cryptoBackend()->sha256(der, len, digest);
+  return std::string(reinterpret_cast<char*>(digest), sizeof(digest));
+}
+
+int base64Value(char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+// Decodes base64, skipping white space, up to any '=' padding.
+bool base64Decode(const char* in, size_t len, std::string* out) {
+  unsigned int bits = 0;
+  int count = 0;
+  out->clear();
+  for (size_t i = 0; i < len && in[i] != '='; ++i) {
+    if (in[i] == ' ' || in[i] == '\t' || in[i] == '\r' || in[i] == '\n') {
+      continue;
+    }
+    int v = base64Value(in[i]);
+    if (v < 0) return false;
+    bits = (bits << 6) | v;
+    count += 6;
+    if (count >= 8) {
+      count -= 8;
+      out->push_back((char) (bits >> count));
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool verifyCertificate(const std::string& pk, const std::string& cert) {
+  if (pk.size() != P256_POINT_SIZE || pk[0] != UNCOMPRESSED_POINT) {
+    return false;
+  }
+  U2F_derCert parsed;
+  if (!U2F_derParseCert(reinterpret_cast<const uint8_t*>(cert.data()),
+                        cert.size(), &parsed)) {
+    return false;
+  }
+  p256_int h, r, s, x, y;
+  if (!certSignature(parsed, &h, &r, &s)) return false;
+  p256_from_bin(reinterpret_cast<const uint8_t*>(pk.data()) + 1, &x);
+  p256_from_bin(reinterpret_cast<const uint8_t*>(pk.data()) + 1 +
+                P256_SCALAR_SIZE, &y);
+  return U2F_cryptoBackend()->verify(&x, &y, &h, &r, &s) == 1;
+}
+
+bool U2F_trustStore::add(const uint8_t* der, size_t len, bool root) {
+  U2F_derCert parsed;
+  if (!U2F_derParseCert(der, len, &parsed)) return false;
+
+  // Keep a copy, with spans into it.
+  std::shared_ptr<Cert> cert(new Cert);
+  cert->der.assign(reinterpret_cast<const char*>(der), parsed.cert.len);
+  cert->root = root;
+  U2F_derParseCert(reinterpret_cast<const uint8_t*>(cert->der.data()),
+                   cert->der.size(), &cert->parsed);
+
+  const U2F_derSpan& subject = cert->parsed.subject;
+  bySubject_.insert(std::make_pair(
+      std::string(reinterpret_cast<const char*>(subject.data), subject.len),
+      std::shared_ptr<const Cert>(cert)));
+  if (root) roots_.insert(digestOf(der, cert->parsed.cert.len));
+
+  std::lock_guard<std::mutex> hold(lock_);
+  for (std::map<std::string, bool>::iterator it = cache_.begin();
+       it != cache_.end();) {
+    if (it->second) {
+      ++it;
+    } else {
+      cache_.erase(it++);
+    }
+  }
+  return true;
+}
+
+int U2F_trustStore::load(const char* path, bool root) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return -1;
+  std::string data;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.append(buf, n);
+  fclose(f);
+
+  static const char kBegin[] = "-----BEGIN CERTIFICATE-----";
+  static const char kEnd[] = "-----END CERTIFICATE-----";
+  if (data.find(kBegin) == std::string::npos) {
+    return add(reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+               root) ? 1 : -1;
+  }
+
+  int count = 0;
+  size_t begin = 0;
+  while ((begin = data.find(kBegin, begin)) != std::string::npos) {
+    begin += sizeof(kBegin) - 1;
+    size_t end = data.find(kEnd, begin);
+    if (end == std::string::npos) return -1;
+    std::string der;
+    if (!base64Decode(data.data() + begin, end - begin, &der) ||
+        !add(reinterpret_cast<const uint8_t*>(der.data()), der.size(),
+             root)) {
+      return -1;
+    }
+    ++count;
+    begin = end + sizeof(kEnd) - 1;
+  }
+  return count;
+}
+
+bool U2F_trustStore::verify(const uint8_t* der, size_t len) {
+  bool tooDeep = false;
+  return verify(der, len, 0, &tooDeep);
+}
+
+bool U2F_trustStore::verify(const uint8_t* der, size_t len, int depth,
+                            bool* tooDeep) {
+  std::string id = digestOf(der, len);
+  {
+    std::lock_guard<std::mutex> hold(lock_);
+    std::map<std::string, bool>::iterator it = cache_.find(id);
+    if (it != cache_.end()) {
+      ++hits_;
+      return it->second;
+    }
+    ++misses_;
+  }
+
+  bool ok = roots_.count(id) != 0;
+  bool deep = false;
+  if (!ok) {
+    U2F_derCert cert;
+    ok = U2F_derParseCert(der, len, &cert) && cert.cert.len == len &&
+         chains(cert, depth, &deep);
+  }
+  if (!ok && deep) {
+    *tooDeep = true;
+    return false;
+  }
+
+  // Two threads missing on the same certificate just check it twice.
+  std::lock_guard<std::mutex> hold(lock_);
+  if (cache_.size() >= capacity_) cache_.clear();
+  cache_[id] = ok;
+  return ok;
+}
+
+bool U2F_trustStore::chains(const U2F_derCert& cert, int depth,
+                            bool* tooDeep) {
+  if (depth >= MAX_DEPTH) {
+    *tooDeep = true;
+    return false;
+  }
+
+  p256_int h, r, s;
+  if (!certSignature(cert, &h, &r, &s)) return false;
+
+  typedef std::multimap<std::string,
+                        std::shared_ptr<const Cert> >::const_iterator Iter;
+  std::pair<Iter, Iter> issuers = bySubject_.equal_range(std::string(
+      reinterpret_cast<const char*>(cert.issuer.data), cert.issuer.len));
+  for (Iter it = issuers.first; it != issuers.second; ++it) {
+    const Cert& issuer = *it->second;
+    if (!issuer.parsed.pubKey.len) continue;
+    if (keys_.verify(issuer.parsed.pubKey.data, &h, &r, &s) != 1) continue;
+    if (issuer.root ||
+        verify(issuer.parsed.cert.data, issuer.parsed.cert.len, depth + 1,
+               tooDeep)) {
+      return true;
+    }
+  }
+  return false;
+}
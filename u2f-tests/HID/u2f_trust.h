@@ -0,0 +1,84 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Attestation certificate validation against a store of vendor roots.
+//
+// Results are cached by SHA-256 of the certificate, for leaves and
+// intermediates alike, so a batch attestation certificate shared by
+// many tokens has its chain checked once. Chains are followed by
+// issuer and subject Name bytes and must be ecdsa-with-SHA256 under
+// P-256 keys; validity periods and extensions are not checked.
+
+#ifndef __U2F_TRUST_H_INCLUDED__
+#define __U2F_TRUST_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "u2f_der.h"
+#include "u2f_keycache.h"
+
+// Returns true if DER certificate |cert| is signed with ecdsa-with-SHA256
+// by the 65 byte uncompressed P-256 point |pk|.
+bool verifyCertificate(const std::string& pk, const std::string& cert);
+
+// Up to |capacity| results are cached; the cache starts over when full.
+// Add certificates before verifying; verify() is then safe to call
+// from several threads.
+class U2F_trustStore {
+ public:
+  explicit U2F_trustStore(size_t capacity = 4096)
+      : capacity_(capacity), hits_(0), misses_(0) {}
+
+  // Adds a DER certificate as a trusted root, or as an intermediate
+  // that chains may pass through. Forgets cached failures.
+  // Returns false if it does not parse.
+  bool add(const uint8_t* der, size_t len, bool root);
+
+  // Adds the PEM certificates in |path|, or the one DER certificate
+  // if it holds no PEM.
+  // Returns the number added, or -1 if it cannot be read or a
+  // certificate in it does not parse.
+  int load(const char* path, bool root);
+
+  // Returns true if DER certificate |der| is a root or chains to one.
+  bool verify(const uint8_t* der, size_t len);
+
+  size_t roots() const { return roots_.size(); }
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+
+ private:
+  struct Cert {
+    std::string der;
+    U2F_derCert parsed;  // spans into der
+    bool root;
+  };
+
+  // |*tooDeep| is set if the result came from stopping at MAX_DEPTH;
+  // such failures are not cached, since a shorter path may succeed.
+  bool verify(const uint8_t* der, size_t len, int depth, bool* tooDeep);
+  bool chains(const U2F_derCert& cert, int depth, bool* tooDeep);
+
+  U2F_keyCache keys_;  // issuer keys
+  std::multimap<std::string, std::shared_ptr<const Cert> > bySubject_;
+  std::set<std::string> roots_;  // by digest
+
+  std::mutex lock_;
+  std::map<std::string, bool> cache_;  // by digest
+  size_t capacity_;
+  std::atomic<size_t> hits_;
+  std::atomic<size_t> misses_;
+};
+
+#endif  // __U2F_TRUST_H_INCLUDED__
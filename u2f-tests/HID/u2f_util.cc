@@ -4,6 +4,7 @@
 // license that can be found in the LICENSE file or at
 // https://developers.google.com/open-source/licenses/bsd
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -16,6 +17,11 @@
 #include <string>
 
 #include "u2f_util.h"
+#include "u2f_hex.h"
+#include "u2f_sim.h"
+
+// Simulated fobs pace frames like a 2ms bInterval full speed device.
+#define SIM_FRAME_INTERVAL_US  2000
 
 // This is a "library"; do not abort.
 #define AbortOrNot() \
@@ -49,16 +55,8 @@ void clock_gettime(int which, struct timespec* ts) {
 #endif  // __OS_MAC
 
 std::string b2a(const void* ptr, size_t size) {
-  const uint8_t* p = reinterpret_cast<const uint8_t*>(ptr);
-  std::string result;
-
-  for (size_t i = 0; i < 2 * size; ++i) {
-    int nib = p[i / 2];
-    if ((i & 1) == 0) nib >>= 4;
-    nib &= 15;
-    result.push_back("0123456789ABCDEF"[nib]);
-  }
-
+  std::string result(2 * size, 0);
+  if (size) U2F_hexEncode(ptr, size, &result[0]);
   return result;
 }
 
@@ -67,15 +65,9 @@ std::string b2a(const std::string& s) {
 }
 
 std::string a2b(const std::string& s) {
-  std::string result;
-  int v;
-  for (size_t i = 0; i < s.size(); ++i) {
-    if ((i & 1) == 1) v <<= 4; else v = 0;
-    char d = s[i];
-    if (d >= '0' && d <= '9') v += (d - '0');
-    else if (d >= 'A' && d <= 'F') v += (d - 'A' + 10);
-    else if (d >= 'a' && d <= 'f') v += (d - 'a' + 10);
-    if ((i & 1) == 1) result.push_back(v & 255);
+  std::string result(s.size() / 2, 0);
+  if (!result.empty()) {
+    U2F_hexDecode(s.data(), s.size(), reinterpret_cast<uint8_t*>(&result[0]));
   }
   return result;
 }
@@ -94,6 +86,128 @@ float U2Fob_deltaTime(uint64_t* state) {
   return (float) (delta / 1.0e9);
 }
 
+size_t U2F_apduEncode(uint8_t CLA, uint8_t INS, uint8_t P1, uint8_t P2,
+                      const void* data, size_t len,
+                      uint8_t* buf, size_t cap) {
+  if (len > 65535 || len + U2F_APDU_OVERHEAD > cap) return 0;
+
+  size_t offs = 0;
+  buf[offs++] = CLA;
+  buf[offs++] = INS;
+  buf[offs++] = P1;
+  buf[offs++] = P2;
+
+  // Encode lc.
+  if (len) {
+    buf[offs++] = 0;  // extended length
+    buf[offs++] = (len >> 8) & 255;
+    buf[offs++] = (len & 255);
+    memcpy(buf + offs, data, len);
+    offs += len;
+  }
+
+  // Encode le.
+  if (!len) {
+    // When there are no data sent, an extra 0 is necessary prior to Le.
+    buf[offs++] = 0;
+  }
+  buf[offs++] = 0;
+  buf[offs++] = 0;
+
+  return offs;
+}
+
+size_t U2F_frameEncode(uint32_t cid, uint8_t cmd,
+                       const void* data, size_t size,
+                       size_t index, U2FHID_FRAME* frame) {
+  const uint8_t* pData = (const uint8_t*) data;
+  uint8_t* payload;
+  size_t room, offs;
+
+  frame->cid = cid;
+  if (index == 0) {
+    frame->init.cmd = TYPE_INIT | cmd;
+    frame->init.bcnth = (size >> 8) & 255;
+    frame->init.bcntl = (size & 255);
+    payload = frame->init.data;
+    room = sizeof(frame->init.data);
+    offs = 0;
+  } else {
+    frame->cont.seq = (uint8_t) (index - 1);
+    payload = frame->cont.data;
+    room = sizeof(frame->cont.data);
+    offs = sizeof(frame->init.data) + (index - 1) * room;
+  }
+
+  size_t frameLen = offs < size ? min(size - offs, room) : 0;
+  memcpy(payload, pData + offs, frameLen);
+  memset(payload + frameLen, 0xEE, room - frameLen);
+  return frameLen;
+}
+
+void U2F_samples::add(float t) {
+  ++count_;
+  if (!capacity_ || samples_.size() < capacity_) {
+    samples_.push_back(t);
+    sorted_ = false;
+    return;
+  }
+  // Keep the new sample with probability capacity / count, in place of
+  // a random kept one; order does not matter for percentiles.
+  size_t j = (size_t) (random_() % count_);
+  if (j < capacity_) {
+    samples_[j] = t;
+    sorted_ = false;
+  }
+}
+
+void U2F_samples::clear() {
+  samples_.clear();
+  sorted_ = true;
+  count_ = 0;
+}
+
+void U2F_samples::sort() const {
+  if (!sorted_) {
+    std::sort(samples_.begin(), samples_.end());
+    sorted_ = true;
+  }
+}
+
+float U2F_samples::percentile(float p) const {
+  if (samples_.empty()) return 0;
+  sort();
+  size_t rank = (size_t) ceil(p * samples_.size());
+  if (rank < 1) rank = 1;
+  if (rank > samples_.size()) rank = samples_.size();
+  return samples_[rank - 1];
+}
+
+void U2F_samples::medianInterval(float* lo, float* hi) const {
+  *lo = *hi = 0;
+  if (samples_.empty()) return;
+  sort();
+
+  // Ranks n/2 -+ 1.96 * sqrt(n) / 2, normal approximation of Binomial(n, .5).
+  double n = samples_.size();
+  double half = 0.98 * sqrt(n);
+  long j = (long) floor(n / 2 - half);
+  long k = (long) ceil(n / 2 + 1 + half);
+  if (j < 1) j = 1;
+  if (k > (long) n) k = (long) n;
+
+  *lo = samples_[j - 1];
+  *hi = samples_[k - 1];
+}
+
+// Monotonic time in seconds.
+static
+double U2Fob_now() {
+  uint64_t t = 0;
+  U2Fob_deltaTime(&t);
+  return t / 1.0e9;
+}
+
 struct U2Fob* U2Fob_create() {
   struct U2Fob* f = NULL;
   if (hid_init() == 0) {
@@ -127,8 +241,7 @@ int U2Fob_open(struct U2Fob* device, const char* path) {
     device->path = NULL;
   }
   device->path = strdup(path);
-  device->dev = hid_open_path(device->path);
-  return device->dev != NULL ? -ERR_NONE : -ERR_OTHER;
+  return U2Fob_reopen(device);
 }
 
 void U2Fob_close(struct U2Fob* device) {
@@ -136,10 +249,18 @@ void U2Fob_close(struct U2Fob* device) {
     hid_close(device->dev);
     device->dev = NULL;
   }
+  if (device->sim) {
+    U2Fsim_destroy(device->sim);
+    device->sim = NULL;
+  }
 }
 
 int U2Fob_reopen(struct U2Fob* device) {
   U2Fob_close(device);
+  if (!strcmp(device->path, U2FSIM_PATH)) {
+    device->sim = U2Fsim_create();
+    return -ERR_NONE;
+  }
   device->dev = hid_open_path(device->path);
   return device->dev != NULL ? -ERR_NONE : -ERR_OTHER;
 }
@@ -157,15 +278,16 @@ void U2Fob_logFrame(struct U2Fob* device,
   if (device->logfp) {
     fprintf(device->logfp, "t+%.3f", U2Fob_deltaTime(&device->logtime));
     fprintf(device->logfp, "%s %08x:%02x", tag, f->cid, f->type);
+    char hex[2 * sizeof(f->cont.data) + 1];
     if (f->type & TYPE_INIT) {
       int len = f->init.bcnth * 256 + f->init.bcntl;
-      fprintf(device->logfp, "[%d]:", len);
-      for (size_t i = 0; i < sizeof(f->init.data); ++i)
-          fprintf(device->logfp, "%02X", f->init.data[i]);
+      U2F_hexEncode(f->init.data, sizeof(f->init.data), hex);
+      hex[2 * sizeof(f->init.data)] = 0;
+      fprintf(device->logfp, "[%d]:%s", len, hex);
     } else {
-      fprintf(device->logfp, ":");
-      for (size_t i = 0; i < sizeof(f->cont.data); ++i)
-          fprintf(device->logfp, "%02X", f->cont.data[i]);
+      U2F_hexEncode(f->cont.data, sizeof(f->cont.data), hex);
+      hex[2 * sizeof(f->cont.data)] = 0;
+      fprintf(device->logfp, ":%s", hex);
     }
     fprintf(device->logfp, "\n");
   }
@@ -180,6 +302,13 @@ int U2Fob_sendHidFrame(struct U2Fob* device, U2FHID_FRAME* f) {
   memcpy(d + 1, f, sizeof(U2FHID_FRAME));
   f->cid = ntohl(f->cid);
 
+  if (device->sim) {
+    usleep(SIM_FRAME_INTERVAL_US);
+    U2Fsim_write(device->sim, f, U2Fob_now());
+    U2Fob_logFrame(device, ">", f);
+    return 0;
+  }
+
   if (!device->dev) return -ERR_OTHER;
   res = hid_write(device->dev, d, sizeof(d));
 
@@ -195,6 +324,27 @@ int U2Fob_receiveHidFrame(struct U2Fob* device, U2FHID_FRAME* r, float to) {
   if (to <= 0.0)
       return -ERR_MSG_TIMEOUT;
 
+  if (device->sim) {
+    double now = U2Fob_now();
+    if (U2Fsim_read(device->sim, r, now) != 0) {
+      // Nothing queued; wait out the timeout, or until a pending
+      // message expires if that comes first.
+      double deadline = U2Fsim_deadline(device->sim);
+      double wait = (deadline && deadline < now + to) ? deadline - now : to;
+      if (wait > 0) usleep((unsigned int) (wait * 1e6));
+      if (U2Fsim_read(device->sim, r, U2Fob_now()) != 0) {
+        if (device->logfp) {
+          fprintf(device->logfp, "t+%.3f", U2Fob_deltaTime(&device->logtime));
+          fprintf(device->logfp, "< (timeout)\n");
+        }
+        return -ERR_MSG_TIMEOUT;
+      }
+    }
+    usleep(SIM_FRAME_INTERVAL_US);
+    U2Fob_logFrame(device, "<", r);
+    return 0;
+  }
+
   if (!device->dev) return -ERR_OTHER;
   memset((int8_t*)r, 0xEE, sizeof(U2FHID_FRAME));
   int res = hid_read_timeout(device->dev,
@@ -262,32 +412,13 @@ int U2Fob_init(struct U2Fob* device) {
 int U2Fob_send(struct U2Fob* device, uint8_t cmd,
                const void* data, size_t size) {
   U2FHID_FRAME frame;
-  int res;
-  size_t frameLen;
-  uint8_t seq = 0;
-  uint8_t* pData = (uint8_t*) data;
-
-  frame.cid = device->cid;
-  frame.init.cmd = TYPE_INIT | cmd;
-  frame.init.bcnth = (size >> 8) & 255;
-  frame.init.bcntl = (size & 255);
+  size_t sent = 0;
 
-  frameLen = min(size, sizeof(frame.init.data));
-  memset(frame.init.data, 0xEE, sizeof(frame.init.data));
-  memcpy(frame.init.data, pData, frameLen);
-
-  do {
-    res = U2Fob_sendHidFrame(device, &frame);
+  for (size_t index = 0; index == 0 || sent < size; ++index) {
+    sent += U2F_frameEncode(device->cid, cmd, data, size, index, &frame);
+    int res = U2Fob_sendHidFrame(device, &frame);
     if (res != 0) return res;
-
-    size -= frameLen;
-    pData += frameLen;
-
-    frame.cont.seq = seq++;
-    frameLen = min(size, sizeof(frame.cont.data));
-    memset(frame.cont.data, 0xEE, sizeof(frame.cont.data));
-    memcpy(frame.cont.data, pData, frameLen);
-  } while (size);
+  }
 
   return 0;
 }
@@ -376,133 +507,9 @@ int U2Fob_apdu(struct U2Fob* device,
                const std::string& out,
                std::string* in) {
   uint8_t buf[4096];
-  size_t nc = out.size() ? (3 + out.size()) : 0;
-
-  // Construct outgoing message.
-  memset(buf, 0xEE, sizeof(buf));
-  buf[0] = CLA;
-  buf[1] = INS;
-  buf[2] = P1;
-  buf[3] = P2;
-
-  uint8_t offs = 4;
-
-  // Encode lc.
-  if (nc) {
-    buf[offs++] = 0;  // extended length
-    buf[offs++] = (out.size() >> 8) & 255;
-    buf[offs++] = (out.size() & 255);
-    memcpy(buf + offs, out.data(), out.size());
-    offs += out.size();
-  }
-
-  // Encode le.
-  if (!nc) {
-    // When there are no data sent, an extra 0 is necessary prior to Le.
-    buf[offs++] = 0;
-  }
-  buf[offs++] = 0;
-  buf[offs++] = 0;
-
-  return U2Fob_exchange_apdu_buffer(device, buf, offs, in);
-}
-
-bool getCertificate(const U2F_REGISTER_RESP& rsp,
-                    std::string* cert) {
-  size_t hkLen = rsp.keyHandleLen;
-
-  CHECK_GE(hkLen, 64);
-  CHECK_LT(hkLen, sizeof(rsp.keyHandleCertSig));
-
-  size_t certOff = hkLen;
-  size_t certLen = sizeof(rsp.keyHandleCertSig) - certOff;
-  const uint8_t* p = &rsp.keyHandleCertSig[certOff];
-
-  CHECK_GE(certLen, 4);
-  CHECK_EQ(p[0], 0x30);
-
-  CHECK_GE(p[1], 0x81);
-  CHECK_LE(p[1], 0x82);
-
-  size_t seqLen;
-  size_t headerLen;
-  if (p[1] == 0x81) {
-    seqLen = p[2];
-    headerLen = 3;
-  } else if (p[1] == 0x82) {
-    seqLen = p[2] * 256 + p[3];
-    headerLen = 4;
-  } else {
-    // FAIL
-    AbortOrNot();
-  }
-
-  CHECK_LE(seqLen, certLen - headerLen);
-
-  cert->assign(reinterpret_cast<const char*>(p), seqLen + headerLen);
-  return true;
-}
-
-bool getSignature(const U2F_REGISTER_RESP& rsp,
-                  std::string* sig) {
-  std::string cert;
-  CHECK_NE(false, getCertificate(rsp, &cert));
-
-  size_t sigOff = rsp.keyHandleLen + cert.size();
-  CHECK_LE(sigOff, sizeof(rsp.keyHandleCertSig));
-
-  size_t sigLen = sizeof(rsp.keyHandleCertSig) - sigOff;
-  const uint8_t* p = &rsp.keyHandleCertSig[sigOff];
-
-  CHECK_GE(sigLen, 2);
-  CHECK_EQ(p[0], 0x30);
-
-  size_t seqLen = p[1];
-  CHECK_LE(seqLen, sigLen - 2);
-
-  sig->assign(reinterpret_cast<const char*>(p), seqLen + 2);
-  return true;
-}
-
-bool getSubjectPublicKey(const std::string& cert,
-                         std::string* pk) {
-  CHECK_GE(cert.size(), P256_POINT_SIZE);
-
-  // Explicitly search for asn1 lead-in sequence of p256-ecdsa public key.
-  const char asn1[] = "3059301306072A8648CE3D020106082A8648CE3D030107034200";
-  std::string pkStart(a2b(asn1));
-
-  size_t off = cert.find(pkStart);
-  CHECK_NE(off, std::string::npos);
-
-  off += pkStart.size();
-  CHECK_LE(off, cert.size() - P256_POINT_SIZE);
-
-  pk->assign(cert, off, P256_POINT_SIZE);
-  return true;
-}
-
-bool getCertSignature(const std::string& cert,
-                      std::string* sig) {
-  // Explicitly search asn1 lead-in sequence of p256-ecdsa signature.
-  const char asn1[] = "300A06082A8648CE3D04030203";
-  std::string sigStart(a2b(asn1));
-
-  size_t off = cert.find(sigStart);
-  CHECK_NE(off, std::string::npos);
-
-  off += sigStart.size();
-  CHECK_LE(off, cert.size() - 8);
-
-  size_t bitStringLen = cert[off] & 255;
-  CHECK_EQ(bitStringLen, cert.size() - off - 1);
-  CHECK_EQ(cert[off + 1], 0);
-
-  sig->assign(cert, off + 2, cert.size() - off - 2);
-  return true;
-}
+  size_t len = U2F_apduEncode(CLA, INS, P1, P2, out.data(), out.size(),
+                              buf, sizeof(buf));
+  if (!len) return -ERR_INVALID_LEN;
 
-bool verifyCertificate(const std::string& pk,
-                       const std::string& cert) {
-  CHECK_EQ(true, false);  // not yet implemented
+  return U2Fob_exchange_apdu_buffer(device, buf, len, in);
 }
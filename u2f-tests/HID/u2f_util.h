@@ -12,8 +12,11 @@
 #include <stdarg.h>
 #include <time.h>
 
+#include <algorithm>
 #include <string>
 #include <iostream>
+#include <random>
+#include <vector>
 
 #include "u2f.h"
 #include "u2f_hid.h"
@@ -70,8 +73,61 @@ std::string a2b(const std::string& s);
 
 float U2Fob_deltaTime(uint64_t* state);
 
+// Most an extended length APDU adds to its data: header, Lc and Le.
+#define U2F_APDU_OVERHEAD  (4 + 3 + 2)
+
+// Formats an extended length APDU with |len| bytes of |data| and Le of
+// 65536 into |buf|.
+// Returns its length, or 0 if it does not fit in |cap| bytes.
+size_t U2F_apduEncode(uint8_t CLA, uint8_t INS, uint8_t P1, uint8_t P2,
+                      const void* data, size_t len,
+                      uint8_t* buf, size_t cap);
+
+// Fills |frame| with frame |index| (0 for the init frame) of the
+// |size| byte message |data| for |cmd| on channel |cid|, padded with
+// 0xEE.
+// Returns the number of message bytes in it.
+size_t U2F_frameEncode(uint32_t cid, uint8_t cmd,
+                       const void* data, size_t size,
+                       size_t index, U2FHID_FRAME* frame);
+
+// Collects elapsed time samples, in seconds, for order statistics.
+class U2F_samples {
+ public:
+  U2F_samples() : sorted_(true), capacity_(0), count_(0) {}
+
+  // Keeps at most |capacity| samples, a uniform random subset of all
+  // those added (reservoir sampling), so that long runs take bounded
+  // memory; percentiles are then estimates. 0, the default, keeps all.
+  void limit(size_t capacity) { capacity_ = capacity; }
+
+  void add(float t);
+  void clear();
+  // Samples added, whether kept or not.
+  size_t size() const { return count_; }
+
+  // Nearest-rank p-quantile, 0 <= p <= 1. Returns 0 when empty.
+  float percentile(float p) const;
+
+  // Distribution-free ~95% confidence interval of the median,
+  // from the binomial order statistics around n/2.
+  void medianInterval(float* lo, float* hi) const;
+
+ private:
+  void sort() const;
+
+  mutable std::vector<float> samples_;
+  mutable bool sorted_;
+  size_t capacity_;
+  size_t count_;
+  std::mt19937_64 random_;
+};
+
+struct U2Fsim;
+
 struct U2Fob {
   hid_device* dev;
+  struct U2Fsim* sim;  // simulated fob, when opened as U2FSIM_PATH
   char* path;
   uint32_t cid;
   int loglevel;
@@ -128,19 +184,4 @@ int U2Fob_apdu(struct U2Fob* device,
                const std::string& out,
                std::string* in);
 
-bool getCertificate(const U2F_REGISTER_RESP& rsp,
-                    std::string* cert);
-
-bool getSignature(const U2F_REGISTER_RESP& rsp,
-                  std::string* sig);
-
-bool getSubjectPublicKey(const std::string& cert,
-                         std::string* pk);
-
-bool getCertSignature(const std::string& cert,
-                      std::string* sig);
-
-bool verifyCertificate(const std::string& pk,
-                       const std::string& cert);
-
 #endif  // __U2F_UTIL_H_INCLUDED__
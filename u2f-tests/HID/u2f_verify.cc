@@ -0,0 +1,98 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <string.h>
+
+#include "u2f_verify.h"
+#include "u2f.h"
+#include "u2f_crypto.h"
+
+// Reserved byte, user key and key handle length.
+#define REGISTER_HEADER_SIZE  (1 + P256_POINT_SIZE + 1)
+
+bool U2F_parseRegister(const uint8_t* rsp, size_t len,
+                       U2F_derSpan* userKey, U2F_derRegister* parts) {
+  if (len < REGISTER_HEADER_SIZE || rsp[0] != U2F_REGISTER_ID ||
+      rsp[1] != UNCOMPRESSED_POINT) {
+    return false;
+  }
+  userKey->data = rsp + 1;
+  userKey->len = P256_POINT_SIZE;
+  return U2F_derParseRegister(rsp + REGISTER_HEADER_SIZE,
+                              len - REGISTER_HEADER_SIZE,
+                              rsp[REGISTER_HEADER_SIZE - 1], parts) == 1;
+}
+
+void U2F_registerDigest(const uint8_t* appId, const uint8_t* challenge,
+                        const uint8_t* keyHandle, uint8_t keyHandleLen,
+                        const uint8_t* userKey,
+                        uint8_t digest[U2F_SHA256_SIZE]) {
+  // At most 385 bytes, so build it on the stack and hash it in one go.
+  uint8_t msg[1 + U2F_APPID_SIZE + U2F_NONCE_SIZE + 255 + P256_POINT_SIZE];
+  uint8_t* p = msg;
+  *p++ = U2F_REGISTER_HASH_ID;
+  memcpy(p, appId, U2F_APPID_SIZE);
+  p += U2F_APPID_SIZE;
+  memcpy(p, challenge, U2F_NONCE_SIZE);
+  p += U2F_NONCE_SIZE;
+  memcpy(p, keyHandle, keyHandleLen);
+  p += keyHandleLen;
+  memcpy(p, userKey, P256_POINT_SIZE);
+  p += P256_POINT_SIZE;
+  U2F_cryptoBackend()->sha256(msg, p - msg, digest);
+}
+
+void U2F_authenticateDigest(const uint8_t* appId, const uint8_t* header,
+                            const uint8_t* challenge,
+                            uint8_t digest[U2F_SHA256_SIZE]) {
+  uint8_t msg[U2F_APPID_SIZE + U2F_AUTH_HEADER_SIZE + U2F_NONCE_SIZE];
+  memcpy(msg, appId, U2F_APPID_SIZE);
+  memcpy(msg + U2F_APPID_SIZE, header, U2F_AUTH_HEADER_SIZE);
+  memcpy(msg + U2F_APPID_SIZE + U2F_AUTH_HEADER_SIZE, challenge,
+         U2F_NONCE_SIZE);
+  U2F_cryptoBackend()->sha256(msg, sizeof(msg), digest);
+}
+
+int U2F_verifySignature(const uint8_t* pk,
+                        const uint8_t digest[U2F_SHA256_SIZE],
+                        const uint8_t* sig, size_t len, U2F_keyCache* keys) {
+  const U2F_crypto* crypto = U2F_cryptoBackend();
+  p256_int h, r, s;
+  if (!crypto->sigDecode(sig, len, &r, &s)) return -1;
+  p256_from_bin(digest, &h);
+  if (keys) return keys->verify(pk, &h, &r, &s);
+
+  if (pk[0] != UNCOMPRESSED_POINT) return 0;
+  p256_int x, y;
+  p256_from_bin(pk + 1, &x);
+  p256_from_bin(pk + 1 + P256_SCALAR_SIZE, &y);
+  return crypto->verify(&x, &y, &h, &r, &s);
+}
+
+int U2F_verifyRegister(const uint8_t* appId, const uint8_t* challenge,
+                       const U2F_derSpan& userKey,
+                       const U2F_derRegister& parts, U2F_keyCache* keys) {
+  if (userKey.len != P256_POINT_SIZE || parts.keyHandle.len > 255 ||
+      parts.pubKey.len != P256_POINT_SIZE) {
+    return -1;
+  }
+  uint8_t digest[U2F_SHA256_SIZE];
+  U2F_registerDigest(appId, challenge, parts.keyHandle.data,
+                     (uint8_t) parts.keyHandle.len, userKey.data, digest);
+  return U2F_verifySignature(parts.pubKey.data, digest, parts.sig.data,
+                             parts.sig.len, keys);
+}
+
+int U2F_verifyAuthenticate(const uint8_t* userKey, const uint8_t* appId,
+                           const uint8_t* challenge,
+                           const uint8_t* rsp, size_t len,
+                           U2F_keyCache* keys) {
+  if (len <= U2F_AUTH_HEADER_SIZE) return -1;
+  uint8_t digest[U2F_SHA256_SIZE];
+  U2F_authenticateDigest(appId, rsp, challenge, digest);
+  return U2F_verifySignature(userKey, digest, rsp + U2F_AUTH_HEADER_SIZE,
+                             len - U2F_AUTH_HEADER_SIZE, keys);
+}
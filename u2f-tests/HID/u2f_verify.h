@@ -0,0 +1,71 @@
+// Copyright 2014 Google Inc. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Verification of U2F registration and authentication responses, shared
+// by the HID, NFC and BLE tests. Works on the raw response bytes, so it
+// does not depend on any transport's message structs, and copies
+// nothing but the few bytes it hashes.
+//
+// Verifiers return 1 if the signature is good, 0 if it is not and -1 if
+// the response or signature is malformed.
+
+#ifndef __U2F_VERIFY_H_INCLUDED__
+#define __U2F_VERIFY_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "u2f_der.h"
+#include "u2f_keycache.h"
+#include "u2f_sha256.h"
+
+// Flags and counter at the front of an authentication response.
+#define U2F_AUTH_HEADER_SIZE  (1 + 4)
+
+// Splits the |len| byte registration response |rsp|: reserved byte 0x05,
+// user public key, key handle length, key handle, attestation
+// certificate and signature. |userKey| gets the 65 byte point.
+// Key handle length limits are left to the caller.
+// Returns false if it is malformed or out of bounds.
+bool U2F_parseRegister(const uint8_t* rsp, size_t len,
+                       U2F_derSpan* userKey, U2F_derRegister* parts);
+
+// What a token signs to register: 0x00, the 32 byte application
+// parameter, the 32 byte challenge, the key handle and the 65 byte user
+// public key.
+void U2F_registerDigest(const uint8_t* appId, const uint8_t* challenge,
+                        const uint8_t* keyHandle, uint8_t keyHandleLen,
+                        const uint8_t* userKey,
+                        uint8_t digest[U2F_SHA256_SIZE]);
+
+// What a token signs to authenticate: the application parameter, the
+// flags and counter as sent, and the challenge.
+void U2F_authenticateDigest(const uint8_t* appId, const uint8_t* header,
+                            const uint8_t* challenge,
+                            uint8_t digest[U2F_SHA256_SIZE]);
+
+// Verifies DER signature |sig| over |digest| under the 65 byte point
+// |pk|, with the crypto backend in use. |keys| (may be NULL) caches the
+// decoded key.
+int U2F_verifySignature(const uint8_t* pk,
+                        const uint8_t digest[U2F_SHA256_SIZE],
+                        const uint8_t* sig, size_t len, U2F_keyCache* keys);
+
+// Verifies the registration signature in |parts| under the attestation
+// key. Batch attestation keys repeat across tokens, so are worth
+// caching.
+int U2F_verifyRegister(const uint8_t* appId, const uint8_t* challenge,
+                       const U2F_derSpan& userKey,
+                       const U2F_derRegister& parts, U2F_keyCache* keys);
+
+// Verifies the |len| byte authentication response |rsp|, flags and
+// counter then signature, under the 65 byte point |userKey|.
+int U2F_verifyAuthenticate(const uint8_t* userKey, const uint8_t* appId,
+                           const uint8_t* challenge,
+                           const uint8_t* rsp, size_t len,
+                           U2F_keyCache* keys);
+
+#endif  // __U2F_VERIFY_H_INCLUDED__
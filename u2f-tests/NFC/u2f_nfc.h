@@ -21,7 +21,8 @@
 #define DATA_NON_EXTENDED 5
 #define DATA_EXTENDED 7
 
-typedef enum {SHORT_APDU, EXTENDED_APDU} cmd_apdu_type;
+// AUTO_APDU: whichever of the two takes fewest round trips; see xchgAPDU.
+typedef enum {SHORT_APDU, EXTENDED_APDU, AUTO_APDU} cmd_apdu_type;
 
 #ifndef __NO_PRAGMA_PACK
 #pragma pack(push, 1)
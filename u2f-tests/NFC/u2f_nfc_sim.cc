@@ -0,0 +1,352 @@
+// Based on code from Google & Yubico.
+
+// U2F applet emulator; see u2f_nfc_sim.h.
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+
+// Ahead of u2f.h, whose min and max macros break the standard headers.
+#include "../HID/u2f_asn1.h"
+#include "../HID/u2f_crypto.h"
+#include "../HID/u2f_p256.h"
+#include "u2f.h"
+#include "u2f_nfc_crypto.h"
+#include "u2f_nfc.h"
+#include "u2f_nfc_sim.h"
+
+#define SIM_KH_SIZE  64  // key handles the emulator hands out
+#define SIM_UID_SIZE  7  // a double size ISO 14443-A UID
+
+U2FNFC_simConfig simConfig = { 0, 256, 65535 };
+
+// A registered key and the application it is for.
+struct SimKey {
+  p256_int d;
+  std::string appId;
+};
+
+struct U2FNFC_sim {
+  U2FNFC_simConfig config;
+  std::mt19937_64 rng;
+  bool selected;  // the U2F applet
+  bool chaining;  // a CLA 0x10 chain is open
+  uint8_t chainIns;
+  std::string chain;  // command data of the chain so far
+  std::string pending;  // response data left for GET RESPONSE
+  uint32_t counter;
+  std::map<std::string, SimKey> keys;  // by key handle
+  p256_int attestation;
+  std::string cert;  // self-signed, for |attestation|
+  uint8_t uid[SIM_UID_SIZE];
+};
+
+static
+std::string randomBytes(U2FNFC_sim *sim, size_t n) {
+  std::string b(n, 0);
+  for (size_t i = 0; i < n; ++i) b[i] = (char) sim->rng();
+  return b;
+}
+
+// Random scalar below 2^255, so below n.
+static
+void randomScalar(U2FNFC_sim *sim, p256_int *k) {
+  std::string b = randomBytes(sim, U2F_EC_KEY_SIZE);
+  b[0] &= 0x7f;
+  p256_from_bin((const uint8_t *) b.data(), k);
+}
+
+// The public key of |d| as an uncompressed point.
+static
+std::string pointOf(const p256_int *d) {
+  p256_int zero = P256_ZERO, x, y;
+  uint8_t point[U2F_EC_POINT_SIZE];
+  U2F_p256PointsMul(d, &zero, NULL, NULL, &x, &y);
+  point[0] = U2F_POINT_UNCOMPRESSED;
+  p256_to_bin(&x, point + 1);
+  p256_to_bin(&y, point + 1 + U2F_EC_KEY_SIZE);
+  return std::string((const char *) point, sizeof(point));
+}
+
+// DER INTEGER holding |a|.
+static
+std::string derInteger(const p256_int *a) {
+  uint8_t b[U2F_EC_KEY_SIZE];
+  p256_to_bin(a, b);
+  size_t i = 0;
+  while (i < sizeof(b) - 1 && !b[i]) ++i;
+  std::string v((char *) b + i, sizeof(b) - i);
+  if (v[0] & 0x80) v.insert(v.begin(), 0);  // keep it positive
+  return std::string(1, 0x02) + std::string(1, (char) v.size()) + v;
+}
+
+// DER element |tag| around |body|.
+static
+std::string derElement(uint8_t tag, const std::string& body) {
+  std::string e(1, (char) tag);
+  if (body.size() < 0x80) {
+    e += (char) body.size();
+  } else if (body.size() < 0x100) {
+    e += (char) 0x81;
+    e += (char) body.size();
+  } else {
+    e += (char) 0x82;
+    e += (char) (body.size() >> 8);
+    e += (char) body.size();
+  }
+  return e + body;
+}
+
+// DER signature of |message| under |d|, the textbook way: for random k,
+// (r, s) = (x(kG), (h + r d) / k). Not constant time; it is a test card.
+static
+std::string sign(U2FNFC_sim *sim, const p256_int *d,
+                 const std::string& message) {
+  uint8_t digest[U2F_SHA256_SIZE];
+  U2F_cryptoBackend()->sha256(message.data(), message.size(), digest);
+  p256_int h, k, r, s, y, zero = P256_ZERO, inv, rd, sum;
+  p256_from_bin(digest, &h);
+  do {
+    randomScalar(sim, &k);
+    U2F_p256PointsMul(&k, &zero, NULL, NULL, &r, &y);
+  } while (p256_cmp(&r, &SECP256r1_n) >= 0);
+
+  p256_modinv_vartime(&SECP256r1_n, &k, &inv);
+  p256_modmul(&SECP256r1_n, &r, 0, d, &rd);
+  int carry = p256_add(&h, &rd, &sum);
+  p256_modmul(&SECP256r1_n, &inv, carry, &sum, &s);
+  return derElement(0x30, derInteger(&r) + derInteger(&s));
+}
+
+U2FNFC_sim *U2FNFC_simCreate(const U2FNFC_simConfig *config) {
+  U2FNFC_sim *sim = new U2FNFC_sim;
+  sim->config = *config;
+  if (sim->config.block < 1 || sim->config.block > 256) {
+    sim->config.block = 256;
+  }
+  if (sim->config.extended > 65535) sim->config.extended = 65535;
+  sim->rng.seed(std::random_device()());
+  sim->selected = false;
+  sim->chaining = false;
+  sim->chainIns = 0;
+  sim->counter = 0;
+
+  // The minimalist self-signed attestation certificate.
+  randomScalar(sim, &sim->attestation);
+  std::string tbs((const char *) U2F_ASN1_SELF_SIGNED_TBS_PREFIX,
+                  sizeof(U2F_ASN1_SELF_SIGNED_TBS_PREFIX));
+  tbs += pointOf(&sim->attestation);
+  std::string alg((const char *) U2F_ASN1_ECDSA_SHA256,
+                  sizeof(U2F_ASN1_ECDSA_SHA256));
+  sim->cert = derElement(0x30, tbs + alg + derElement(0x03,
+      std::string(1, 0) + sign(sim, &sim->attestation, tbs)));
+
+  std::string uid = randomBytes(sim, sizeof(sim->uid));
+  memcpy(sim->uid, uid.data(), sizeof(sim->uid));
+  return sim;
+}
+
+void U2FNFC_simDestroy(U2FNFC_sim *sim) {
+  delete sim;
+}
+
+static
+uint16_t registerKey(U2FNFC_sim *sim, const std::string& data,
+                     std::string *out) {
+  if (data.size() != U2F_NONCE_SIZE + U2F_APPID_SIZE) return 0x6700;
+  std::string challenge = data.substr(0, U2F_NONCE_SIZE);
+  std::string appId = data.substr(U2F_NONCE_SIZE, U2F_APPID_SIZE);
+
+  SimKey key;
+  randomScalar(sim, &key.d);
+  key.appId = appId;
+  std::string handle = randomBytes(sim, SIM_KH_SIZE);
+  sim->keys[handle] = key;
+
+  std::string point = pointOf(&key.d);
+  std::string signedData = std::string(1, U2F_REGISTER_HASH_ID) + appId +
+      challenge + handle + point;
+  *out = std::string(1, U2F_REGISTER_ID) + point +
+      std::string(1, (char) handle.size()) + handle + sim->cert +
+      sign(sim, &sim->attestation, signedData);
+  return SW_NO_ERROR;
+}
+
+static
+uint16_t authenticate(U2FNFC_sim *sim, uint8_t p1, const std::string& data,
+                      std::string *out) {
+  const size_t header = U2F_NONCE_SIZE + U2F_APPID_SIZE + 1;
+  if (data.size() < header ||
+      data.size() != header + (uint8_t) data[header - 1]) {
+    return 0x6700;
+  }
+  std::string challenge = data.substr(0, U2F_NONCE_SIZE);
+  std::string appId = data.substr(U2F_NONCE_SIZE, U2F_APPID_SIZE);
+  std::map<std::string, SimKey>::const_iterator key =
+      sim->keys.find(data.substr(header));
+  if (key == sim->keys.end() || key->second.appId != appId) return 0x6a80;
+
+  // The user is always present.
+  uint8_t flags;
+  switch (p1) {
+    case U2F_AUTH_CHECK_ONLY: return 0x6985;
+    case U2F_AUTH_ENFORCE: flags = U2F_TOUCHED; break;
+    case 0x08: flags = 0; break;  // don't enforce user presence
+    default: return 0x6a80;
+  }
+
+  ++sim->counter;
+  std::string ctr(4, 0);
+  for (int i = 0; i < 4; ++i) ctr[i] = (char) (sim->counter >> (24 - 8 * i));
+  *out = std::string(1, (char) flags) + ctr;
+  *out += sign(sim, &key->second.d, appId + *out + challenge);
+  return SW_NO_ERROR;
+}
+
+// Runs the command, once chaining is done with. Returns the status word,
+// with the response data in |out|.
+static
+uint16_t process(U2FNFC_sim *sim, uint8_t cla, uint8_t ins, uint8_t p1,
+                 uint8_t p2, const std::string& data, std::string *out) {
+  static const uint8_t aid[U2F_APPLET_AID_LEN] = U2F_APPLET_AID;
+  static const char version[U2F_VERSION_LEN] = U2F_VERSION;
+
+  // PC/SC GET DATA, which the reader answers for the card.
+  if (cla == 0xff && ins == 0xca) {
+    if (p1 != 0 || p2 != 0) return 0x6a81;
+    out->assign((const char *) sim->uid, sizeof(sim->uid));
+    return SW_NO_ERROR;
+  }
+  if (cla != 0) return 0x6e00;
+
+  if (ins == 0xa4) {  // SELECT by AID
+    if (p1 != 0x04) return 0x6a86;
+    sim->selected = data.size() == sizeof(aid) &&
+        !memcmp(data.data(), aid, sizeof(aid));
+    if (!sim->selected) return 0x6a82;
+    out->assign(version, sizeof(version));
+    return SW_NO_ERROR;
+  }
+  if (!sim->selected) return 0x6d00;
+
+  switch (ins) {
+    case U2F_INS_REGISTER:
+      return registerKey(sim, data, out);
+    case U2F_INS_AUTHENTICATE:
+      return authenticate(sim, p1, data, out);
+    case 0x03:  // VERSION
+      if (!data.empty()) return 0x6700;
+      out->assign(version, sizeof(version));
+      return SW_NO_ERROR;
+  }
+  return 0x6d00;
+}
+
+// As much of |sim->pending| as |ne| allows, with 9000 or 61xx after it.
+static
+std::string respond(U2FNFC_sim *sim, size_t ne) {
+  size_t n = sim->pending.size() < ne ? sim->pending.size() : ne;
+  std::string r = sim->pending.substr(0, n);
+  sim->pending.erase(0, n);
+  if (sim->pending.empty()) {
+    r += (char) 0x90;
+    r += (char) 0x00;
+  } else {
+    r += (char) 0x61;
+    r += (char) (sim->pending.size() < 256 ? sim->pending.size() : 0);
+  }
+  return r;
+}
+
+static
+std::string statusWord(uint16_t sw) {
+  return std::string(1, (char) (sw >> 8)) + std::string(1, (char) sw);
+}
+
+// One exchange: decodes the command APDU's case (ISO 7816-4, 5.1) and
+// handles chaining and GET RESPONSE around process().
+static
+std::string exchange(U2FNFC_sim *sim, const uint8_t *capdu, size_t len) {
+  if (len < 4) return statusWord(0x6700);
+  uint8_t cla = capdu[CLA], ins = capdu[INS];
+  uint8_t p1 = capdu[P1], p2 = capdu[P2];
+
+  size_t nc = 0, ne = 0, offset = 0;
+  bool extended = false;
+  if (len == 5) {
+    ne = capdu[LC] ? capdu[LC] : 256;
+  } else if (len > 5 && capdu[LC]) {
+    nc = capdu[LC];
+    offset = DATA_NON_EXTENDED;
+    if (len == 6 + nc) {
+      ne = capdu[len - 1] ? capdu[len - 1] : 256;
+    } else if (len != 5 + nc) {
+      return statusWord(0x6700);
+    }
+  } else if (len > 5) {
+    extended = true;
+    size_t n = (capdu[5] << 8) | capdu[6];
+    if (len == 7) {
+      ne = n ? n : 65536;
+    } else if (len == 7 + n || len == 9 + n) {
+      nc = n;
+      offset = DATA_EXTENDED;
+      if (len == 9 + n) {
+        ne = (capdu[len - 2] << 8) | capdu[len - 1];
+        if (!ne) ne = 65536;
+      }
+    } else {
+      return statusWord(0x6700);
+    }
+  }
+
+  size_t limit = extended ? sim->config.extended : sim->config.block;
+  if ((extended && !limit) || nc > limit) return statusWord(0x6700);
+  if (ne > limit) ne = limit;
+
+  if (cla == 0 && ins == 0xc0) {  // GET RESPONSE
+    if (sim->pending.empty()) return statusWord(0x6985);
+    return respond(sim, ne);
+  }
+  sim->pending.clear();
+
+  std::string data((const char *) capdu + offset, nc);
+  if ((cla & 0x10) && cla != 0xff) {
+    if (!sim->chaining || sim->chainIns != ins) sim->chain.clear();
+    sim->chaining = true;
+    sim->chainIns = ins;
+    if (sim->chain.size() + nc > 65535) {
+      sim->chaining = false;
+      return statusWord(0x6700);
+    }
+    sim->chain += data;
+    return statusWord(SW_NO_ERROR);
+  }
+  if (sim->chaining) {
+    sim->chaining = false;
+    if (sim->chainIns != ins) return statusWord(0x6883);
+    data = sim->chain + data;
+  }
+
+  std::string out;
+  uint16_t sw = process(sim, cla, ins, p1, p2, data, &out);
+  if (sw != SW_NO_ERROR) return statusWord(sw);
+  sim->pending = out;
+  return respond(sim, ne);
+}
+
+int U2FNFC_simTransmit(U2FNFC_sim *sim, const uint8_t *capdu,
+                       unsigned long len, uint8_t *rapdu,
+                       unsigned long *rlen) {
+  if (sim->config.latencyMs > 0) {
+    std::this_thread::sleep_for(
+        std::chrono::duration<double, std::milli>(sim->config.latencyMs));
+  }
+  std::string r = exchange(sim, capdu, len);
+  if (r.size() > *rlen) return 0;
+  memcpy(rapdu, r.data(), r.size());
+  *rlen = (unsigned long) r.size();
+  return 1;
+}
@@ -0,0 +1,51 @@
+// Based on code from Google & Yubico.
+
+// Software stand-in for a reader with a U2F card on it: a U2F applet
+// behind the same transmit call as SCardTransmit, so the test runs
+// without readers. Open reader U2FNFC_SIM_READER to use it.
+
+#ifndef __U2F_NFC_SIM_H_INCLUDED__
+#define __U2F_NFC_SIM_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define U2FNFC_SIM_READER  "sim"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  double latencyMs;  // added to every exchange
+  unsigned block;  // most data per short APDU (<= 256), each way: longer
+                   // commands get 6700, more response data comes with
+                   // 61xx, for GET RESPONSE
+  unsigned extended;  // largest extended APDU data field, each way; 0
+                      // for no extended APDUs
+} U2FNFC_simConfig;
+
+// Used by sessions opened after it is set. Defaults: no latency, 256
+// byte blocks and extended APDUs up to 65535 bytes.
+extern U2FNFC_simConfig simConfig;
+
+typedef struct U2FNFC_sim U2FNFC_sim;
+
+// A freshly powered card: no applet selected, no keys registered.
+U2FNFC_sim *U2FNFC_simCreate(const U2FNFC_simConfig *config);
+
+void U2FNFC_simDestroy(U2FNFC_sim *sim);
+
+// Handles one command APDU as the card would, after config.latencyMs,
+// and puts the response APDU in |rapdu| (|*rlen| bytes, set to the
+// length used). Returns 0 if the response did not fit, else 1.
+// Also answers the PC/SC GET DATA for the card's UID (CLA 0xFF).
+int U2FNFC_simTransmit(U2FNFC_sim *sim, const uint8_t *capdu,
+                       unsigned long len, uint8_t *rapdu,
+                       unsigned long *rlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __U2F_NFC_SIM_H_INCLUDED__
@@ -5,43 +5,141 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
-
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../HID/u2f_counters.h"
 #include "u2f.h"
+#include "../HID/u2f_crypto.h"
 #include "u2f_nfc_crypto.h"
+#include "u2f_nfc_sim.h"
 #include "u2f_nfc_util.h"
 
 // u2f_nfc_crypto functions
-extern void enrollCheckSignature(U2F_REGISTER_REQ regReq,
-                                 U2F_REGISTER_RESP regRsp);
-extern void signCheckSignature(U2F_REGISTER_REQ regReq,
-                               U2F_REGISTER_RESP regRsp,
-                               U2F_AUTHENTICATE_REQ authReq,
-                               U2F_AUTHENTICATE_RESP authResp,
+extern void enrollCheckSignature(const U2F_REGISTER_REQ& regReq,
+                                 const U2F_REGISTER_RESP& regRsp);
+extern void signCheckSignature(const U2F_REGISTER_REQ& regReq,
+                               const U2F_REGISTER_RESP& regRsp,
+                               const U2F_AUTHENTICATE_REQ& authReq,
+                               const U2F_AUTHENTICATE_RESP& authResp,
                                int respLength);
+extern U2F_counterStore counterStore;
+extern std::string b2a(const void* ptr, size_t size);
 
 // u2f_nfc_util functions
-extern "C" int U2FNFC_connect(void);
-extern "C" uint xchgAPDUShort(uint cla, uint ins, uint p1, uint p2, uint lc,
-                              const void *data, uint *rapduLen, void *rapdu);
-extern "C" uint xchgAPDUExtended(uint cla, uint ins, uint p1, uint p2, uint lc,
-                                 const void *data, uint *rapduLen, void *rapdu);
 extern "C" void AbortOrNot(void);
 extern "C" void checkPause(const char* prompt);
-extern "C" void setChainingLc(uint16_t size);
 
 // Global Variables from u2f_nfc_utils
 extern "C" flag log_Apdu;
 extern "C" flag log_Crypto;
 extern "C" flag arg_Pause;
 extern "C" flag arg_Abort;
-extern "C" cmd_apdu_type cmd_apdu;
 
 
-U2F_REGISTER_REQ  regReq;
-U2F_REGISTER_RESP regRsp;
-U2F_AUTHENTICATE_REQ authReq;
-U2F_AUTHENTICATE_RESP authRsp;
+// One card under test, and how its run went.
+struct Card {
+  std::string reader;
+  U2FNFC_session* session;
+  const char* step;  // the test last started
+  const char* failedAt;  // the test of the first failure
+  int passed;
+  int failures;
+  bool connected;
+  float seconds;
+
+  Card() : session(NULL), step(""), failedAt(""), passed(0), failures(0),
+           connected(false), seconds(0) {}
+};
+
+// Thrown from failed checks to stop a card when testing many (-r, -w).
+struct CardFailure {};
+
+// With -r and -w, cards run on threads of their own; all per-card state
+// is thread local.
+static bool arg_Rack = false;
+static thread_local Card* card;
+static thread_local U2FNFC_session* session;  // the card under test
+static thread_local U2F_REGISTER_REQ  regReq;
+static thread_local U2F_REGISTER_RESP regRsp;
+static thread_local U2F_AUTHENTICATE_REQ authReq;
+static thread_local U2F_AUTHENTICATE_RESP authRsp;
+// Nonces and appIds. Not rand(): on MSVC each thread starts it from the
+// same seed, so every card in a rack would get the same challenges.
+static thread_local std::mt19937 rng;
+
+// With -n: what each kind of card takes, by ATR, so each is probed once.
+static bool arg_Negotiate = false;
+static std::mutex capsLock;
+static std::map<std::string, U2FNFC_caps> capsByAtr;
+
+// With -b: the latency curve, one point per operation, encoding and
+// block size on each card, saved to arg_Sweep after each card.
+#define SWEEP_RUNS  5
+
+struct SweepPoint {
+  std::string reader;
+  std::string atr;
+  const char* op;  // "register" or "authenticate"
+  const char* encoding;  // "short" or "extended"
+  uint block;  // short APDU block size
+  uint apdus;  // exchanges per run
+  double meanMs, minMs, maxMs;  // APDU time per run
+
+  SweepPoint() : op(""), encoding(""), block(0), apdus(0), meanMs(0),
+                 minMs(0), maxMs(0) {}
+};
+
+static const char* arg_Sweep = NULL;
+static std::mutex sweepLock;
+static std::vector<SweepPoint> sweepPoints;
+
+// Exchange time histograms of each card, by kind of exchange, for the
+// summary table and, with -j, saved to arg_Latency.
+struct CardLatency {
+  std::string label;
+  U2FNFC_histogram kinds[U2FNFC_KINDS];
+};
+
+static const char* arg_Latency = NULL;
+static std::mutex latencyLock;
+static std::vector<CardLatency> latencies;
+
+// PASS, but only counted while testing many cards.
+#undef PASS
+#ifdef _MSC_VER
+#define PASS(x) do { (x); ++card->passed; if (!arg_Rack) std::cout << "PASS("#x")" << std::endl; } while (0)
+#else
+#define PASS(x) do { (x); ++card->passed; if (!arg_Rack) std::cout << "\x1b[32mPASS("#x")\x1b[0m" << std::endl; } while (0)
+#endif
+
+// Announces the next test; with -r, only remembers it for the report.
+static void step(const char* name) {
+  card->step = name;
+  if (!arg_Rack) std::cout << name;
+}
+
+// Announces part of a test, unless -r.
+static void note(const char* text) {
+  if (!arg_Rack) std::cout << text;
+}
+
+// abortHook with -r and -w: names the card after the check's message and stops
+// it, unless -a.
+static void cardFailed() {
+  std::cerr << "[" << card->reader << "]" << std::endl;
+  if (!card->failures++) card->failedAt = card->step;
+  if (arg_Abort) throw CardFailure();
+}
 
 void test_Enroll(cmd_apdu_type cmd_apdu_in, uint expectedSW12 = 0x9000) {
   uint rspLen = sizeof(U2F_REGISTER_RESP);
@@ -49,25 +147,31 @@ void test_Enroll(cmd_apdu_type cmd_apdu_in, uint expectedSW12 = 0x9000) {
 
   // pick random origin and challenge.
   for (size_t i = 0; i < sizeof(regReq.nonce); ++i) {
-    regReq.nonce[i] = rand();
+    regReq.nonce[i] = (uint8_t) rng();
   }
   for (size_t i = 0; i < sizeof(regReq.appId); ++i) {
-    regReq.appId[i] = rand();
+    regReq.appId[i] = (uint8_t) rng();
   }
 
   // APDU Exchange - Select Short or Extended
   if (cmd_apdu_in == SHORT_APDU) {
-    CHECK_EQ(expectedSW12, xchgAPDUShort(0, U2F_INS_REGISTER, U2F_AUTH_ENFORCE,
-                                         0, sizeof(regReq),
+    CHECK_EQ(expectedSW12, xchgAPDUShort(session, 0, U2F_INS_REGISTER,
+                                         U2F_AUTH_ENFORCE, 0, sizeof(regReq),
                                          reinterpret_cast<uint8_t*>(&regReq),
                                          &rspLen, rsp));
   }
   if (cmd_apdu_in == EXTENDED_APDU) {
-    CHECK_EQ(expectedSW12, xchgAPDUExtended(0, U2F_INS_REGISTER,
+    CHECK_EQ(expectedSW12, xchgAPDUExtended(session, 0, U2F_INS_REGISTER,
                                             U2F_AUTH_ENFORCE, 0, sizeof(regReq),
                                             reinterpret_cast<uint8_t*>(&regReq),
                                             &rspLen, rsp));
   }
+  if (cmd_apdu_in == AUTO_APDU) {
+    CHECK_EQ(expectedSW12, xchgAPDU(session, 0, U2F_INS_REGISTER,
+                                    U2F_AUTH_ENFORCE, 0, sizeof(regReq),
+                                    reinterpret_cast<uint8_t*>(&regReq),
+                                    &rspLen, rsp));
+  }
 
   if (expectedSW12 != 0x9000) {
     CHECK_EQ(0, rspLen);
@@ -91,7 +195,7 @@ uint test_Sign(cmd_apdu_type cmd_apdu_in,
 
   // pick random challenge and use registered appId.
   for (size_t i = 0; i < sizeof(authReq.nonce); ++i) {
-    authReq.nonce[i] = rand();
+    authReq.nonce[i] = (uint8_t) rng();
   }
   memcpy(authReq.appId, regReq.appId, sizeof(authReq.appId));
   authReq.keyHandleLen = regRsp.keyHandleLen;
@@ -103,18 +207,25 @@ uint test_Sign(cmd_apdu_type cmd_apdu_in,
   // APDU Exchange - Select Short or Extended
   if (cmd_apdu_in == SHORT_APDU) {
     CHECK_EQ(expectedSW12,
-             xchgAPDUShort(0, U2F_INS_AUTHENTICATE,
+             xchgAPDUShort(session, 0, U2F_INS_AUTHENTICATE,
                            checkOnly ? U2F_AUTH_CHECK_ONLY : U2F_AUTH_ENFORCE,
                            0, reqSize, reinterpret_cast<uint8_t*>(&authReq),
                            &rspLen, rsp)); }
 
   if (cmd_apdu_in == EXTENDED_APDU) {
     CHECK_EQ(expectedSW12,
-             xchgAPDUExtended(0, U2F_INS_AUTHENTICATE,
+             xchgAPDUExtended(session, 0, U2F_INS_AUTHENTICATE,
                               checkOnly ? U2F_AUTH_CHECK_ONLY : U2F_AUTH_ENFORCE,
                               0, reqSize, reinterpret_cast<uint8_t*>(&authReq),
                               &rspLen, rsp));
   }
+  if (cmd_apdu_in == AUTO_APDU) {
+    CHECK_EQ(expectedSW12,
+             xchgAPDU(session, 0, U2F_INS_AUTHENTICATE,
+                      checkOnly ? U2F_AUTH_CHECK_ONLY : U2F_AUTH_ENFORCE,
+                      0, reqSize, reinterpret_cast<uint8_t*>(&authReq),
+                      &rspLen, rsp));
+  }
 
   if (expectedSW12 != 0x9000) {
     CHECK_EQ(0, rspLen);
@@ -128,140 +239,662 @@ uint test_Sign(cmd_apdu_type cmd_apdu_in,
   return rspLen;
 }
 
+// Finds what the card takes, or recalls it for its ATR, for xchgAPDU.
+// A card the probe finds taking nothing stays on short APDUs chained at
+// the session block size.
+static void negotiate() {
+  uint8_t atr[33];
+  std::string key = b2a(atr, U2FNFC_atr(session, atr));
+  U2FNFC_caps caps;
+  bool known;
+  {
+    std::lock_guard<std::mutex> hold(capsLock);
+    known = capsByAtr.count(key) != 0;
+    if (known) caps = capsByAtr[key];
+  }
+  if (!known) {
+    int rc = U2FNFC_probe(session, &caps);
+    CHECK_EQ(0, rc);
+    if (rc) return;
+    std::lock_guard<std::mutex> hold(capsLock);
+    capsByAtr[key] = caps;
+  }
+  U2FNFC_setCaps(session, &caps);
+
+  if (!arg_Rack) {
+    std::cout << (known ? " (known ATR)" : "") << ": extended APDUs "
+              << (caps.extended ? "yes" : "no") << ", short blocks of "
+              << caps.block << std::endl;
+  }
+}
+
+// |s| as a JSON string.
+static std::string jsonString(const std::string& s) {
+  std::ostringstream out;
+  out << '"';
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (c < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << (int) c << std::dec;
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+  return out.str();
+}
+
+// Writes every point so far to arg_Sweep: JSON if its name ends in
+// .json, else CSV.
+static void saveSweep() {
+  std::string name(arg_Sweep);
+  bool json = name.size() >= 5 &&
+      name.compare(name.size() - 5, 5, ".json") == 0;
+  std::ofstream out(arg_Sweep);
+  out << std::fixed << std::setprecision(3);
+  if (!json) {
+    out << "reader,atr,op,encoding,block,apdus,runs,mean_ms,min_ms,max_ms,"
+           "ms_per_apdu\n";
+  } else {
+    out << "[\n";
+  }
+  for (size_t i = 0; i < sweepPoints.size(); ++i) {
+    const SweepPoint& p = sweepPoints[i];
+    double perApdu = p.apdus ? p.meanMs / p.apdus : 0;
+    if (!json) {
+      // Reader names may hold commas; quote them as RFC 4180 does.
+      std::string reader(p.reader);
+      for (size_t q = reader.find('"'); q != std::string::npos;
+           q = reader.find('"', q + 2)) {
+        reader.insert(q, 1, '"');
+      }
+      out << '"' << reader << "\"," << p.atr << "," << p.op << ","
+          << p.encoding << "," << p.block << "," << p.apdus << ","
+          << SWEEP_RUNS << "," << p.meanMs << "," << p.minMs << ","
+          << p.maxMs << "," << perApdu << "\n";
+    } else {
+      out << "  {\"reader\": " << jsonString(p.reader)
+          << ", \"atr\": \"" << p.atr << "\", \"op\": \"" << p.op
+          << "\", \"encoding\": \"" << p.encoding << "\", \"block\": "
+          << p.block << ", \"apdus\": " << p.apdus << ", \"runs\": "
+          << SWEEP_RUNS << ", \"mean_ms\": " << p.meanMs
+          << ", \"min_ms\": " << p.minMs << ", \"max_ms\": " << p.maxMs
+          << ", \"ms_per_apdu\": " << perApdu << "}"
+          << (i + 1 < sweepPoints.size() ? "," : "") << "\n";
+    }
+  }
+  if (json) out << "]\n";
+  if (!out) std::cerr << "Cannot write " << arg_Sweep << std::endl;
+}
+
+// Times SWEEP_RUNS of REGISTER then AUTHENTICATE with short APDUs at
+// each block size (as setChainingLc) up to the longest the probe saw
+// the card take and, if the card takes them, extended APDUs; the time
+// is that of the APDU exchanges alone.
+static void sweep() {
+  static const uint16_t blocks[] = { 16, 32, 48, 64, 100, 128, 192, 256 };
+  const size_t count = sizeof(blocks) / sizeof(blocks[0]);
+  U2FNFC_caps caps;
+  bool extended = U2FNFC_probe(session, &caps) == 0 && caps.extended;
+  uint8_t atr[33];
+  std::string atrHex = b2a(atr, U2FNFC_atr(session, atr));
+
+  std::vector<SweepPoint> points;
+  for (size_t i = 0; i <= count; ++i) {
+    if (i == count && !extended) break;
+    // A 256 byte block still sends at most 255 bytes of data.
+    if (i < count && caps.block &&
+        (blocks[i] < 256 ? blocks[i] : 255) > caps.block) {
+      continue;
+    }
+    cmd_apdu_type type = i < count ? SHORT_APDU : EXTENDED_APDU;
+    setChainingLc(session, i < count ? blocks[i] : 256);
+    for (int op = 0; op < 2; ++op) {
+      SweepPoint p;
+      p.reader = card->reader;
+      p.atr = atrHex;
+      p.op = op ? "authenticate" : "register";
+      p.encoding = i < count ? "short" : "extended";
+      p.block = i < count ? blocks[i] : 0;
+      for (int run = 0; run < SWEEP_RUNS; ++run) {
+        uint before, after;
+        double beforeMs, afterMs, maxMs;
+        U2FNFC_stats(session, &before, &beforeMs, &maxMs);
+        if (op) {
+          test_Sign(type);
+        } else {
+          test_Enroll(type);
+        }
+        U2FNFC_stats(session, &after, &afterMs, &maxMs);
+        double ms = afterMs - beforeMs;
+        p.apdus = after - before;
+        p.meanMs += ms / SWEEP_RUNS;
+        if (!run || ms < p.minMs) p.minMs = ms;
+        if (ms > p.maxMs) p.maxMs = ms;
+      }
+      if (!arg_Rack) {
+        std::cout << std::fixed << std::setprecision(1) << "\n" << p.op
+                  << ", " << p.encoding;
+        if (p.block) std::cout << " " << p.block;
+        std::cout << ": " << p.apdus << " APDUs, " << p.meanMs
+                  << " ms mean, " << p.minMs << " min, " << p.maxMs << " max";
+      }
+      points.push_back(p);
+    }
+  }
+  setChainingLc(session, 256);
+  note("\n");
+
+  std::lock_guard<std::mutex> hold(sweepLock);
+  sweepPoints.insert(sweepPoints.end(), points.begin(), points.end());
+  saveSweep();
+}
+
 void check_Compilation() {
   // Couple of sanity checks.
   CHECK_EQ(sizeof(U2F_EC_POINT), 65);
   CHECK_EQ(sizeof(U2F_REGISTER_REQ), 64);
 }
 
-int main(int argc, char* argv[]) {
+// The whole test sequence, on |session|.
+void runTests() {
   // Allocate buffers for response APDU
   uint rapduLen = 0;
   uint8_t rapdu[APDU_BUFFER_SIZE];
   uint32_t ctr;
 
-  while (--argc > 0) {
-    if (!strncmp(argv[argc], "-v", 2)) {
-      // Log APDUs
-      log_Apdu = flagON;
-    }
-    if (!strncmp(argv[argc], "-V", 2)) {
-      // Log APDUs and Crypro
-      log_Apdu = flagON;
-      log_Crypto = flagON;
-    }
-    if (!strncmp(argv[argc], "-a", 2)) {
-      // Don't abort, try to continue;
-      arg_Abort = flagOFF;
-    }
-    if (!strncmp(argv[argc], "-p", 2)) {
-      // Pause at abort
-      arg_Pause = flagON;
-    }
-  }
-
-  srand((unsigned int) time(NULL));
-  PASS(check_Compilation());
-
-  // Connect to the card reader
-  CHECK_EQ(0, U2FNFC_connect());
-
   //---------------------------------------------------------------------------
   //                                 Tests
   //---------------------------------------------------------------------------
-  std::cout << "\nApplet Select - Check Version Response";
+  step("\nApplet Select - Check Version Response");
   uint8_t u2fAID[U2F_APPLET_AID_LEN] = U2F_APPLET_AID;
   uint8_t u2fVer[U2F_VERSION_LEN] = U2F_VERSION;
   rapduLen = U2F_VERSION_LEN;
-  CHECK_EQ(SW_NO_ERROR, (xchgAPDUShort(0, 0xa4, 0x04, 0x00, sizeof(u2fAID), u2fAID,  &rapduLen, rapdu)));
+  CHECK_EQ(SW_NO_ERROR, (xchgAPDUShort(session, 0, 0xa4, 0x04, 0x00, sizeof(u2fAID), u2fAID,  &rapduLen, rapdu)));
   CHECK_EQ(0, memcmp(u2fVer, rapdu, U2F_VERSION_LEN));
 
-  std::cout << "\nCheck Unknown INS Response";
-  CHECK_EQ(0x6D00, xchgAPDUShort(0, 0 /* not U2F INS */, 0, 0, 0, "", &rapduLen, rapdu));
+  step("\nCheck Unknown INS Response");
+  CHECK_EQ(0x6D00, xchgAPDUShort(session, 0, 0 /* not U2F INS */, 0, 0, 0, "", &rapduLen, rapdu));
   CHECK_EQ(0, rapduLen);
-  CHECK_EQ(0x6D00, xchgAPDUExtended(0, 0 /* not U2F INS */, 0, 0, 0, "", &rapduLen, rapdu));
+  CHECK_EQ(0x6D00, xchgAPDUExtended(session, 0, 0 /* not U2F INS */, 0, 0, 0, "", &rapduLen, rapdu));
   CHECK_EQ(0, rapduLen);
 
-  std::cout << "\nCheck Bad CLA Response";
-  CHECK_NE(0x9000, xchgAPDUShort(1 /* not U2F CLA, 0x00 */, U2F_INS_AUTHENTICATE, 0, 0, 0, "abc", &rapduLen, rapdu));
+  step("\nCheck Bad CLA Response");
+  CHECK_NE(0x9000, xchgAPDUShort(session, 1 /* not U2F CLA, 0x00 */, U2F_INS_AUTHENTICATE, 0, 0, 0, "abc", &rapduLen, rapdu));
   CHECK_EQ(0, rapduLen);
 
-  std::cout << "\nCheck Wrong Length U2F_REGISTER Response";
-  CHECK_EQ(0x6700u, xchgAPDUShort(0, U2F_INS_REGISTER, 0, 0, 0, "", &rapduLen, rapdu));
+  step("\nCheck Wrong Length U2F_REGISTER Response");
+  CHECK_EQ(0x6700u, xchgAPDUShort(session, 0, U2F_INS_REGISTER, 0, 0, 0, "", &rapduLen, rapdu));
   CHECK_EQ(0, rapduLen);
 
-  setChainingLc(256);
-  std::cout << "\nValid U2F_REGISTER, Short APDU";
+  setChainingLc(session, 256);
+  step("\nValid U2F_REGISTER, Short APDU");
   PASS(test_Enroll(SHORT_APDU, 0x9000u));
-  std::cout << "Check the Signature\n";
+  note("Check the Signature\n");
   PASS(enrollCheckSignature(regReq, regRsp));
 
-  setChainingLc(100);
-  std::cout << "\nValid U2F_REGISTER, Short APDU, Change BlockSize";
+  setChainingLc(session, 100);
+  step("\nValid U2F_REGISTER, Short APDU, Change BlockSize");
   PASS(test_Enroll(SHORT_APDU, 0x9000u));
-  std::cout << "Check the Signature\n";
+  note("Check the Signature\n");
   PASS(enrollCheckSignature(regReq , regRsp));
-  setChainingLc(256);
+  setChainingLc(session, 256);
 
-  std::cout << "\nValid U2F_REGISTER, Extended APDU";
+  step("\nValid U2F_REGISTER, Extended APDU");
   PASS(test_Enroll(EXTENDED_APDU, 0x9000u));
-  std::cout << "Check the Signature\n";
+  note("Check the Signature\n");
   PASS(enrollCheckSignature(regReq, regRsp));
 
-  std::cout << "\nValid U2F_AUTH, Short APDU";
+  step("\nValid U2F_AUTH, Short APDU");
   PASS(rapduLen = test_Sign(SHORT_APDU, 0x9000u));
-  std::cout << "Check the Signature & Counter";
+  note("Check the Signature & Counter");
   PASS(signCheckSignature(regReq, regRsp, authReq, authRsp, rapduLen));
   ctr = MAKE_UINT32(authRsp.ctr);
 
-  std::cout << "\nValid U2F_AUTH, Extended APDU";
+  step("\nValid U2F_AUTH, Extended APDU");
   PASS(rapduLen = test_Sign(EXTENDED_APDU, 0x9000u));
-  std::cout << "Check the Signature & Counter";
+  note("Check the Signature & Counter");
   PASS(signCheckSignature(regReq, regRsp, authReq, authRsp, rapduLen));
   CHECK_EQ(MAKE_UINT32(authRsp.ctr), ctr+1); ctr = MAKE_UINT32(authRsp.ctr);
 
-  std::cout << "\nTest Auth with wrong keyHandle";
+  step("\nTest Auth with wrong keyHandle");
   regRsp.keyHandleCertSig[0] ^= 0x55;
   PASS(test_Sign(SHORT_APDU, 0x6a80));
   regRsp.keyHandleCertSig[0] ^= 0x55;
 
-  std::cout << "\nTest Auth with wrong AppId";
+  step("\nTest Auth with wrong AppId");
   regReq.appId[0] ^= 0xaa;
   PASS(test_Sign(EXTENDED_APDU, 0x6a80));
   regReq.appId[0] ^= 0xaa;
 
-  std::cout << "\nReTest Valid U2F_AUTH, Short APDU";
+  step("\nReTest Valid U2F_AUTH, Short APDU");
   PASS(rapduLen = test_Sign(SHORT_APDU, 0x9000u));
-  std::cout << "Check the Signature & Counter";
+  note("Check the Signature & Counter");
   PASS(signCheckSignature(regReq, regRsp, authReq, authRsp, rapduLen));
   CHECK_EQ(MAKE_UINT32(authRsp.ctr), ctr+1); ctr = MAKE_UINT32(authRsp.ctr);
 
-  std::cout << "\nReTest U2F_AUTH, Extended APDU";
+  step("\nReTest U2F_AUTH, Extended APDU");
   PASS(rapduLen = test_Sign(EXTENDED_APDU, 0x9000u));
-  std::cout << "Check the Signature & Counter";
+  note("Check the Signature & Counter");
   PASS(signCheckSignature(regReq, regRsp, authReq, authRsp, rapduLen));
   CHECK_EQ(MAKE_UINT32(authRsp.ctr), ctr+1); ctr = MAKE_UINT32(authRsp.ctr);
 
-  std::cout << "\nValid U2F_REGISTER, Extended APDU";
+  step("\nValid U2F_REGISTER, Extended APDU");
   PASS(test_Enroll(EXTENDED_APDU, 0x9000u));
-  std::cout << "Check the Signature\n";
+  note("Check the Signature\n");
   PASS(enrollCheckSignature(regReq, regRsp));
 
-  std::cout << "\nValid U2F_AUTH, Extended APDU";
+  step("\nValid U2F_AUTH, Extended APDU");
   PASS(rapduLen = test_Sign(EXTENDED_APDU, 0x9000u));
-  std::cout << "Check the Signature & Counter ";
+  note("Check the Signature & Counter ");
   PASS(signCheckSignature(regReq, regRsp, authReq, authRsp, rapduLen));
   CHECK_EQ(MAKE_UINT32(authRsp.ctr), ctr+1); ctr = MAKE_UINT32(authRsp.ctr);
 
-  std::cout << "\nValid U2F_REGISTER, Short APDU";
+  step("\nValid U2F_REGISTER, Short APDU");
   PASS(test_Enroll(SHORT_APDU, 0x9000u));
-  std::cout << "Check the Signature\n";
+  note("Check the Signature\n");
   PASS(enrollCheckSignature(regReq, regRsp));
 
-  std::cout << "\nValid U2F_AUTH, Short APDU";
+  step("\nValid U2F_AUTH, Short APDU");
   PASS(rapduLen = test_Sign(SHORT_APDU, 0x9000u));
-  std::cout << "Check the Signature & Counter";
+  note("Check the Signature & Counter");
   PASS(signCheckSignature(regReq, regRsp, authReq, authRsp, rapduLen));
   CHECK_EQ(MAKE_UINT32(authRsp.ctr), ctr+1); ctr = MAKE_UINT32(authRsp.ctr);
+
+  if (arg_Negotiate) {
+    step("\nNegotiate APDU Encoding");
+    PASS(negotiate());
+
+    step("\nValid U2F_REGISTER, Negotiated APDU");
+    PASS(test_Enroll(AUTO_APDU, 0x9000u));
+    note("Check the Signature\n");
+    PASS(enrollCheckSignature(regReq, regRsp));
+
+    step("\nValid U2F_AUTH, Negotiated APDU");
+    PASS(rapduLen = test_Sign(AUTO_APDU, 0x9000u));
+    note("Check the Signature & Counter");
+    PASS(signCheckSignature(regReq, regRsp, authReq, authRsp, rapduLen));
+    CHECK_EQ(MAKE_UINT32(authRsp.ctr), ctr+1); ctr = MAKE_UINT32(authRsp.ctr);
+  }
+
+  if (arg_Sweep) {
+    step("\nBlock Size Sweep");
+    PASS(sweep());
+  }
+}
+
+// Prints the exchange times in |kinds| as a table.
+static void printLatency(const U2FNFC_histogram* kinds) {
+  std::cout << std::endl << std::left << std::setw(14) << "exchange"
+            << std::right << std::setw(7) << "count" << std::setw(9) << "mean"
+            << std::setw(9) << "p50" << std::setw(9) << "p90"
+            << std::setw(9) << "p99" << std::setw(9) << "max" << " ms"
+            << std::endl;
+  uint total = 0;
+  for (int k = 0; k < U2FNFC_KINDS; ++k) {
+    const U2FNFC_histogram& h = kinds[k];
+    total += h.count;
+    if (!h.count) continue;
+    std::cout << std::left << std::setw(14) << U2FNFC_kindName((U2FNFC_kind) k)
+              << std::right << std::setw(7) << h.count << std::fixed
+              << std::setprecision(1) << std::setw(9) << h.totalMs / h.count
+              << std::setw(9) << U2FNFC_percentile(&h, 50)
+              << std::setw(9) << U2FNFC_percentile(&h, 90)
+              << std::setw(9) << U2FNFC_percentile(&h, 99)
+              << std::setw(9) << h.maxMs << std::endl;
+  }
+  std::cout << "Chained round trips: "
+            << kinds[U2FNFC_CHAINED].count +
+               kinds[U2FNFC_GET_RESPONSE].count
+            << " of " << total << " (" << kinds[U2FNFC_CHAINED].count
+            << " command blocks, " << kinds[U2FNFC_GET_RESPONSE].count
+            << " GET RESPONSE)" << std::endl;
+}
+
+// Writes the histograms of every card so far to arg_Latency as JSON.
+static void saveLatency() {
+  std::ofstream out(arg_Latency);
+  out << std::fixed << std::setprecision(3) << "[\n";
+  for (size_t i = 0; i < latencies.size(); ++i) {
+    const CardLatency& c = latencies[i];
+    out << "  {\"card\": " << jsonString(c.label) << ", \"chained\": "
+        << c.kinds[U2FNFC_CHAINED].count + c.kinds[U2FNFC_GET_RESPONSE].count
+        << ", \"exchanges\": {";
+    for (int k = 0; k < U2FNFC_KINDS; ++k) {
+      const U2FNFC_histogram& h = c.kinds[k];
+      out << (k ? ", " : "") << "\n    \""
+          << U2FNFC_kindName((U2FNFC_kind) k) << "\": {\"count\": "
+          << h.count << ", \"mean_ms\": "
+          << (h.count ? h.totalMs / h.count : 0) << ", \"min_ms\": "
+          << h.minMs << ", \"p50_ms\": " << U2FNFC_percentile(&h, 50)
+          << ", \"p90_ms\": " << U2FNFC_percentile(&h, 90)
+          << ", \"p99_ms\": " << U2FNFC_percentile(&h, 99)
+          << ", \"max_ms\": " << h.maxMs << "}";
+    }
+    out << "}}" << (i + 1 < latencies.size() ? "," : "") << "\n";
+  }
+  out << "]\n";
+  if (!out) std::cerr << "Cannot write " << arg_Latency << std::endl;
+}
+
+// Keeps the exchange times of |s|, under |label|, and saves them with -j.
+static void keepLatency(U2FNFC_session* s, const std::string& label) {
+  CardLatency c;
+  c.label = label;
+  for (int k = 0; k < U2FNFC_KINDS; ++k) {
+    c.kinds[k] = *U2FNFC_latency(s, (U2FNFC_kind) k);
+  }
+  std::lock_guard<std::mutex> hold(latencyLock);
+  latencies.push_back(c);
+  if (arg_Latency) saveLatency();
+}
+
+// Runs |c| to the end or its first failure, on this thread.
+static void runCard(Card* c) {
+  card = c;
+  session = c->session;
+  rng.seed(std::random_device()());
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  try {
+    runTests();
+  } catch (const CardFailure&) {
+  }
+  c->seconds = std::chrono::duration<float>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+// Connects to the card in |c|'s reader, for a thread of its own.
+static bool openCard(Card* c) {
+  card = c;
+  try {
+    c->connected = U2FNFC_open(c->reader.c_str(), &c->session) == 0;
+  } catch (const CardFailure&) {
+  }
+  if (!c->connected) {
+    c->failedAt = "connect";
+    c->failures = 1;
+    return false;
+  }
+  return true;
+}
+
+// Prints a line on how |c| did, headed by |label|, and disconnects it.
+static void reportCard(Card* c, const std::string& label) {
+  uint exchanges = 0;
+  double totalMs = 0, maxMs = 0;
+  if (c->session) {
+    U2FNFC_stats(c->session, &exchanges, &totalMs, &maxMs);
+    keepLatency(c->session, label);
+  }
+  U2FNFC_close(c->session);
+  c->session = NULL;
+
+  // Test names carry their own line breaks.
+  std::string at(c->failedAt);
+  at.erase(0, at.find_first_not_of("\n "));
+  at.erase(at.find_last_not_of("\n ") + 1);
+
+  std::cout << label << ": "
+            << (c->failures ? "\x1b[31mFAIL\x1b[0m" : "\x1b[32mPASS\x1b[0m")
+            << ", " << c->passed << " passed, " << c->failures << " failed";
+  if (c->failures) std::cout << " (at " << at << ")";
+  std::cout << std::fixed << std::setprecision(2) << ", " << c->seconds
+            << "s, " << exchanges << " APDUs";
+  if (exchanges) {
+    std::cout << std::setprecision(0) << ", " << totalMs / exchanges
+              << " ms average, " << maxMs << " ms max";
+  }
+  std::cout << std::endl;
+}
+
+// Tests every reader whose name contains |pattern| at once, one thread
+// per card, and reports on each.
+// Returns the number of cards that failed, or -1 if no reader matches.
+static int testRack(const char* pattern) {
+  std::vector<char> names(65536);
+  int count = U2FNFC_listReaders(pattern, &names[0], names.size());
+  if (!count) {
+    std::cerr << "No PC/SC reader matches \"" << pattern << "\"" << std::endl;
+    return -1;
+  }
+
+  std::vector<Card> cards(count);
+  const char* name = &names[0];
+  abortHook = cardFailed;
+  for (int i = 0; i < count; ++i, name += strlen(name) + 1) {
+    cards[i].reader = name;
+    openCard(&cards[i]);
+  }
+
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int i = 0; i < count; ++i) {
+    if (cards[i].connected) workers.push_back(std::thread(runCard, &cards[i]));
+  }
+  for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+  float seconds = std::chrono::duration<float>(
+      std::chrono::steady_clock::now() - start).count();
+  abortHook = NULL;
+
+  int failed = 0;
+  float serial = 0;
+  std::cout << std::endl;
+  for (int i = 0; i < count; ++i) {
+    serial += cards[i].seconds;
+    failed += cards[i].failures ? 1 : 0;
+    reportCard(&cards[i], cards[i].reader);
+  }
+  std::cout << count - failed << " of " << count << " cards passed in "
+            << std::fixed << std::setprecision(2) << seconds << "s ("
+            << serial << "s one after the other)" << std::endl;
+
+  // The rack as a whole.
+  U2FNFC_histogram sum[U2FNFC_KINDS];
+  memset(sum, 0, sizeof(sum));
+  {
+    std::lock_guard<std::mutex> hold(latencyLock);
+    for (size_t i = 0; i < latencies.size(); ++i) {
+      for (int k = 0; k < U2FNFC_KINDS; ++k) {
+        U2FNFC_histogramAdd(&sum[k], &latencies[i].kinds[k]);
+      }
+    }
+  }
+  printLatency(sum);
+  return failed;
+}
+
+// With -w: taps so far of each card, by UID where the reader tells it,
+// else by ATR.
+struct Tally {
+  int taps;
+  int passed;
+
+  Tally() : taps(0), passed(0) {}
+};
+
+static std::mutex tapLock;  // guards the below and the report lines
+static std::map<std::string, Tally> tallies;
+static std::vector<bool> readerBusy;
+
+// Tests the card just put on |c|'s reader and reports, keyed by |atr|
+// or the UID, then frees the reader for the next tap.
+static void tapCard(Card* c, int readerIndex, std::string atr) {
+  std::string key = "ATR " + atr;
+  if (openCard(c)) {
+    // PC/SC 2.01 part 3 GET DATA for the UID, which readers answer
+    // themselves; not all do.
+    uint8_t uid[APDU_BUFFER_SIZE];
+    uint uidLen = sizeof(uid);
+    try {
+      if (xchgAPDUShort(c->session, 0xff, 0xca, 0, 0, 0, "", &uidLen, uid) ==
+          SW_NO_ERROR && uidLen) {
+        key = "UID " + b2a(uid, uidLen);
+      }
+    } catch (const CardFailure&) {
+    }
+    if (!c->failures) runCard(c);
+  }
+
+  std::lock_guard<std::mutex> hold(tapLock);
+  Tally& tally = tallies[key];
+  ++tally.taps;
+  if (!c->failures) ++tally.passed;
+  std::ostringstream label;
+  label << c->reader << ", " << key << ", " << tally.passed << " of "
+        << tally.taps << " taps passed";
+  reportCard(c, label.str());
+  readerBusy[readerIndex] = false;
+  delete c;
+}
+
+// Waits for cards on every reader whose name contains |pattern| and
+// tests each as it is put down, on a thread of its own, for ever.
+// Returns -1 if no reader matches or the reader service fails, once the
+// cards being tested are done.
+static int tapLoop(const char* pattern) {
+  U2FNFC_watch* watch = U2FNFC_watchOpen(pattern);
+  if (!watch) {
+    std::cerr << "No PC/SC reader matches \"" << pattern << "\"" << std::endl;
+    return -1;
+  }
+  std::cout << "Waiting for cards..." << std::endl;
+
+  // The last tap's thread on each reader; joined before the next one.
+  std::vector<std::thread> threads;
+  abortHook = cardFailed;
+  for (;;) {
+    const char* reader;
+    uint8_t atr[33];
+    uint atrLen = 0;
+    int index;
+    try {
+      index = U2FNFC_watchNext(watch, ~0u, &reader, atr, &atrLen);
+    } catch (const CardFailure&) {
+      break;
+    }
+    if (index == U2FNFC_WATCH_ERROR) break;
+    if (index < 0) continue;
+
+    {
+      std::lock_guard<std::mutex> hold(tapLock);
+      if (readerBusy.size() <= (size_t) index) readerBusy.resize(index + 1);
+      if (readerBusy[index]) continue;  // still on the last tap
+      readerBusy[index] = true;
+    }
+    if (threads.size() <= (size_t) index) threads.resize(index + 1);
+    if (threads[index].joinable()) threads[index].join();
+    Card* c = new Card;
+    c->reader = reader;
+    threads[index] = std::thread(tapCard, c, index, b2a(atr, atrLen));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    if (threads[i].joinable()) threads[i].join();
+  }
+  U2FNFC_watchClose(watch);
+  return -1;
+}
+
+int main(int argc, char* argv[]) {
+  const char* arg_Pattern = NULL;
+  bool arg_Taps = false;
+  bool arg_Sim = false;
+
+  while (--argc > 0) {
+    if (!strncmp(argv[argc], "-v", 2)) {
+      // Log APDUs
+      log_Apdu = flagON;
+    }
+    if (!strncmp(argv[argc], "-V", 2)) {
+      // Log APDUs and Crypro
+      log_Apdu = flagON;
+      log_Crypto = flagON;
+    }
+    if (!strncmp(argv[argc], "-a", 2)) {
+      // Don't abort, try to continue;
+      arg_Abort = flagOFF;
+    }
+    if (!strncmp(argv[argc], "-p", 2)) {
+      // Pause at abort
+      arg_Pause = flagON;
+    }
+    if (!strncmp(argv[argc], "-c", 2)) {
+      // Crypto backend
+      if (!U2F_cryptoUse(argv[argc] + 2)) {
+        std::cerr << "No crypto backend " << argv[argc] + 2 << std::endl;
+        return -1;
+      }
+    }
+    if (!strncmp(argv[argc], "-r", 2)) {
+      // Every reader whose name contains this, at once
+      arg_Pattern = argv[argc] + 2;
+      arg_Rack = true;
+    }
+    if (!strncmp(argv[argc], "-w", 2)) {
+      // Test cards as they are put on readers whose name contains this
+      arg_Pattern = argv[argc] + 2;
+      arg_Rack = true;
+      arg_Taps = true;
+    }
+    if (!strncmp(argv[argc], "-s", 2)) {
+      // The applet emulator instead of a reader: latency, block limits
+      arg_Sim = true;
+      sscanf(argv[argc] + 2, "%lf,%u,%u", &simConfig.latencyMs,
+             &simConfig.block, &simConfig.extended);
+    }
+    if (!strncmp(argv[argc], "-b", 2)) {
+      // Block size sweep, saved to this file
+      arg_Sweep = argv[argc][2] ? argv[argc] + 2 : "sweep.csv";
+    }
+    if (!strncmp(argv[argc], "-j", 2)) {
+      // Exchange time histograms, saved as JSON to this file
+      arg_Latency = argv[argc][2] ? argv[argc] + 2 : "latency.json";
+    }
+    if (!strncmp(argv[argc], "-n", 2)) {
+      // Probe for the APDU encoding with fewest round trips
+      arg_Negotiate = true;
+    }
+    if (!strncmp(argv[argc], "-k", 2)) {
+      // Signature counters to check and record
+      if (!counterStore.open(argv[argc] + 2)) {
+        std::cerr << "Cannot open counters in " << argv[argc] + 2
+                  << std::endl;
+        return -1;
+      }
+    }
+  }
+
+  srand((unsigned int) time(NULL));
+  Card single;
+  card = &single;
+  rng.seed(std::random_device()());
+  PASS(check_Compilation());
+
+  if (arg_Taps) return tapLoop(arg_Pattern);
+  if (arg_Rack) {
+    int failed = testRack(arg_Pattern);
+    return failed ? 1 : 0;
+  }
+
+  // Connect to the card reader
+  if (arg_Sim) {
+    single.reader = U2FNFC_SIM_READER;
+    CHECK_EQ(0, U2FNFC_open(U2FNFC_SIM_READER, &session));
+  } else {
+    CHECK_EQ(0, U2FNFC_connect(&session));
+  }
+  runTests();
+
+  U2FNFC_histogram kinds[U2FNFC_KINDS];
+  for (int k = 0; k < U2FNFC_KINDS; ++k) {
+    kinds[k] = *U2FNFC_latency(session, (U2FNFC_kind) k);
+  }
+  printLatency(kinds);
+  keepLatency(session, single.reader);
+  U2FNFC_close(session);
   checkPause("----------------------------------\nEnd of Test, Succesfully Completed\n----------------------------------\nHit Key To Exit...");
 }
@@ -1,4 +1,5 @@
 // Based on code from Google & Yubico.
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,7 +7,8 @@
 #include <ctype.h>
 #include "u2f.h"
 #include "u2f_nfc_crypto.h"
-#include "u2f_nfc.h"
+#include "u2f_nfc_util.h"
+#include "u2f_nfc_sim.h"
 
 #if defined(__GLIBC__)
 #include <wintypes.h>
@@ -17,21 +19,68 @@
 #include <winscard.h>
 const char* printError(uint err);
 
+#ifdef _MSC_VER
+#define lockStdout() _lock_file(stdout)
+#define unlockStdout() _unlock_file(stdout)
+#else
+#define lockStdout() flockfile(stdout)
+#define unlockStdout() funlockfile(stdout)
+#endif
+
 // Gloabl variables shared with top level routine
-flag log_Apdu = flagOFF;  // default
+flag log_Apdu = flagOFF;  // default for new sessions
 flag log_Crypto = flagOFF;
 flag arg_Pause = flagOFF;
 flag arg_Abort = flagON;
-cmd_apdu_type cmd_apdu;
+void (*abortHook)(void) = NULL;
+
+// One card in one reader; see u2f_nfc_util.h.
+struct U2FNFC_session {
+  U2FNFC_sim *sim;  // instead of a reader, if opened as U2FNFC_SIM_READER
+  SCARDCONTEXT hContext;
+  SCARDHANDLE hCard;
+  ulong protocol;
+  uint16_t blockSize;  // Chaining Blocksize from reader - Le
+  uint8_t atr[33];
+  uint atrLen;
+  U2FNFC_caps caps;  // for xchgAPDU
+  flag hasCaps;
+  cmd_apdu_type cmd_apdu;  // of the last exchange
+  flag log_Apdu;
+  uint exchanges;  // and their time, for U2FNFC_stats
+  double totalMs, maxMs;
+  U2FNFC_histogram latency[U2FNFC_KINDS];
+  uint8_t *ring;  // APDU log, LOG_RING_SIZE bytes; see logAPDU
+  size_t ringHead, ringTail;  // bytes written and read, ever
+  uint dropped;  // log records overwritten before they were shown
+  double lastSent;  // time of the last command rendered
+};
+
+// Bytes of APDU log kept per session until it is shown.
+#define LOG_RING_SIZE  65536
+
+// Heads each APDU in the log.
+typedef struct {
+  double ms;  // sent or received, as getTimestampMs()
+  ulong len;
+  flag response;
+} logRecord;
 
-// Chaining Blocksize from reader - Le
-static uint16_t blockSize = 256;
+static void flushLog(U2FNFC_session *session);
 
-// Shared between PC/SC Card Access Routines
-static SCARDHANDLE hCard;
+void setChainingLc(U2FNFC_session *session, uint16_t size) {
+  session->blockSize = (size <= 256 ? size : 256);
+}
+
+void setLogApdu(U2FNFC_session *session, flag on) {
+  session->log_Apdu = on;
+}
 
-void setChainingLc(uint16_t size) {
-  blockSize = (size <= 256 ? size : 256);
+void U2FNFC_stats(const U2FNFC_session *session, uint *exchanges,
+                  double *totalMs, double *maxMs) {
+  *exchanges = session->exchanges;
+  *totalMs = session->totalMs;
+  *maxMs = session->maxMs;
 }
 
 static void pausePrompt(const char* prompt) {
@@ -45,8 +94,12 @@ void checkPause(const char* prompt) {
 }
 
 void AbortOrNot(void) {
+  if (abortHook) {
+    abortHook();
+    return;
+  }
   checkPause(arg_Abort == flagOFF ? "\nHit Enter to Continue..." : "\nHit Enter to Exit...");
-  if (arg_Abort) exit(0);
+  if (arg_Abort) exit(1);
   printf("%s" , "Continuing... (-a option)");
 }
 
@@ -54,17 +107,21 @@ int check(const char *func, long rc) {
   if (rc == SCARD_S_SUCCESS) return 1;
   // Don't try to continue after PC/SC error
   printf("%s: PC/SC error %08lx:%s\n", func, rc, printError(rc));
+  if (abortHook) {
+    abortHook();
+    return 0;
+  }
   checkPause("Hit Enter to Exit...");
-  exit(0);
+  exit(1);
 }
 
 double getTimestampMs(void) {
 #ifdef _MSC_VER
-  FILETIME gtime;
-  ULONGLONG tret;
-  GetSystemTimeAsFileTime(&gtime);
-  tret = (((ULONGLONG)gtime.dwHighDateTime << 32) | ((ULONGLONG)gtime.dwLowDateTime));
-  return (double) (tret / 10000.0);
+  // The system time only moves every few ms; exchanges are shorter.
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (double) count.QuadPart * 1000.0 / (double) freq.QuadPart;
 #else
   struct timespec st;
   clock_gettime(CLOCK_MONOTONIC, &st);
@@ -72,23 +129,102 @@ double getTimestampMs(void) {
 #endif
 }
 
-int printTransactionTime(double start, double stop) {
-  double elapsed;
+const char *U2FNFC_kindName(U2FNFC_kind kind) {
+  switch (kind) {
+    case U2FNFC_SELECT: return "select";
+    case U2FNFC_REGISTER: return "register";
+    case U2FNFC_AUTHENTICATE: return "authenticate";
+    case U2FNFC_OTHER: return "other";
+    case U2FNFC_CHAINED: return "chained block";
+    case U2FNFC_GET_RESPONSE: return "get response";
+    default: return "?";
+  }
+}
+
+// The kind of the last (or only) block of a command with |ins|.
+static U2FNFC_kind kindOf(uint ins) {
+  switch (ins) {
+    case 0xa4: return U2FNFC_SELECT;
+    case U2F_INS_REGISTER: return U2FNFC_REGISTER;
+    case U2F_INS_AUTHENTICATE: return U2FNFC_AUTHENTICATE;
+    default: return U2FNFC_OTHER;
+  }
+}
+
+const U2FNFC_histogram *U2FNFC_latency(const U2FNFC_session *session,
+                                       U2FNFC_kind kind) {
+  return &session->latency[kind];
+}
+
+void U2FNFC_histogramAdd(U2FNFC_histogram *sum, const U2FNFC_histogram *h) {
+  int i;
+  if (!h->count) return;
+  if (!sum->count || h->minMs < sum->minMs) sum->minMs = h->minMs;
+  if (h->maxMs > sum->maxMs) sum->maxMs = h->maxMs;
+  sum->count += h->count;
+  sum->totalMs += h->totalMs;
+  for (i = 0; i < U2FNFC_BUCKETS; i++) sum->buckets[i] += h->buckets[i];
+}
+
+double U2FNFC_percentile(const U2FNFC_histogram *h, double p) {
+  uint rank, seen = 0;
+  double upper;
+  int i;
+
+  if (!h->count) return 0;
+  rank = (uint) ceil(p / 100.0 * h->count);
+  if (rank < 1) rank = 1;
+  for (i = 0; i < U2FNFC_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) break;
+  }
+  upper = pow(2.0, (i + 1.0) / U2FNFC_BUCKETS_PER_OCTAVE) / 1000.0;
+  if (upper > h->maxMs) upper = h->maxMs;
+  if (upper < h->minMs) upper = h->minMs;
+  return upper;
+}
+
+// Records an exchange of |kind|, and fails it if it took too long.
+static int recordTransactionTime(U2FNFC_session *session,
+                                 U2FNFC_kind kind, double start,
+                                 double stop) {
+  U2FNFC_histogram *h = &session->latency[kind];
+  double elapsed, us;
+  int bucket = 0;
   elapsed = stop-start;
-  if((elapsed > 0.0) && (elapsed < NFC_TIMEOUT_MS)) {
-    printf("Transaction Time: %.0f ms\n", elapsed);
+  session->exchanges++;
+  session->totalMs += elapsed;
+  if (elapsed > session->maxMs) session->maxMs = elapsed;
+
+  us = elapsed * 1000.0;
+  if (us >= 1.0) {
+    bucket = (int) (log(us) / log(2.0) * U2FNFC_BUCKETS_PER_OCTAVE);
+    if (bucket >= U2FNFC_BUCKETS) bucket = U2FNFC_BUCKETS - 1;
+  }
+  if (!h->count || elapsed < h->minMs) h->minMs = elapsed;
+  if (elapsed > h->maxMs) h->maxMs = elapsed;
+  h->count++;
+  h->totalMs += elapsed;
+  h->buckets[bucket]++;
+
+  // The emulator with no latency may answer within a clock tick.
+  if((elapsed > 0.0 || (session->sim && elapsed == 0.0)) &&
+     (elapsed < NFC_TIMEOUT_MS)) {
     return SUCCESS;
   } else {
+    flushLog(session);
     printf("!!Transaction Time FAIL!!: %.0f ms\n", elapsed);
     return SW_ERROR_ANY;
   }
 }
 
-void  printCmdAPDU(uint8_t apduin[], ulong lenin) {
+// Renders a command APDU from the log.
+static void printCmdAPDU(const U2FNFC_session *session, uint8_t apduin[],
+                         ulong lenin) {
   uint8_t i;
   uint Lc, Le, DataOffset;
   printf("\n");
-  if (log_Apdu == flagON) {
+  {
     // Determine case of Command APDU
     if (lenin == 4) {
       printf("Cmd APDU, Case 1\n");
@@ -151,9 +287,11 @@ void  printCmdAPDU(uint8_t apduin[], ulong lenin) {
   }
 }
 
-void printRespAPDU(uint8_t apduin[], ulong lenin) {
+// Renders a response APDU from the log.
+static void printRespAPDU(const U2FNFC_session *session, uint8_t apduin[],
+                          ulong lenin) {
   ulong i;
-  if (log_Apdu == flagON) {
+  {
     printf("Response APDU, Length: %lu(0x%04lX)\n", lenin, lenin);
     printf("Status=>%02X:%02X\n", apduin[lenin-2], apduin[lenin-1]);
     for (i = 0; i < lenin-2; i++) {
@@ -195,7 +333,106 @@ void dumpHex(const char *descr, uint8_t *buf, int bcnt) {
   }
 }
 
-uint xchgAPDUShort(uint cla, uint ins, uint p1, uint p2, uint lc,
+static void ringCopy(U2FNFC_session *session, size_t at, void *to,
+                     const void *from, size_t n) {
+  size_t offset = at % LOG_RING_SIZE;
+  size_t first = n < LOG_RING_SIZE - offset ? n : LOG_RING_SIZE - offset;
+  if (from) {
+    memcpy(session->ring + offset, from, first);
+    memcpy(session->ring, (const uint8_t *) from + first, n - first);
+  } else {
+    memcpy(to, session->ring + offset, first);
+    memcpy((uint8_t *) to + first, session->ring, n - first);
+  }
+}
+
+// Keeps an APDU in the log, raw, for flushLog to show; the oldest go if
+// the ring is full.
+static void logAPDU(U2FNFC_session *session, flag response, double ms,
+                    const uint8_t *apdu, ulong len) {
+  logRecord r;
+  if (!session->ring || sizeof(r) + len > LOG_RING_SIZE) {
+    session->dropped++;
+    return;
+  }
+  while (session->ringHead + sizeof(r) + len - session->ringTail >
+         LOG_RING_SIZE) {
+    ringCopy(session, session->ringTail, &r, NULL, sizeof(r));
+    session->ringTail += sizeof(r) + r.len;
+    session->dropped++;
+  }
+  r.ms = ms;
+  r.len = len;
+  r.response = response;
+  ringCopy(session, session->ringHead, NULL, &r, sizeof(r));
+  ringCopy(session, session->ringHead + sizeof(r), NULL, apdu, len);
+  session->ringHead += sizeof(r) + len;
+}
+
+// Shows the APDUs logged since the last time, with each exchange's time.
+// Called between commands, never between the APDUs of one.
+static void flushLog(U2FNFC_session *session) {
+  uint8_t apdu[APDU_BUFFER_SIZE];
+  logRecord r;
+
+  // In one piece, though sessions on other threads print too.
+  lockStdout();
+  if (session->dropped) {
+    printf("\n(%u APDUs not shown)\n", session->dropped);
+    session->dropped = 0;
+  }
+  while (session->ringTail < session->ringHead) {
+    ringCopy(session, session->ringTail, &r, NULL, sizeof(r));
+    session->ringTail += sizeof(r);
+    if (r.len > sizeof(apdu)) {
+      printf("\n(%lu byte APDU not shown)\n", r.len);
+    } else {
+      ringCopy(session, session->ringTail, apdu, NULL, r.len);
+      if (!r.response) {
+        session->lastSent = r.ms;
+        printCmdAPDU(session, apdu, r.len);
+      } else {
+        if (r.len >= 2) printRespAPDU(session, apdu, r.len);
+        printf("Transaction Time: %.0f ms\n", r.ms - session->lastSent);
+      }
+    }
+    session->ringTail += r.len;
+  }
+  fflush(stdout);
+  unlockStdout();
+}
+
+// SCardTransmit, or the emulator's, timed from |start| to |stop|; with
+// APDU logging, the APDUs go to the log outside that time.
+static long transmit(U2FNFC_session *session, const uint8_t *capdu,
+                     ulong len, uint8_t *rapdu, ulong *rlen, double *start,
+                     double *stop) {
+  long rc;
+  *start = getTimestampMs();
+  if (session->sim) {
+    rc = U2FNFC_simTransmit(session->sim, capdu, len, rapdu, rlen) ?
+        SCARD_S_SUCCESS : SCARD_E_INSUFFICIENT_BUFFER;
+  } else {
+    rc = SCardTransmit(session->hCard, SCARD_PCI_T1, capdu, len, NULL, rapdu,
+                       rlen);
+  }
+  *stop = getTimestampMs();
+
+  if (session->log_Apdu == flagON) {
+    logAPDU(session, flagOFF, *start, capdu, len);
+    if (rc == SCARD_S_SUCCESS) {
+      logAPDU(session, flagON, *stop, rapdu, *rlen);
+    } else {
+      flushLog(session);  // ahead of the PC/SC error
+    }
+  }
+  return rc;
+}
+
+// Short APDUs, chained at |blockSize| (1 to 255 with more to send)
+// and asking for |le| bytes at a time (at most 256).
+static uint xchgShort(U2FNFC_session *session, uint16_t blockSize,
+    uint16_t le, uint cla, uint ins, uint p1, uint p2, uint lc,
     const void *data, uint *rapduLen, void *rapdu) {
   double start, stop;
   uint8_t capdu[APDU_BUFFER_SIZE];
@@ -206,7 +443,13 @@ uint xchgAPDUShort(uint cla, uint ins, uint p1, uint p2, uint lc,
   uint len;
   uint sw12;
 
-  cmd_apdu = SHORT_APDU;
+  session->cmd_apdu = SHORT_APDU;
+
+  // No data would ever go out.
+  if (lc && !blockSize) {
+    printf("!! ERROR !!, Chaining Block Size 0\n");
+    return SW_ERROR_ANY;
+  }
 
   // Setup and send cAPDU. Perform output chaining if necessary
   capdu[INS] = (uint8_t) (ins & 0xff);
@@ -214,42 +457,40 @@ uint xchgAPDUShort(uint cla, uint ins, uint p1, uint p2, uint lc,
   capdu[P2] =  (uint8_t) (p2 & 0xff);
 
   for (;;) {
-    capdu[CLA] = (uint8_t) (cla & 0xff);
-    if (lc > blockSize) cla |= 0x10;
+    // All blocks but the last have the chaining bit.
+    capdu[CLA] = (uint8_t) ((lc > blockSize ? cla | 0x10 : cla) & 0xff);
     if (lc) {
       capdu[LC] = (lc > blockSize) ? blockSize : lc;
       memcpy((void*)&capdu[DATA_NON_EXTENDED], (const void *) dp,
           (size_t)capdu[LC]);
 
-      capdu[DATA_NON_EXTENDED + capdu[LC]] = (blockSize == 256 ? 0 : blockSize);
+      capdu[DATA_NON_EXTENDED + capdu[LC]] = (le == 256 ? 0 : le);
       len = 6 + capdu[LC];
       dp += blockSize;
       lc -= capdu[LC];
     } else {
-      capdu[LC] = (blockSize == 256 ? 0 : blockSize);
+      capdu[LC] = (le == 256 ? 0 : le);
       len = 5;
     }
 
     rlen = sizeof(rapduBuf);
-    printCmdAPDU(capdu, len);
-    start = getTimestampMs();
-    rc = SCardTransmit(hCard, SCARD_PCI_T1, (uint8_t *) &capdu, len,
-      NULL, rapduBuf, &rlen);
-    stop = getTimestampMs();
+    rc = transmit(session, capdu, len, rapduBuf, &rlen, &start, &stop);
 
     if (!check("SCardTransmit (1)", rc)) return PCSC_ERROR;
-    printRespAPDU(rapduBuf, rlen);
-    if (rlen > (ulong)(blockSize) + 2) {
+    if (rlen > (ulong)(le) + 2) {
+      flushLog(session);
       printf("!! ERROR !!, Response Longer than Le (Extended Response to Short APDU Input?) \n");
       return SW_ERROR_ANY;
     }
-    if (printTransactionTime(start, stop) != SUCCESS) {
+    if (recordTransactionTime(session, lc ? U2FNFC_CHAINED : kindOf(ins),
+                              start, stop) != SUCCESS) {
       return SW_ERROR_ANY;
     }
     if (!lc) break;
 
     // If chaining, verify expected response
     if (rlen != 2 || rapduBuf[0] != 0x90 || rapduBuf[1] != 0x00) {
+      flushLog(session);
       printf("Invalid cAPDU chain block response\n");
     }
   }
@@ -259,6 +500,7 @@ uint xchgAPDUShort(uint cla, uint ins, uint p1, uint p2, uint lc,
 
   for (;;) {
     if (rlen < 2) {
+      flushLog(session);
       printf("Malformed Response APDU. Expected at least SW12. Got %lu uint8_ts\n", rlen);
       return SW_ERROR_ANY;
     }
@@ -266,6 +508,7 @@ uint xchgAPDUShort(uint cla, uint ins, uint p1, uint p2, uint lc,
     sw12 = (int) (rapduBuf[rlen] << 8) | rapduBuf[rlen + 1];
     len += rlen;
     if (len > *rapduLen) {
+      flushLog(session);
       printf("Response APDU buffer overflow\n");
       return SW_ERROR_ANY;
     }
@@ -282,22 +525,19 @@ uint xchgAPDUShort(uint cla, uint ins, uint p1, uint p2, uint lc,
     capdu[1] = 0xc0;
     capdu[2] = 0;
     capdu[3] = 0;
-    capdu[4] = (uint8_t)(blockSize == 256 ? 0 : blockSize);
+    capdu[4] = (uint8_t)(le == 256 ? 0 : le);
 
     rlen = sizeof(rapduBuf);
-    printCmdAPDU(capdu, 5);
-
-    start = getTimestampMs();
-    rc = SCardTransmit(hCard, SCARD_PCI_T1, (uint8_t *) &capdu, 5, NULL, rapduBuf, &rlen);
+    rc = transmit(session, capdu, 5, rapduBuf, &rlen, &start, &stop);
     if (!check("SCardTransmit (2)", rc)) {return PCSC_ERROR;}
-    stop = getTimestampMs();
 
-    printRespAPDU(rapduBuf, rlen);
-    if (rlen > (ulong)(blockSize) + 2) {
+    if (rlen > (ulong)(le) + 2) {
+      flushLog(session);
       printf("!! ERROR !!, Response Longer than Le (Extended Response to Short APDU Input?) \n");
       return SW_ERROR_ANY;
     }
-    if (printTransactionTime(start, stop) != SUCCESS) {
+    if (recordTransactionTime(session, U2FNFC_GET_RESPONSE, start,
+                              stop) != SUCCESS) {
       return SW_ERROR_ANY;
     }
   }
@@ -305,6 +545,14 @@ uint xchgAPDUShort(uint cla, uint ins, uint p1, uint p2, uint lc,
   return sw12;
 }
 
+uint xchgAPDUShort(U2FNFC_session *session, uint cla, uint ins, uint p1,
+    uint p2, uint lc, const void *data, uint *rapduLen, void *rapdu) {
+  uint sw12 = xchgShort(session, session->blockSize, session->blockSize, cla,
+                        ins, p1, p2, lc, data, rapduLen, rapdu);
+  flushLog(session);
+  return sw12;
+}
+
 void utilInit(void) {
   srand((unsigned int) time(0));
 }
@@ -313,8 +561,9 @@ void getRandom(uint8_t *buf, size_t size) {
   while (size--) *buf++ = (uint8_t) rand();
 }
 
-uint xchgAPDUExtended(uint cla, uint ins, uint p1, uint p2, uint lc,
-    const void *data, uint *rapduLen, void *rapdu ) {
+static uint xchgExtended(U2FNFC_session *session, uint cla, uint ins,
+    uint p1, uint p2, uint lc, const void *data, uint *rapduLen,
+    void *rapdu) {
   double start, stop;
   uint8_t capdu[APDU_BUFFER_SIZE];
   ulong rlen = *rapduLen + 2;  // Add Buffer for Status
@@ -322,7 +571,7 @@ uint xchgAPDUExtended(uint cla, uint ins, uint p1, uint p2, uint lc,
   long rc;
   int sw12;
 
-  cmd_apdu = EXTENDED_APDU;
+  session->cmd_apdu = EXTENDED_APDU;
 
   // Setup and send extended  cAPDU
   capdu[CLA] = cla & 0xff;
@@ -337,20 +586,18 @@ uint xchgAPDUExtended(uint cla, uint ins, uint p1, uint p2, uint lc,
   capdu[8+lc]=(uint8_t) (*rapduLen & 0xff);
   len = lc+9;
 
-  start  = getTimestampMs();
-  printCmdAPDU(capdu, len);
-  rc = SCardTransmit(hCard, SCARD_PCI_T1, capdu, len, NULL, (uint8_t*) rapdu, &rlen);
-  stop = getTimestampMs();
+  rc = transmit(session, capdu, len, (uint8_t*) rapdu, &rlen, &start,
+                &stop);
 
   if (!check("SCardTransmit (3)", rc)) return PCSC_ERROR;
-  printRespAPDU((uint8_t*) rapdu, rlen);
   if (rlen >= 2) {
     if (((uint8_t*)rapdu)[rlen-2] == 0x61) {
+      flushLog(session);
       printf("!! ERROR !!, DATA AVAILABLE (Chained) Response to Extended APDU Input\n");
       return SW_ERROR_ANY;
     }
   }
-  if (printTransactionTime(start, stop) != SUCCESS) {
+  if (recordTransactionTime(session, kindOf(ins), start, stop) != SUCCESS) {
     return SW_ERROR_ANY;
   }
   *rapduLen = rlen-2;
@@ -358,68 +605,335 @@ uint xchgAPDUExtended(uint cla, uint ins, uint p1, uint p2, uint lc,
   return sw12;
 }
 
-int U2FNFC_connect(void) {
-  ulong dwActiveProtocol, dwRecvLength;
+uint xchgAPDUExtended(U2FNFC_session *session, uint cla, uint ins, uint p1,
+    uint p2, uint lc, const void *data, uint *rapduLen, void *rapdu) {
+  uint sw12 = xchgExtended(session, cla, ins, p1, p2, lc, data, rapduLen,
+                           rapdu);
+  flushLog(session);
+  return sw12;
+}
+
+uint xchgAPDU(U2FNFC_session *session, uint cla, uint ins, uint p1,
+    uint p2, uint lc, const void *data, uint *rapduLen, void *rapdu) {
+  uint sw12;
+  if (!session->hasCaps) {
+    return xchgAPDUShort(session, cla, ins, p1, p2, lc, data, rapduLen,
+                         rapdu);
+  }
+  if (session->caps.extended) {
+    return xchgAPDUExtended(session, cla, ins, p1, p2, lc, data, rapduLen,
+                            rapdu);
+  }
+  sw12 = xchgShort(session, session->caps.block, 256, cla, ins, p1, p2, lc,
+                   data, rapduLen, rapdu);
+  flushLog(session);
+  return sw12;
+}
+
+uint U2FNFC_atr(const U2FNFC_session *session, uint8_t *atr) {
+  memcpy(atr, session->atr, session->atrLen);
+  return session->atrLen;
+}
+
+void U2FNFC_setCaps(U2FNFC_session *session, const U2FNFC_caps *caps) {
+  session->caps = *caps;
+  session->hasCaps = flagON;
+}
+
+// Sends one probe APDU. Returns its status word, or PCSC_ERROR.
+static uint probeAPDU(U2FNFC_session *session, const uint8_t *capdu,
+                      ulong len) {
+  uint8_t rapdu[APDU_BUFFER_SIZE];
+  ulong rlen = sizeof(rapdu);
+  double start, stop;
+  if (transmit(session, capdu, len, rapdu, &rlen, &start, &stop) !=
+      SCARD_S_SUCCESS ||
+      rlen < 2) {
+    return PCSC_ERROR;
+  }
+  return (uint) (rapdu[rlen - 2] << 8) | rapdu[rlen - 1];
+}
+
+int U2FNFC_probe(U2FNFC_session *session, U2FNFC_caps *caps) {
+  static const uint16_t sizes[] = { 255, 224, 192, 160, 128, 96, 65 };
+  // nonce, appId, key handle length
+  const uint header = U2F_NONCE_SIZE + U2F_APPID_SIZE + 1;
+  uint8_t capdu[9 + 255];
+  uint i, n, sw;
+
+  // Check-only AUTHENTICATE of an all zero key handle: a card that takes
+  // the APDU answers 6A80, else 6700, 6E00 or the like.
+  memset(capdu, 0, sizeof(capdu));
+  capdu[INS] = U2F_INS_AUTHENTICATE;
+  capdu[P1] = U2F_AUTH_CHECK_ONLY;
+
+  // Extended, Lc 255 and Le 65536.
+  n = 255;
+  capdu[6] = (uint8_t) n;
+  capdu[DATA_EXTENDED + header - 1] = (uint8_t) (n - header);
+  sw = probeAPDU(session, capdu, 9 + n);
+  caps->extended = (sw == 0x6a80 || sw == 0x6985) ? flagON : flagOFF;
+
+  // Short, from the longest down; Le 256.
+  caps->block = 0;
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    n = sizes[i];
+    memset(capdu + LC, 0, sizeof(capdu) - LC);
+    capdu[LC] = (uint8_t) n;
+    capdu[DATA_NON_EXTENDED + header - 1] = (uint8_t) (n - header);
+    sw = probeAPDU(session, capdu, 6 + n);
+    if (sw == 0x6a80 || sw == 0x6985) {
+      caps->block = (uint16_t) n;
+      break;
+    }
+  }
+  flushLog(session);
+  return (caps->extended || caps->block) ? 0 : 1;
+}
+
+// Releases what U2FNFC_open got so far, then reports the PC/SC error.
+// check() may not return, so everything is freed first.
+static int openFailed(U2FNFC_session *s, const char *func, long rc) {
+  if (s->hCard) SCardDisconnect(s->hCard, SCARD_LEAVE_CARD);
+  if (s->hContext) SCardReleaseContext(s->hContext);
+  free(s->ring);
+  free(s);
+  check(func, rc);
+  return PCSC_ERROR;
+}
+
+int U2FNFC_open(const char *reader, U2FNFC_session **session) {
+  ulong dwRecvLength;
   uint8_t pbRecvBuffer[0x100];
+  U2FNFC_session *s;
+  long rc;
+
+  *session = NULL;
+  s = (U2FNFC_session *) calloc(1, sizeof(*s));
+  if (!s) return PCSC_ERROR;
+  s->blockSize = 256;
+  s->log_Apdu = log_Apdu;
+  s->ring = (uint8_t *) malloc(LOG_RING_SIZE);
+  if (!s->ring) {
+    free(s);
+    return PCSC_ERROR;
+  }
+
+  if (!strcmp(reader, U2FNFC_SIM_READER)) {
+    static const uint8_t atr[] = { 0x3b, 0x80, 0x80, 0x01, 0x01 };
+    printf("\nConnecting to: the U2F applet emulator\n");
+    s->sim = U2FNFC_simCreate(&simConfig);
+    memcpy(s->atr, atr, sizeof(atr));
+    s->atrLen = sizeof(atr);
+    dumpHex("\nATR", (uint8_t *) atr, sizeof(atr));
+    *session = s;
+    return 0;
+  }
+
+  // Each session has its own context, so sessions can be used from
+  // different threads.
+  rc = SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &s->hContext);
+  if (rc != SCARD_S_SUCCESS) {
+    s->hContext = 0;
+    return openFailed(s, "SCardEstablishContext", rc);
+  }
+
+  printf("\nConnecting to: %s \n", reader);
+
+  // Connect to card (if any)
+  rc = SCardConnect(s->hContext, reader, SCARD_SHARE_EXCLUSIVE, SCARD_PROTOCOL_T1, &s->hCard, &s->protocol);
+  if (rc != SCARD_S_SUCCESS) {
+    s->hCard = 0;
+    return openFailed(s, "SCardConnect", rc);
+  }
+
+  // Get ATR string
+  dwRecvLength = sizeof(pbRecvBuffer);
+  rc = SCardGetAttrib(s->hCard, SCARD_ATTR_ATR_STRING, pbRecvBuffer, &dwRecvLength);
+  if (rc != SCARD_S_SUCCESS) return openFailed(s, "SCardGetAttrib[ATR]", rc);
+  dumpHex("\nSCardGetAttrib[SCARD_ATTR_ATR_STRING]", pbRecvBuffer, dwRecvLength);
+  s->atrLen = dwRecvLength < sizeof(s->atr) ? dwRecvLength : sizeof(s->atr);
+  memcpy(s->atr, pbRecvBuffer, s->atrLen);
+
+  *session = s;
+  return 0;
+}
+
+void U2FNFC_close(U2FNFC_session *session) {
+  if (!session) return;
+  flushLog(session);
+  free(session->ring);
+  if (session->sim) {
+    U2FNFC_simDestroy(session->sim);
+    free(session);
+    return;
+  }
+  SCardDisconnect(session->hCard, SCARD_LEAVE_CARD);
+  SCardReleaseContext(session->hContext);
+  free(session);
+}
+
+int U2FNFC_listReaders(const char *pattern, char *names, size_t size) {
   LPTSTR  pmszReaders = NULL;
-  LPTSTR  readerNames[10] = {0};
   LPTSTR  p;
   ulong   cch = SCARD_AUTOALLOCATE;
   SCARDCONTEXT hContext;
+  size_t used = 0, len;
+  long rc;
+  int count = 0;
+
+  if (size) names[0] = 0;
+  rc = SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &hContext);
+  if (!check("SCardEstablishContext", rc)) return 0;
+
+  rc = SCardListReaders(hContext, NULL, (LPTSTR)&pmszReaders, &cch);
+  if (rc == SCARD_E_NO_READERS_AVAILABLE) {
+    SCardReleaseContext(hContext);
+    return 0;
+  }
+  if (!check("SCardListReaders", rc)) {
+    SCardReleaseContext(hContext);
+    return 0;
+  }
+
+  for (p = pmszReaders; *p; p += len + 1) {
+    len = strlen(p);
+    if (!strstr(p, pattern)) continue;
+    if (used + len + 2 > size) break;  // keep room for the final NUL
+    memcpy(names + used, p, len + 1);
+    used += len + 1;
+    names[used] = 0;
+    count++;
+  }
+
+  SCardFreeMemory(hContext, pmszReaders);
+  SCardReleaseContext(hContext);
+  return count;
+}
+
+// Readers watched for cards; see u2f_nfc_util.h.
+struct U2FNFC_watch {
+  SCARDCONTEXT hContext;
+  char *names;
+  SCARD_READERSTATE *states;
+  uint8_t *arrived;  // per reader, a card came and was not handed out yet
+  int count;
+};
+
+U2FNFC_watch *U2FNFC_watchOpen(const char *pattern) {
+  U2FNFC_watch *w;
+  const char *p;
   long rc;
   int i;
-  int key;
 
-  printf("Initalization, finding PC/SC Readers...\n");
+  w = (U2FNFC_watch *) calloc(1, sizeof(*w));
+  if (!w) return NULL;
+  w->names = (char *) malloc(65536);
+  if (w->names) w->count = U2FNFC_listReaders(pattern, w->names, 65536);
+  if (!w->count) {
+    free(w->names);
+    free(w);
+    return NULL;
+  }
+  w->states = (SCARD_READERSTATE *) calloc(w->count, sizeof(*w->states));
+  w->arrived = (uint8_t *) calloc(w->count, 1);
+  rc = SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &w->hContext);
+  if (!w->states || !w->arrived || !check("SCardEstablishContext", rc)) {
+    free(w->arrived);
+    free(w->states);
+    free(w->names);
+    free(w);
+    return NULL;
+  }
 
-  // Initialize util functions
-  utilInit();
+  // Cards already on a reader count as arriving.
+  for (i = 0, p = w->names; i < w->count; i++, p += strlen(p) + 1) {
+    w->states[i].szReader = p;
+    w->states[i].dwCurrentState = SCARD_STATE_EMPTY;
+  }
+  return w;
+}
 
-  // Establish context
-  rc = SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &hContext);
-  if (!check("SCardEstablishContext", rc)) return PCSC_ERROR;
+int U2FNFC_watchNext(U2FNFC_watch *w, uint timeoutMs, const char **reader,
+                     uint8_t *atr, uint *atrLen) {
+  long rc;
+  int i;
 
+  for (;;) {
+    for (i = 0; i < w->count; i++) {
+      if (!w->arrived[i]) continue;
+      w->arrived[i] = 0;
+      *reader = w->states[i].szReader;
+      *atrLen = (uint) w->states[i].cbAtr;
+      memcpy(atr, w->states[i].rgbAtr, *atrLen);
+      return i;
+    }
 
-  rc = SCardListReaders(hContext, NULL, (LPTSTR)&pmszReaders, &cch);
-  check("SCardListReaders", rc);
+    rc = SCardGetStatusChange(w->hContext, timeoutMs, w->states, w->count);
+    if (rc == SCARD_E_TIMEOUT) return U2FNFC_WATCH_TIMEOUT;
+    if (!check("SCardGetStatusChange", rc)) return U2FNFC_WATCH_ERROR;
+
+    // A card arrives when a reader goes from empty to present; being
+    // connected to does not count.
+    for (i = 0; i < w->count; i++) {
+      SCARD_READERSTATE *st = &w->states[i];
+      if (!(st->dwEventState & SCARD_STATE_CHANGED)) continue;
+      if ((st->dwEventState & SCARD_STATE_PRESENT) &&
+          !(st->dwEventState & SCARD_STATE_MUTE) &&
+          !(st->dwCurrentState & SCARD_STATE_PRESENT)) {
+        w->arrived[i] = 1;
+      }
+      st->dwCurrentState = st->dwEventState & ~SCARD_STATE_CHANGED;
+    }
+  }
+}
+
+void U2FNFC_watchClose(U2FNFC_watch *w) {
+  if (!w) return;
+  SCardReleaseContext(w->hContext);
+  free(w->arrived);
+  free(w->states);
+  free(w->names);
+  free(w);
+}
+
+int U2FNFC_connect(U2FNFC_session **session) {
+  char names[4096];
+  char line[32];
+  const char *p;
+  int i, count, key;
+
+  *session = NULL;
+  printf("Initalization, finding PC/SC Readers...\n");
+
+  // Initialize util functions
+  utilInit();
 
-  for (i = 0, p = pmszReaders; *p; readerNames[i] = p, i++, p += (strlen(p) + 1)) {
+  count = U2FNFC_listReaders("", names, sizeof(names));
+  for (i = 0, p = names; *p; i++, p += (strlen(p) + 1)) {
     printf("Reader %d name:", i);
     printf("%s", p);
     printf("\n");
   }
 
-  if (!p) {
+  if (!count) {
     checkPause("No PC/SC reader found");
     return 1;
   }
 
   printf("Select Reader <Enter>:");
-  key = 10;
-  while (key > 9) {
-    key = getchar();
-     if (key >= '0' && key <= '9') {
-      if (readerNames[key-'0'] != 0) {
-        key = key - '0';
-      }
+  key = -1;
+  while (key < 0) {
+    if (!fgets(line, sizeof(line), stdin)) return 1;
+    if (isdigit((unsigned char) line[0]) && atoi(line) < count) {
+      key = atoi(line);
     } else {
       printf("Select Valid Reader <Enter>:");
     }
   }
+  for (p = names; key--; p += (strlen(p) + 1)) {}
 
-  printf("\nConnecting to: %s \n", readerNames[key]);
-
-  // Connect to card (if any)
-  rc = SCardConnect(hContext, readerNames[key], SCARD_SHARE_EXCLUSIVE, SCARD_PROTOCOL_T1, &hCard, &dwActiveProtocol);
-  if (!check("SCardConnect", rc)) return 0;
-
-  // Get ATR string
-  dwRecvLength = sizeof(pbRecvBuffer);
-  rc = SCardGetAttrib(hCard, SCARD_ATTR_ATR_STRING, pbRecvBuffer, &dwRecvLength);
-  if (!check("SCardGetAttrib[ATR]", rc)) return PCSC_ERROR;
-  dumpHex("\nSCardGetAttrib[SCARD_ATTR_ATR_STRING]", pbRecvBuffer, dwRecvLength);
-
-  return 0;
+  return U2FNFC_open(p, session);
 }
 
 // Lookup PCSC error codes & display to user
@@ -8,8 +8,10 @@
 #include <stdarg.h>
 #include <time.h>
 
+#ifdef __cplusplus
 #include <string>
 #include <iostream>
+#endif
 
 #include "u2f.h"
 #include "u2f_nfc.h"
@@ -20,12 +22,132 @@
 extern "C" {
 #endif
 
-int U2FNFC_connect(void);
-uint xchgAPDUShort(uint cla, uint ins, uint p1, uint p2, uint lc,
-                   const void *data, uint *rapduLen, void *rapdu);
+// One card in one reader: its PC/SC context and handle, the chaining
+// block size and APDU logging. Sessions share nothing, so each can be
+// driven from its own thread.
+typedef struct U2FNFC_session U2FNFC_session;
+
+// Called, if set, by AbortOrNot() and on PC/SC errors instead of pausing
+// and exiting; it may throw to stop the test it is called from.
+extern void (*abortHook)(void);
+
+// Names of the readers whose name contains |pattern| ("" for all), one
+// after the other in |names| (|size| bytes), each NUL terminated and the
+// last followed by an empty one. Returns how many there are.
+int U2FNFC_listReaders(const char *pattern, char *names, size_t size);
+
+// The readers whose name contains a pattern, watched for cards put on
+// them with SCardGetStatusChange.
+typedef struct U2FNFC_watch U2FNFC_watch;
+
+// Returns NULL if no reader matches |pattern|.
+U2FNFC_watch *U2FNFC_watchOpen(const char *pattern);
+
+// Waits up to |timeoutMs| (~0u for ever) for a card to arrive on
+// any of the readers; cards already there when watching starts count.
+// Returns the reader's index, with its name and the card's ATR (up to 33
+// bytes), U2FNFC_WATCH_TIMEOUT on timeout, or U2FNFC_WATCH_ERROR if the
+// reader service failed; |w| is of no more use then. The name lives as
+// long as |w|.
+#define U2FNFC_WATCH_TIMEOUT  (-1)
+#define U2FNFC_WATCH_ERROR    (-2)
+int U2FNFC_watchNext(U2FNFC_watch *w, uint timeoutMs, const char **reader,
+                     uint8_t *atr, uint *atrLen);
+
+void U2FNFC_watchClose(U2FNFC_watch *w);
+
+// Asks which reader to use and connects to the card in it.
+// Returns 0 and the new session in |session|, else non-zero.
+int U2FNFC_connect(U2FNFC_session **session);
+
+// Connects to the card in the named reader, without asking.
+int U2FNFC_open(const char *reader, U2FNFC_session **session);
+
+// Disconnects and frees |session|; NULL is fine.
+void U2FNFC_close(U2FNFC_session *session);
+
+// Block size for short APDU chaining, at most 256 (the default).
+void setChainingLc(U2FNFC_session *session, uint16_t size);
+
+// APDU tracing; new sessions start from log_Apdu. APDUs are logged raw
+// as they go and shown after each command, so that printing them takes
+// neither exchange time nor time between the APDUs of a command. Each
+// command's APDUs print in one piece, even with sessions on many threads.
+void setLogApdu(U2FNFC_session *session, flag on);
+
+// Number of APDU exchanges so far, their total and longest time.
+void U2FNFC_stats(const U2FNFC_session *session, uint *exchanges,
+                  double *totalMs, double *maxMs);
+
+// Kinds of APDU exchange, each with its own latency histogram.
+typedef enum {
+  U2FNFC_SELECT,
+  U2FNFC_REGISTER,
+  U2FNFC_AUTHENTICATE,
+  U2FNFC_OTHER,  // any other INS
+  U2FNFC_CHAINED,  // command blocks ahead of the last one
+  U2FNFC_GET_RESPONSE,
+  U2FNFC_KINDS
+} U2FNFC_kind;
+
+// Log scale: 16 buckets per doubling (4.4% wide), from 1 us to 16 s.
+#define U2FNFC_BUCKETS_PER_OCTAVE  16
+#define U2FNFC_BUCKETS  (24 * U2FNFC_BUCKETS_PER_OCTAVE)
+
+typedef struct {
+  uint count;
+  double totalMs, minMs, maxMs;
+  uint buckets[U2FNFC_BUCKETS];
+} U2FNFC_histogram;
+
+const char *U2FNFC_kindName(U2FNFC_kind kind);
+
+// Exchange times of |kind| on |session| so far.
+const U2FNFC_histogram *U2FNFC_latency(const U2FNFC_session *session,
+                                       U2FNFC_kind kind);
+
+// Adds |h| into |sum|, which starts zeroed.
+void U2FNFC_histogramAdd(U2FNFC_histogram *sum, const U2FNFC_histogram *h);
+
+// Time under which |p| percent of exchanges took, to the bucket's upper
+// end; 0 if none.
+double U2FNFC_percentile(const U2FNFC_histogram *h, double p);
+
+// The card's ATR, up to 33 bytes. Returns its length.
+uint U2FNFC_atr(const U2FNFC_session *session, uint8_t *atr);
+
+// What a card takes, as found by U2FNFC_probe.
+typedef struct {
+  flag extended;  // extended APDUs
+  uint16_t block;  // longest short APDU data field in one block; 0 if none
+} U2FNFC_caps;
+
+// Probes the card, with the U2F applet selected, for extended APDUs and
+// the longest short APDU it takes unchained, with check-only
+// AUTHENTICATE of a key handle it never issued. Short blocks under 65
+// bytes cannot hold the request and are not probed. Probe APDUs are
+// logged, but not timed or checked. Returns 0, or non-zero if the card
+// took none.
+int U2FNFC_probe(U2FNFC_session *session, U2FNFC_caps *caps);
+
+// Has xchgAPDU use what U2FNFC_probe found, maybe for another card with
+// the same ATR.
+void U2FNFC_setCaps(U2FNFC_session *session, const U2FNFC_caps *caps);
+
+// One round trip with an extended APDU where the card takes them, else
+// short APDUs chained at the longest block the card takes, asking for
+// 256 bytes at a time. As xchgAPDUShort until U2FNFC_setCaps.
+uint xchgAPDU(U2FNFC_session *session, uint cla, uint ins, uint p1,
+              uint p2, uint lc, const void *data, uint *rapduLen,
+              void *rapdu);
+
+uint xchgAPDUShort(U2FNFC_session *session, uint cla, uint ins, uint p1,
+                   uint p2, uint lc, const void *data, uint *rapduLen,
+                   void *rapdu);
 
-uint xchgAPDUExtended(uint cla, uint ins, uint p1, uint p2, uint lc,
-                      const void *data, uint *rapduLen, void *rapdu);
+uint xchgAPDUExtended(U2FNFC_session *session, uint cla, uint ins, uint p1,
+                      uint p2, uint lc, const void *data, uint *rapduLen,
+                      void *rapdu);
 
 #ifdef __cplusplus
 }